@@ -9,54 +9,258 @@
 #include <numeric>
 #include <stdexcept>
 
-Magick::Image get_lightness_channel(const std::string& filename);
-Histogram compute_lightness_histogram(const Magick::Image& lightnessChannel);
-
-std::optional<Histogram> image_get_histogram(const std::string& filename) {
-	Magick::Image lightnessChannel{};
+#include "colour.hpp"
+#include "decode.hpp"
+#include "equalisation.hpp"
+#include "histogram.hpp"
+#include "image_cache.hpp"
+#include "sampling.hpp"
+#include "stream.hpp"
+#include "thread_pool.hpp"
+#include "tiff.hpp"
+
+Magick::Image read_image(const std::string& filename);
+Magick::Image get_lightness_channel(Magick::Image image);
+SampledHistogram compute_lightness_histogram(const Magick::Image& lightnessChannel,
+                                             const SampleGrid& grid, std::size_t bandCount);
+SampledHistogram compute_native_lightness_histogram(const Magick::Image& image,
+                                                    const SampleGrid& grid, std::size_t bandCount);
+std::optional<SampledHistogram> stream_lightness_histogram(const std::string& filename,
+                                                           std::uint64_t sampleBudget,
+                                                           std::size_t bandCount);
+SampledHistogram decoded_image_histogram(const Magick::Image& image, std::uint64_t sampleBudget,
+                                         std::size_t bandCount);
+ImageData equalise_decoded_image(Magick::Image& image, const EqualisationLookupTable& lookupTable,
+                                 std::size_t bandCount, const OutputEncoding& outputEncoding);
+Histogram proportional_histogram(const HistogramCounts& histogram, double pixelCount);
+
+std::optional<SampledHistogram> image_get_histogram(const std::string& filename,
+                                                    const std::uint64_t sampleBudget,
+                                                    const std::size_t decodeSize,
+                                                    const std::size_t bandCount,
+                                                    DecodedImageCache* imageCache) {
+	Magick::Image image{};
 
 	try {
-		lightnessChannel = get_lightness_channel(filename);
+		if (decodeSize == 0 && NATIVE_COLOUR_CONVERSION && should_stream_image(filename)) {
+			auto histogram = stream_lightness_histogram(filename, sampleBudget, bandCount);
+
+			if (histogram) {
+				return histogram;
+			}
+		}
+
+		if (decodeSize == 0) {
+			image = read_image(filename);
+
+			if (imageCache != nullptr) {
+				imageCache->insert(filename, image);
+			}
+		} else {
+			image = read_reduced_image(filename, decodeSize);
+		}
+
+		return decoded_image_histogram(image, sampleBudget, bandCount);
 	} catch (Magick::Exception& error) {
 		return std::nullopt;
 	}
+}
+
+SampledHistogram decoded_image_histogram(const Magick::Image& image,
+                                         const std::uint64_t sampleBudget,
+                                         const std::size_t bandCount) {
+	const SampleGrid grid = SampleGrid::for_budget(image.columns(), image.rows(), sampleBudget);
+
+	if (NATIVE_COLOUR_CONVERSION && native_colour_conversion_supported(image)) {
+		return compute_native_lightness_histogram(image, grid, bandCount);
+	}
 
-	return compute_lightness_histogram(lightnessChannel);
+	return compute_lightness_histogram(get_lightness_channel(image), grid, bandCount);
 }
 
-Magick::Image get_lightness_channel(const std::string& filename) {
+Magick::Image read_image(const std::string& filename) {
 	Magick::Image image{};
 
 	try {
 		image.read(filename);
+	} catch (Magick::Exception& error) {
+		std::cerr << "Error loading input: " << error.what() << std::endl;
+		throw;
+	}
 
+	return image;
+}
+
+Magick::Image get_lightness_channel(Magick::Image image) {
+	try {
 		image.colorSpace(Magick::LabColorspace);
 		image.channel(Magick::ChannelType::LChannel);
 	} catch (Magick::Exception& error) {
-		std::cerr << "Error loading input: " << error.what() << std::endl;
+		std::cerr << "Error converting input: " << error.what() << std::endl;
 		throw;
 	}
 
 	return image;
 }
 
-std::array<float, HISTOGRAM_SEGMENTS>
-compute_lightness_histogram(const Magick::Image& lightnessChannel) {
-	const Magick::Quantum* pixels =
-	    lightnessChannel.getConstPixels(0, 0, lightnessChannel.columns(), lightnessChannel.rows());
-	std::array<uint64_t, HISTOGRAM_SEGMENTS> histogram{};
+// Splits sampled rows [firstIndex, endIndex) into (up to) `bandCount` bands run on the shared
+// thread pool. Each band accumulates a private histogram with `accumulateBand(firstIndex, endIndex,
+// counts)`, returning how many pixels it sampled, and the band histograms are added to `histogram`
+// once all are complete. Returns the total number of pixels sampled.
+template <typename BandFunction>
+std::uint64_t accumulate_row_bands(const std::size_t firstIndex, const std::size_t endIndex,
+                                   const std::size_t bandCount, HistogramCounts& histogram,
+                                   BandFunction&& accumulateBand) {
+	const size_t sampledRows = endIndex - firstIndex;
+	const size_t bands = row_band_count(sampledRows, bandCount);
+	std::vector<HistogramCounts> bandHistograms(bands);
+	std::vector<std::uint64_t> bandSampleCounts(bands);
+
+	ThreadPool::shared().parallel_for(bands, [&](const std::size_t band) {
+		const auto [bandFirstIndex, bandEndIndex] = band_range(sampledRows, bands, band);
+		bandSampleCounts[band] = accumulateBand(firstIndex + bandFirstIndex, firstIndex + bandEndIndex,
+		                                        bandHistograms[band]);
+	});
+
+	std::uint64_t sampleCount = 0;
 
-	for (size_t y = 0; y < lightnessChannel.rows(); y++) {
-		for (size_t x = 0; x < lightnessChannel.columns(); x++) {
-			const float pixel = pixels[x + y * lightnessChannel.columns()] / QuantumRange;
-			const float bucket = std::round(pixel * (HISTOGRAM_SEGMENTS - 1));
-			histogram[static_cast<uint32_t>(bucket)]++;
+	for (size_t band = 0; band < bands; band++) {
+		for (size_t i = 0; i < HISTOGRAM_SEGMENTS; i++) {
+			histogram[i] += bandHistograms[band][i];
 		}
+
+		sampleCount += bandSampleCounts[band];
+	}
+
+	return sampleCount;
+}
+
+SampledHistogram sampled_histogram(const SampleGrid& grid, const HistogramCounts& histogram,
+                                   const std::uint64_t sampleCount) {
+	const double cdfErrorBound =
+	    grid.samples_every_pixel() ? 0.0 : histogram_cdf_error_bound(sampleCount);
+
+	return SampledHistogram{ proportional_histogram(histogram, static_cast<double>(sampleCount)),
+		                       sampleCount, cdfErrorBound };
+}
+
+SampledHistogram compute_lightness_histogram(const Magick::Image& lightnessChannel,
+                                             const SampleGrid& grid, const std::size_t bandCount) {
+	const size_t columns = lightnessChannel.columns();
+	const Magick::Quantum* pixels = lightnessChannel.getConstPixels(0, 0, columns, grid.rows);
+	HistogramCounts histogram{};
+
+	const std::uint64_t sampleCount = accumulate_row_bands(
+	    0, grid.sampled_rows(), bandCount, histogram,
+	    [&grid, columns, pixels](const size_t firstIndex, const size_t endIndex,
+	                             HistogramCounts& bandHistogram) {
+		    std::vector<Magick::Quantum> samples{};
+		    std::uint64_t bandSampleCount = 0;
+
+		    for (size_t index = firstIndex; index < endIndex; index++) {
+			    const size_t row = grid.sampled_row(index);
+			    const size_t rowSampleCount = grid.columns_in_row(row);
+
+			    accumulate_quantum_histogram(grid.gather_row(pixels + row * columns, row, 1, samples),
+			                                 rowSampleCount, bandHistogram);
+			    bandSampleCount += rowSampleCount;
+		    }
+
+		    return bandSampleCount;
+	    });
+
+	return sampled_histogram(grid, histogram, sampleCount);
+}
+
+// Accumulates the native lightness of sampled rows [firstIndex, endIndex) of `grid` into
+// `histogram`, from interleaved sRGB or grayscale `pixels` starting at image row `firstRow`.
+std::uint64_t accumulate_native_lightness_rows(const SampleGrid& grid, const std::size_t channels,
+                                               const Magick::Quantum* pixels,
+                                               const std::size_t firstRow,
+                                               const std::size_t firstIndex,
+                                               const std::size_t endIndex,
+                                               HistogramCounts& histogram) {
+	std::vector<Magick::Quantum> samples{};
+	std::vector<Magick::Quantum> lightnessRow(grid.columns);
+	std::uint64_t sampleCount = 0;
+
+	for (size_t index = firstIndex; index < endIndex; index++) {
+		const size_t row = grid.sampled_row(index);
+		const size_t rowSampleCount = grid.columns_in_row(row);
+		const Magick::Quantum* rowSamples = grid.gather_row(
+		    pixels + (row - firstRow) * grid.columns * channels, row, channels, samples);
+
+		srgb_to_lightness(rowSamples, rowSampleCount, channels, lightnessRow.data());
+		accumulate_quantum_histogram(lightnessRow.data(), rowSampleCount, histogram);
+		sampleCount += rowSampleCount;
 	}
 
-	std::array<float, HISTOGRAM_SEGMENTS> proportionalHistogram{};
-	const double pixelCount =
-	    static_cast<double>(lightnessChannel.rows()) * lightnessChannel.columns();
+	return sampleCount;
+}
+
+// Computes the lightness histogram directly from sRGB pixels, a row at a time, without building a
+// Lab image. Only the sampled pixels of each row are converted.
+SampledHistogram compute_native_lightness_histogram(const Magick::Image& image,
+                                                    const SampleGrid& grid,
+                                                    const std::size_t bandCount) {
+	const size_t channels = image.channels();
+	const Magick::Quantum* pixels = image.getConstPixels(0, 0, grid.columns, grid.rows);
+	HistogramCounts histogram{};
+
+	const std::uint64_t sampleCount = accumulate_row_bands(
+	    0, grid.sampled_rows(), bandCount, histogram,
+	    [&grid, channels, pixels](const size_t firstIndex, const size_t endIndex,
+	                              HistogramCounts& bandHistogram) {
+		    return accumulate_native_lightness_rows(grid, channels, pixels, 0, firstIndex, endIndex,
+		                                            bandHistogram);
+	    });
+
+	return sampled_histogram(grid, histogram, sampleCount);
+}
+
+// Computes the native lightness histogram of a large image as it is streamed, a band of rows at a
+// time, so that the image is never held whole. Returns nothing if the image cannot be streamed, or
+// is not in a colour space the native conversion supports.
+std::optional<SampledHistogram> stream_lightness_histogram(const std::string& filename,
+                                                           const std::uint64_t sampleBudget,
+                                                           const std::size_t bandCount) {
+	std::optional<SampleGrid> grid{};
+	HistogramCounts histogram{};
+	std::uint64_t sampleCount = 0;
+
+	const bool streamed = stream_image_bands(
+	    filename, [&](const StreamFormat& format, const Magick::Quantum* pixels,
+	                  const std::size_t firstRow, const std::size_t rowCount) {
+		    if (!grid) {
+			    if (!native_colour_conversion_supported(format.colorspace, format.channels,
+			                                            format.alpha)) {
+				    return false;
+			    }
+
+			    grid = SampleGrid::for_budget(format.columns, format.rows, sampleBudget);
+		    }
+
+		    sampleCount += accumulate_row_bands(
+		        grid->sampled_index_from(firstRow), grid->sampled_index_from(firstRow + rowCount),
+		        bandCount, histogram,
+		        [&grid, &format, pixels, firstRow](const size_t firstIndex, const size_t endIndex,
+		                                           HistogramCounts& bandHistogram) {
+			        return accumulate_native_lightness_rows(*grid, format.channels, pixels, firstRow,
+			                                                firstIndex, endIndex, bandHistogram);
+		        });
+
+		    return true;
+	    });
+
+	if (!streamed) {
+		return std::nullopt;
+	}
+
+	return sampled_histogram(*grid, histogram, sampleCount);
+}
+
+Histogram proportional_histogram(const HistogramCounts& histogram, const double pixelCount) {
+	Histogram proportionalHistogram{};
 
 	for (size_t i = 0; i < HISTOGRAM_SEGMENTS; i++) {
 		proportionalHistogram[i] = histogram[i] / pixelCount;
@@ -149,72 +353,118 @@ EqualisationHistogramMapping get_equalisation_parameters(const Histogram& previo
 	return mapping;
 }
 
-double lerp(double a, double b, double t) {
-	return a + (b - a) * t;
+// With a sink, each band is written to it as soon as it is encoded, and only the end of the file is
+// returned
+std::optional<std::vector<std::uint8_t>> stream_equalise(const std::string& filename,
+                                                         const EqualisationLookupTable& lookupTable,
+                                                         const std::size_t bandCount,
+                                                         ImageSink* sink) {
+	std::optional<TiffEncoder> encoder{};
+
+	const bool streamed = stream_image_bands(
+	    filename, [&](const StreamFormat& format, Magick::Quantum* pixels, const std::size_t,
+	                  const std::size_t rowCount) {
+		    if (!encoder) {
+			    if (!native_equalisation_supported(format.colorspace, format.channels, format.alpha)) {
+				    return false;
+			    }
+
+			    encoder.emplace(format.columns, format.rows, format.channels,
+			                    (format.depth > 8) ? 16 : 8, format.icc_profile);
+		    }
+
+		    equalise_srgb_rows(pixels, format.columns, rowCount, format.channels, lookupTable,
+		                       bandCount);
+		    encoder->write_rows(pixels, rowCount);
+
+		    if (sink != nullptr) {
+			    sink->write(ImageData{ encoder->take_output() });
+		    }
+
+		    return true;
+	    });
+
+	if (!streamed) {
+		return std::nullopt;
+	}
+
+	return encoder->finish();
 }
 
-Magick::Quantum linear_map(Magick::Quantum value, const EqualisationHistogramMapping& mapping) {
-	const double histogramBin = (static_cast<double>(value) / static_cast<double>(QuantumRange)) *
-	                            static_cast<double>(mapping.size() - 1);
-	const uint32_t histogramBinRounded = static_cast<size_t>(round(histogramBin));
-	const double errorDelta = histogramBin - static_cast<double>(histogramBinRounded);
-	const double baseValue = mapping[histogramBinRounded];
-	const double belowValue = mapping[(histogramBinRounded == 0) ? 0 : (histogramBinRounded - 1)];
-	const double aboveValue =
-	    mapping[(histogramBinRounded >= mapping.size() - 1) ? histogramBinRounded
-	                                                        : (histogramBinRounded + 1)];
+// Equalises an image, writing whatever part of it is streamed to `sink`, if given, and returning
+// the rest
+ImageData equalise_image_to(ImageSink* sink, const std::string& filename,
+                            const EqualisationHistogramMapping& mapping,
+                            const std::size_t bandCount, DecodedImageCache* imageCache,
+                            const OutputEncoding& outputEncoding) {
+	const EqualisationLookupTable lookupTable{ mapping };
+	std::optional<Magick::Image> cachedImage =
+	    (imageCache != nullptr) ? imageCache->take(filename) : std::nullopt;
+
+	if (!cachedImage && NATIVE_LAB_EQUALISATION && outputEncoding.codec == OutputCodec::Tiff &&
+	    should_stream_image(filename)) {
+		auto equalised = stream_equalise(filename, lookupTable, bandCount, sink);
+
+		if (equalised) {
+			return ImageData{ std::move(*equalised) };
+		}
 
-	assert((belowValue <= baseValue && aboveValue >= baseValue));
+		// An abandoned stream may already have written bands, which the decoded image replaces
+		if (sink != nullptr) {
+			sink->restart();
+		}
+	}
 
-	// What value needs to be interpolated with the current value
-	double interpolateValue = 0.0;
+	Magick::Image image = cachedImage ? std::move(*cachedImage) : read_image(filename);
 
-	if (errorDelta >= 0.0) {
-		interpolateValue = aboveValue;
-	} else {
-		interpolateValue = belowValue;
-	}
+	return equalise_decoded_image(image, lookupTable, bandCount, outputEncoding);
+}
 
-	const auto absErrorDelta = abs(errorDelta);
+ImageData image_equalise(const std::string& filename, const EqualisationHistogramMapping& mapping,
+                         const std::size_t bandCount, DecodedImageCache* imageCache,
+                         const OutputEncoding& outputEncoding) {
+	return equalise_image_to(nullptr, filename, mapping, bandCount, imageCache, outputEncoding);
+}
 
-	// Linearly interpolate between the base value and the interpolated value.
-	return static_cast<Magick::Quantum>(lerp(baseValue, interpolateValue, absErrorDelta));
+void image_equalise(ImageSink& sink, const std::string& filename,
+                    const EqualisationHistogramMapping& mapping, const std::size_t bandCount,
+                    DecodedImageCache* imageCache, const OutputEncoding& outputEncoding) {
+	sink.write(equalise_image_to(&sink, filename, mapping, bandCount, imageCache, outputEncoding));
 }
 
-std::vector<std::uint8_t> image_equalise(const std::string& filename,
-                                         const EqualisationHistogramMapping& mapping) {
-	Magick::Image image{};
+FusedEqualisation image_histogram_equalise(const std::string& filename,
+                                           const std::optional<Histogram>& previousHistogram,
+                                           const std::uint64_t sampleBudget,
+                                           const std::size_t bandCount,
+                                           DecodedImageCache* imageCache,
+                                           const OutputEncoding& outputEncoding) {
+	std::optional<Magick::Image> cachedImage =
+	    (imageCache != nullptr) ? imageCache->take(filename) : std::nullopt;
+	Magick::Image image = cachedImage ? std::move(*cachedImage) : read_image(filename);
+
+	SampledHistogram histogram = decoded_image_histogram(image, sampleBudget, bandCount);
+	const EqualisationHistogramMapping mapping =
+	    previousHistogram ? get_equalisation_parameters(*previousHistogram, histogram.histogram)
+	                      : identity_equalisation_histogram_mapping();
+	const EqualisationLookupTable lookupTable{ mapping };
+
+	return FusedEqualisation{ histogram,
+		                        equalise_decoded_image(image, lookupTable, bandCount, outputEncoding) };
+}
 
+ImageData equalise_decoded_image(Magick::Image& image, const EqualisationLookupTable& lookupTable,
+                                 const std::size_t bandCount,
+                                 const OutputEncoding& outputEncoding) {
 	try {
-		image.read(filename);
-
-		image.colorSpace(Magick::LabColorspace);
+		if (NATIVE_LAB_EQUALISATION && native_equalisation_supported(image)) {
+			equalise_image_native(image, lookupTable, bandCount);
+		} else {
+			equalise_image_magick(image, lookupTable, bandCount);
+		}
 	} catch (Magick::Exception& error) {
-		std::cerr << "Error loading input: " << error.what() << std::endl;
+		std::cerr << "Error equalising input: " << error.what() << std::endl;
 		throw;
 	}
 
-	image.modifyImage();
-
-	Magick::Quantum* pixels = image.getPixels(0, 0, image.columns(), image.rows());
-
-	for (size_t row = 0; row < image.rows(); row++) {
-		for (size_t col = 0; col < image.columns(); col++) {
-			*pixels = linear_map(*pixels, mapping);
-			pixels += 3; // Move forward by the three channels in image
-		}
-	}
-
-	image.syncPixels();
-
-	Magick::Blob blob{};
-
-	image.colorSpace(Magick::sRGBColorspace);
-	image.magick("TIFF");
-	image.write(&blob);
-
-	const auto* const blobData = static_cast<const std::uint8_t*>(blob.data());
-	const size_t blobLength = blob.length();
-
-	return std::vector<std::uint8_t>{ blobData, blobData + blobLength };
+	return encode_image(image, outputEncoding);
 }
@@ -1,19 +1,81 @@
 #pragma once
 
 #include <array>
+#include <cstddef>
 #include <cstdint>
 #include <optional>
 #include <string>
 #include <vector>
 
 #include "config.hpp"
+#include "image_data.hpp"
+#include "output_encoding.hpp"
+
+class DecodedImageCache;
 
 using Histogram = std::array<float, HISTOGRAM_SEGMENTS>;
 using EqualisationHistogramMapping = Histogram;
 
-std::optional<Histogram> image_get_histogram(const std::string& filename);
+// A lightness histogram, estimated from `sample_count` of an image's pixels
+struct SampledHistogram {
+	Histogram histogram;
+	std::uint64_t sample_count;
+
+	// Bound on the difference between the cumulative distribution of `histogram` and that of the full
+	// image, see `histogram_cdf_error_bound`. Zero when every pixel was sampled.
+	double cdf_error_bound;
+};
+
+// Computes the lightness histogram of an image from at least `sampleBudget` of its pixels, or from
+// every pixel if `sampleBudget` is zero. A non-zero `decodeSize` first decodes the image at reduced
+// resolution, see `read_reduced_image`. The image's rows are split into up to `bandCount` bands,
+// which run in parallel on the shared thread pool. Full resolution decodes are kept in
+// `imageCache`, if given, for the image's equalisation.
+std::optional<SampledHistogram> image_get_histogram(const std::string& filename,
+                                                    std::uint64_t sampleBudget = 0,
+                                                    std::size_t decodeSize = 0,
+                                                    std::size_t bandCount = 1,
+                                                    DecodedImageCache* imageCache = nullptr);
 EqualisationHistogramMapping identity_equalisation_histogram_mapping();
 EqualisationHistogramMapping get_equalisation_parameters(const Histogram& previousHistogram,
                                                          const Histogram& currentHistogram);
-std::vector<std::uint8_t> image_equalise(const std::string& filename,
-                                         const EqualisationHistogramMapping& mapping);
+// The histogram of an image, and the image equalised against the previous frame's histogram
+struct FusedEqualisation {
+	SampledHistogram histogram;
+	ImageData tiff_data;
+};
+
+// Computes the histogram of an image, as `image_get_histogram` does at full resolution, then
+// equalises it against `previousHistogram` from the same single decode. Without a previous
+// histogram, the image is equalised with the identity mapping.
+FusedEqualisation image_histogram_equalise(const std::string& filename,
+                                           const std::optional<Histogram>& previousHistogram,
+                                           std::uint64_t sampleBudget = 0,
+                                           std::size_t bandCount = 1,
+                                           DecodedImageCache* imageCache = nullptr,
+                                           const OutputEncoding& outputEncoding = {});
+
+/**
+ * @brief Receives an encoded image in order, a piece at a time, as it is produced.
+ */
+class ImageSink {
+public:
+	virtual ~ImageSink() = default;
+
+	virtual void write(const ImageData& piece) = 0;
+	// Discards the pieces written so far, as the image is about to be encoded again from the start
+	virtual void restart() = 0;
+};
+
+// Equalises the lightness of an image through `mapping`, returning it encoded with
+// `outputEncoding`. The image is taken from `imageCache` if it is held there, rather than decoded
+// again. Only uncompressed TIFFs are streamed, so other codecs decode large images whole.
+ImageData image_equalise(const std::string& filename, const EqualisationHistogramMapping& mapping,
+                         std::size_t bandCount = 1, DecodedImageCache* imageCache = nullptr,
+                         const OutputEncoding& outputEncoding = {});
+// Equalises an image as `image_equalise` does, writing it to `sink` as it is encoded rather than
+// returning it whole. Streamed TIFFs are written a band of rows at a time, other images at once.
+void image_equalise(ImageSink& sink, const std::string& filename,
+                    const EqualisationHistogramMapping& mapping, std::size_t bandCount = 1,
+                    DecodedImageCache* imageCache = nullptr,
+                    const OutputEncoding& outputEncoding = {});
@@ -0,0 +1,388 @@
+#include "colour.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "simd.hpp"
+
+// ImageMagick's sRGB transfer function breakpoints, and CIE constants
+const constexpr double SRGB_DECODE_BREAKPOINT = 0.0404482362771076;
+const constexpr double SRGB_ENCODE_BREAKPOINT = 0.0031306684425005883;
+const constexpr float CIE_EPSILON = 216.0 / 24389.0;
+const constexpr float CIE_K = 24389.0 / 27.0;
+const constexpr float CIE_F_EPSILON = 6.0 / 29.0; // CIE_EPSILON^(1/3)
+
+// ImageMagick's D65 white point
+const constexpr float WHITE_X = 0.950456;
+const constexpr float WHITE_Z = 1.088754;
+
+// sRGB (D65) -> XYZ matrix, and its inverse, as used by ImageMagick
+const constexpr float RGB_TO_XYZ[3][3] = {
+	{ 0.4124564, 0.3575761, 0.1804375 },
+	{ 0.2126729, 0.7151522, 0.0721750 },
+	{ 0.0193339, 0.1191920, 0.9503041 },
+};
+const constexpr float XYZ_TO_RGB[3][3] = {
+	{ 3.2404542, -1.5371385, -0.4985314 },
+	{ -0.9692660, 1.8760108, 0.0415560 },
+	{ 0.0556434, -0.2040259, 1.0572252 },
+};
+const constexpr float RED_LUMINANCE = RGB_TO_XYZ[1][0];
+const constexpr float GREEN_LUMINANCE = RGB_TO_XYZ[1][1];
+const constexpr float BLUE_LUMINANCE = RGB_TO_XYZ[1][2];
+
+// Number of linearly interpolated segments of the gamma tables. The decoding table is indexed by
+// the encoded value, whilst the encoding table is indexed by the square root of the linear value to
+// flatten the steep start of the curve. Both are smooth enough for interpolation error to be below
+// 1e-6.
+const constexpr std::size_t GAMMA_TABLE_SEGMENTS = 1024;
+
+// Pixels converted per block, sized to keep the intermediate luminance in L1
+const constexpr std::size_t CONVERSION_BLOCK_PIXELS = 512;
+
+using GammaTable = std::array<float, GAMMA_TABLE_SEGMENTS + 1>;
+
+// std::pow is not constexpr, so compute x^(1/n) with Newton's method. Starting from 1 (above the
+// root for values in (0, 1]), the iterates decrease monotonically until they converge.
+static constexpr double constexpr_root(const double value, const int n) {
+	double root = 1.0;
+
+	for (int i = 0; i < 64; i++) {
+		double power = 1.0;
+
+		for (int j = 0; j < n - 1; j++) {
+			power *= root;
+		}
+
+		const double next = ((n - 1) * root + value / power) / n;
+
+		if (next >= root) {
+			break;
+		}
+
+		root = next;
+	}
+
+	return root;
+}
+
+// sRGB decoding (gamma expansion), as ImageMagick's DecodePixelGamma
+static constexpr double srgb_decode(const double value) {
+	if (value <= SRGB_DECODE_BREAKPOINT) {
+		return value / 12.92;
+	}
+
+	// x^2.4 = x^2 * (x^2)^(1/5)
+	const double base = (value + 0.055) / 1.055;
+	const double squared = base * base;
+
+	return squared * constexpr_root(squared, 5);
+}
+
+// sRGB encoding (gamma compression) of the square of `root`, as ImageMagick's EncodePixelGamma
+static constexpr double srgb_encode_squared(const double root) {
+	const double value = root * root;
+
+	if (value <= SRGB_ENCODE_BREAKPOINT) {
+		return value * 12.92;
+	}
+
+	// x^(1/2.4) = root^(5/6)
+	const double rootFifth = root * root * root * root * root;
+
+	return 1.055 * constexpr_root(rootFifth, 6) - 0.055;
+}
+
+static constexpr GammaTable generate_decode_table() {
+	GammaTable table{};
+
+	for (std::size_t i = 0; i <= GAMMA_TABLE_SEGMENTS; i++) {
+		table[i] = static_cast<float>(srgb_decode(static_cast<double>(i) / GAMMA_TABLE_SEGMENTS));
+	}
+
+	return table;
+}
+
+static constexpr GammaTable generate_encode_table() {
+	GammaTable table{};
+
+	for (std::size_t i = 0; i <= GAMMA_TABLE_SEGMENTS; i++) {
+		table[i] =
+		    static_cast<float>(srgb_encode_squared(static_cast<double>(i) / GAMMA_TABLE_SEGMENTS));
+	}
+
+	return table;
+}
+
+static constexpr GammaTable DECODE_TABLE = generate_decode_table();
+static constexpr GammaTable ENCODE_TABLE = generate_encode_table();
+
+static inline float lookup_gamma(const GammaTable& table, const float normalised) {
+	const float position =
+	    std::clamp(normalised, 0.F, 1.F) * static_cast<float>(GAMMA_TABLE_SEGMENTS);
+	const auto segment =
+	    std::min(static_cast<std::size_t>(position), GAMMA_TABLE_SEGMENTS - 1);
+	const float fraction = position - static_cast<float>(segment);
+
+	return table[segment] + (table[segment + 1] - table[segment]) * fraction;
+}
+
+// Rounds and clamps as ImageMagick's ClampToQuantum in integer quantum builds
+static inline Magick::Quantum to_quantum(const float value) {
+	if constexpr (std::is_integral_v<Magick::Quantum>) {
+		return static_cast<Magick::Quantum>(
+		    std::clamp(value + 0.5F, 0.F, static_cast<float>(QuantumRange)));
+	} else {
+		return value;
+	}
+}
+
+// Cube root approximation shared by the scalar and SIMD kernels: an exponent-dividing bit trick
+// estimate (as fdlibm's cbrtf) refined by three Newton iterations to single precision.
+static inline float approximate_cbrt(const float value) {
+	std::uint32_t bits = 0;
+	std::memcpy(&bits, &value, sizeof(bits));
+	bits = bits / 3 + 709958130U;
+
+	float root = 0.F;
+	std::memcpy(&root, &bits, sizeof(root));
+
+	for (int i = 0; i < 3; i++) {
+		root = (2.F * root + value / (root * root)) * (1.F / 3.F);
+	}
+
+	return root;
+}
+
+// The CIE L*a*b* companding function f(t)
+static inline float cie_f(const float t) {
+	return (t > CIE_EPSILON) ? approximate_cbrt(t) : (CIE_K * t + 16.F) / 116.F;
+}
+
+static void cie_f_scalar(float* values, const std::size_t count) {
+	for (std::size_t i = 0; i < count; i++) {
+		values[i] = cie_f(values[i]);
+	}
+}
+
+#if SIMD_X86_KERNELS
+
+SIMD_KERNELS_BEGIN
+
+__attribute__((target("avx2,fma"))) static void cie_f_avx2(float* values,
+                                                          const std::size_t count) {
+	const __m256 epsilon = _mm256_set1_ps(CIE_EPSILON);
+	const __m256 k = _mm256_set1_ps(CIE_K);
+	const __m256 sixteen = _mm256_set1_ps(16.F);
+	const __m256 oneHundredSixteenth = _mm256_set1_ps(1.F / 116.F);
+	const __m256 two = _mm256_set1_ps(2.F);
+	const __m256 oneThird = _mm256_set1_ps(1.F / 3.F);
+	const __m256i cbrtBias = _mm256_set1_epi32(709958130);
+
+	std::size_t i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		const __m256 t = _mm256_loadu_ps(values + i);
+
+		// Estimate bits / 3 through a float multiply, which is accurate enough for a starting guess
+		const __m256i bits = _mm256_castps_si256(t);
+		const __m256i thirdBits =
+		    _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(bits), oneThird));
+		__m256 root = _mm256_castsi256_ps(_mm256_add_epi32(thirdBits, cbrtBias));
+
+		for (int iteration = 0; iteration < 3; iteration++) {
+			root = _mm256_mul_ps(
+			    _mm256_fmadd_ps(two, root, _mm256_div_ps(t, _mm256_mul_ps(root, root))), oneThird);
+		}
+
+		const __m256 linear = _mm256_mul_ps(_mm256_fmadd_ps(k, t, sixteen), oneHundredSixteenth);
+
+		_mm256_storeu_ps(values + i,
+		                 _mm256_blendv_ps(linear, root, _mm256_cmp_ps(t, epsilon, _CMP_GT_OQ)));
+	}
+
+	cie_f_scalar(values + i, count - i);
+}
+
+SIMD_KERNELS_END
+
+#endif
+
+static void cie_f(float* values, const std::size_t count) {
+#if SIMD_X86_KERNELS
+	if (cpu_supports_avx2()) {
+		cie_f_avx2(values, count);
+		return;
+	}
+#endif
+
+	cie_f_scalar(values, count);
+}
+
+// Inverse of the companding function. Plain arithmetic, so left to the compiler to vectorise.
+static void cie_f_inverse(float* values, const std::size_t count) {
+	for (std::size_t i = 0; i < count; i++) {
+		const float f = values[i];
+		values[i] = (f > CIE_F_EPSILON) ? f * f * f : (116.F * f - 16.F) / CIE_K;
+	}
+}
+
+static inline float srgb_decode_quantum(const Magick::Quantum quantum) {
+	return lookup_gamma(DECODE_TABLE, quantum * (1.F / static_cast<float>(QuantumRange)));
+}
+
+static inline Magick::Quantum srgb_encode_quantum(const float linear) {
+	const float clamped = std::clamp(linear, 0.F, 1.F);
+	const float encoded = (clamped <= SRGB_ENCODE_BREAKPOINT)
+	                          ? clamped * 12.92F
+	                          : lookup_gamma(ENCODE_TABLE, std::sqrt(clamped));
+
+	return to_quantum(encoded * static_cast<float>(QuantumRange));
+}
+
+// L* / 100 from f(Y), and back
+static inline float lightness_from_f(const float f) {
+	return (116.F * f - 16.F) / 100.F;
+}
+
+static inline float f_from_lightness(const float lightness) {
+	return (100.F * lightness + 16.F) / 116.F;
+}
+
+static void srgb_to_luminance(const Magick::Quantum* pixels, const std::size_t pixelCount,
+                              const std::size_t channels, float* luminance) {
+	if (channels >= 3) {
+		for (std::size_t i = 0; i < pixelCount; i++) {
+			const Magick::Quantum* const pixel = pixels + i * channels;
+
+			luminance[i] = RED_LUMINANCE * srgb_decode_quantum(pixel[0]) +
+			               GREEN_LUMINANCE * srgb_decode_quantum(pixel[1]) +
+			               BLUE_LUMINANCE * srgb_decode_quantum(pixel[2]);
+		}
+	} else {
+		// ImageMagick converts grayscale to sRGB with equal channels before converting to Lab
+		const float grayLuminance = RED_LUMINANCE + GREEN_LUMINANCE + BLUE_LUMINANCE;
+
+		for (std::size_t i = 0; i < pixelCount; i++) {
+			luminance[i] = grayLuminance * srgb_decode_quantum(pixels[i * channels]);
+		}
+	}
+}
+
+bool native_colour_conversion_supported(const Magick::Image& image) {
+	return native_colour_conversion_supported(image.colorSpace(), image.channels(), image.alpha());
+}
+
+bool native_colour_conversion_supported(const Magick::ColorspaceType colorspace,
+                                        const std::size_t channels, const bool alpha) {
+	switch (colorspace) {
+		case Magick::sRGBColorspace:
+			return channels == 3 || (channels == 4 && alpha);
+		case Magick::GRAYColorspace:
+			return channels == 1 || (channels == 2 && alpha);
+		default:
+			return false;
+	}
+}
+
+bool native_equalisation_supported(const Magick::Image& image) {
+	return native_equalisation_supported(image.colorSpace(), image.channels(), image.alpha());
+}
+
+bool native_equalisation_supported(const Magick::ColorspaceType colorspace,
+                                   const std::size_t channels, const bool alpha) {
+	return native_colour_conversion_supported(colorspace, channels, alpha) &&
+	       colorspace == Magick::sRGBColorspace;
+}
+
+void srgb_to_lightness(const Magick::Quantum* pixels, const std::size_t pixelCount,
+                       const std::size_t channels, Magick::Quantum* lightness) {
+	std::array<float, CONVERSION_BLOCK_PIXELS> block{};
+
+	for (std::size_t start = 0; start < pixelCount; start += CONVERSION_BLOCK_PIXELS) {
+		const std::size_t blockPixels = std::min(CONVERSION_BLOCK_PIXELS, pixelCount - start);
+
+		srgb_to_luminance(pixels + start * channels, blockPixels, channels, block.data());
+		cie_f(block.data(), blockPixels);
+
+		for (std::size_t i = 0; i < blockPixels; i++) {
+			lightness[start + i] =
+			    to_quantum(lightness_from_f(block[i]) * static_cast<float>(QuantumRange));
+		}
+	}
+}
+
+void equalise_srgb_lightness(Magick::Quantum* pixels, const std::size_t pixelCount,
+                             const std::size_t channels,
+                             const EqualisationLookupTable& lookupTable) {
+	// Block-local structure of arrays, holding f(X/Xn), f(Y) and f(Z/Zn) of each pixel
+	std::array<float, CONVERSION_BLOCK_PIXELS> fx{};
+	std::array<float, CONVERSION_BLOCK_PIXELS> fy{};
+	std::array<float, CONVERSION_BLOCK_PIXELS> fz{};
+	std::array<Magick::Quantum, CONVERSION_BLOCK_PIXELS> lightness{};
+
+	for (std::size_t start = 0; start < pixelCount; start += CONVERSION_BLOCK_PIXELS) {
+		const std::size_t blockPixels = std::min(CONVERSION_BLOCK_PIXELS, pixelCount - start);
+		Magick::Quantum* const blockStart = pixels + start * channels;
+
+		// sRGB -> XYZ
+		for (std::size_t i = 0; i < blockPixels; i++) {
+			const Magick::Quantum* const pixel = blockStart + i * channels;
+			const float red = srgb_decode_quantum(pixel[0]);
+			const float green = srgb_decode_quantum(pixel[1]);
+			const float blue = srgb_decode_quantum(pixel[2]);
+
+			fx[i] = (RGB_TO_XYZ[0][0] * red + RGB_TO_XYZ[0][1] * green + RGB_TO_XYZ[0][2] * blue) /
+			        WHITE_X;
+			fy[i] = RGB_TO_XYZ[1][0] * red + RGB_TO_XYZ[1][1] * green + RGB_TO_XYZ[1][2] * blue;
+			fz[i] = (RGB_TO_XYZ[2][0] * red + RGB_TO_XYZ[2][1] * green + RGB_TO_XYZ[2][2] * blue) /
+			        WHITE_Z;
+		}
+
+		// XYZ -> Lab
+		cie_f(fx.data(), blockPixels);
+		cie_f(fy.data(), blockPixels);
+		cie_f(fz.data(), blockPixels);
+
+		for (std::size_t i = 0; i < blockPixels; i++) {
+			lightness[i] = to_quantum(lightness_from_f(fy[i]) * static_cast<float>(QuantumRange));
+		}
+
+		lookupTable.apply(lightness.data(), blockPixels, 1);
+
+		// Shift f(X/Xn) and f(Z/Zn) with f(Y) so that a* and b* are unchanged
+		for (std::size_t i = 0; i < blockPixels; i++) {
+			const float mappedF =
+			    f_from_lightness(static_cast<float>(lightness[i]) / static_cast<float>(QuantumRange));
+			const float shift = mappedF - fy[i];
+
+			fx[i] += shift;
+			fy[i] = mappedF;
+			fz[i] += shift;
+		}
+
+		// Lab -> XYZ
+		cie_f_inverse(fx.data(), blockPixels);
+		cie_f_inverse(fy.data(), blockPixels);
+		cie_f_inverse(fz.data(), blockPixels);
+
+		// XYZ -> sRGB
+		for (std::size_t i = 0; i < blockPixels; i++) {
+			Magick::Quantum* const pixel = blockStart + i * channels;
+			const float x = fx[i] * WHITE_X;
+			const float y = fy[i];
+			const float z = fz[i] * WHITE_Z;
+
+			pixel[0] =
+			    srgb_encode_quantum(XYZ_TO_RGB[0][0] * x + XYZ_TO_RGB[0][1] * y + XYZ_TO_RGB[0][2] * z);
+			pixel[1] =
+			    srgb_encode_quantum(XYZ_TO_RGB[1][0] * x + XYZ_TO_RGB[1][1] * y + XYZ_TO_RGB[1][2] * z);
+			pixel[2] =
+			    srgb_encode_quantum(XYZ_TO_RGB[2][0] * x + XYZ_TO_RGB[2][1] * y + XYZ_TO_RGB[2][2] * z);
+		}
+	}
+}
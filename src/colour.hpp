@@ -0,0 +1,58 @@
+#pragma once
+
+#include <Magick++.h>
+#include <cstddef>
+
+#include "equalisation.hpp"
+
+// Native colour space conversions reproducing ImageMagick's sRGB -> CIE L*a*b* (D65) conversion,
+// without requiring a full Lab image to be built.
+//
+// Native lightness is within NATIVE_LIGHTNESS_TOLERANCE L* (on the 0-100 scale) of ImageMagick's
+// double precision result, before both are rounded to a quantum. The error comes from the linearly
+// interpolated gamma table and the single precision cube root, so histogram buckets can only differ
+// for values lying within that tolerance of a bucket rounding boundary.
+const constexpr double NATIVE_LIGHTNESS_TOLERANCE = 1e-3;
+
+// Maximum difference of natively equalised channels from ImageMagick's round trip, as a proportion
+// of QuantumRange.
+const constexpr double NATIVE_EQUALISATION_TOLERANCE = 1e-3;
+
+// Whether the pixels of `image` are laid out in a form the native conversions understand (sRGB or
+// grayscale, optionally with an alpha channel).
+bool native_colour_conversion_supported(const Magick::Image& image);
+bool native_colour_conversion_supported(Magick::ColorspaceType colorspace, std::size_t channels,
+                                        bool alpha);
+
+/**
+ * @brief Compute the lightness (L*) of a run of pixels.
+ *
+ * @param pixels The first of `pixelCount` interleaved sRGB or grayscale pixels
+ * @param pixelCount The number of pixels to convert
+ * @param channels The number of quantums per pixel (1 or 2 for grayscale, 3 or 4 for sRGB)
+ * @param lightness Output of `pixelCount` lightness values, scaled onto QuantumRange in the same
+ * way as ImageMagick's Lab L channel
+ */
+void srgb_to_lightness(const Magick::Quantum* pixels, std::size_t pixelCount, std::size_t channels,
+                       Magick::Quantum* lightness);
+
+// Whether `image` can be equalised with `equalise_srgb_lightness` (sRGB, optionally with alpha).
+bool native_equalisation_supported(const Magick::Image& image);
+bool native_equalisation_supported(Magick::ColorspaceType colorspace, std::size_t channels,
+                                   bool alpha);
+
+/**
+ * @brief Equalise the lightness of a run of sRGB pixels in place.
+ *
+ * Each pixel makes a single sRGB -> Lab -> (mapped L) -> sRGB round trip, equivalent to converting
+ * the image to Lab with ImageMagick, mapping the L channel and converting back, but without
+ * materialising either intermediate image. Linear values are clamped to [0, 1] before encoding, so
+ * only out of gamut results differ from ImageMagick by more than NATIVE_EQUALISATION_TOLERANCE.
+ *
+ * @param pixels The first of `pixelCount` interleaved sRGB pixels
+ * @param pixelCount The number of pixels to equalise
+ * @param channels The number of quantums per pixel (3, or 4 with alpha)
+ * @param lookupTable The equalisation mapping to apply to the lightness of each pixel
+ */
+void equalise_srgb_lightness(Magick::Quantum* pixels, std::size_t pixelCount, std::size_t channels,
+                             const EqualisationLookupTable& lookupTable);
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <chrono>
+#include <cstddef>
 #include <cstdint>
 
 #define DEBUG_SERVICE_DISCOVERY 0
@@ -22,13 +23,128 @@ const constexpr std::uint64_t MAX_CHUNK_SIZE = 64 * 1024ULL * 1024ULL;
 // By default, to be safe, allow up to 256 chunks
 const constexpr std::uint64_t MAX_MESSAGE_SIZE = 256 * MAX_CHUNK_SIZE;
 
+// Equalised images are streamed back in chunks of up to this size, of which the server holds one
+// at a time
+const constexpr std::uint64_t RESULT_CHUNK_SIZE = 4 * 1024ULL * 1024ULL;
+
 // Max interval between heartbeat request and responses before a peer is considered "dead"
 const constexpr std::chrono::seconds MAX_HEARTBEAT_INTERVAL{ 5 };
 
+// How often the server checks whether heartbeats are due, or overdue, from its event loop
+const constexpr std::chrono::seconds HEARTBEAT_CHECK_INTERVAL{ 1 };
+
 // Whether the libraries linked with already have parallelism enabled.
 // Assume no library parallelism if not defined.
 const constexpr bool LIBRARY_PARALLELISM = false;
 
+// Whether to compute lightness natively from sRGB pixels (see colour.hpp), rather than through
+// ImageMagick's Lab colour space conversion. Images in other colour spaces always use ImageMagick.
+const constexpr bool NATIVE_COLOUR_CONVERSION = true;
+
+// Whether to equalise sRGB images with the fused native sRGB -> Lab -> sRGB round trip, rather than
+// two whole-image ImageMagick colour space conversions.
+const constexpr bool NATIVE_LAB_EQUALISATION = true;
+
+// Default number of pixels sampled from each image to estimate its histogram, or zero to use every
+// pixel. Overridden on the server with `--sample-budget`.
+const constexpr std::uint64_t HISTOGRAM_SAMPLE_BUDGET = 0;
+
+// Default minimum longest edge, in pixels, that images are decoded to for their histograms, or zero
+// to decode at full resolution. Overridden on the server with `--decode-size`.
+const constexpr std::size_t HISTOGRAM_DECODE_SIZE = 0;
+
+// Whether reduced RAW decodes may use the embedded JPEG preview instead of a half size demosaic.
+// The preview is much faster to decode, but has the camera's tone curve applied rather than
+// LibRaw's.
+const constexpr bool RAW_PREVIEW_DECODE = false;
+
+// Confidence with which the reported error bounds of sampled histograms hold
+const constexpr double HISTOGRAM_CDF_CONFIDENCE = 0.95;
+
+// Fewest image rows given to each band when a single image is split across threads. Workers split
+// images into bands only when they have fewer jobs queued than threads.
+const constexpr std::size_t MIN_BAND_ROWS = 64;
+
+// Images with at least this many pixels are streamed through in bands of STREAM_BAND_ROWS rows,
+// rather than decoded whole, bounding the memory of each job by the band size.
+const constexpr std::uint64_t STREAMING_PIXEL_THRESHOLD = 200'000'000;
+
+// Rows held in memory at once when streaming an image.
+const constexpr std::size_t STREAM_BAND_ROWS = 256;
+
+// Whether to compute each frame's histogram and equalise it in a single fused job, rather than in
+// two passes over the whole sequence. Enabled on the server with `--fused`.
+const constexpr bool FUSED_JOBS = false;
+
+// Shortest run of unstarted frames split to start a new chain of fused jobs. Each chain waits on
+// the histogram of the frame before it, and starting one costs an extra histogram job for that
+// frame.
+const constexpr std::size_t FUSED_CHAIN_MIN_SPLIT = 4;
+
+// Memory each worker may hold decoded images in between the histogram and equalisation phases, so
+// that images are not decoded twice. Zero disables the cache.
+const constexpr std::size_t DECODED_IMAGE_CACHE_BYTES = 2ULL << 30ULL;
+
+// Whether the server keeps histograms between runs in a store alongside the frames (see
+// histogram_store.hpp), so that unchanged frames are not decoded again. Disabled on the server with
+// `--no-histogram-store`.
+const constexpr bool HISTOGRAM_STORE = true;
+
+// Name of the histogram store within the served directory
+const constexpr char HISTOGRAM_STORE_FILENAME[] = ".exposure-histograms";
+
+// Whether the server records the images it writes in a manifest alongside the frames (see
+// output_manifest.hpp), so that images already written for the same input and mapping are not
+// equalised again. Disabled on the server with `--no-output-reuse`.
+const constexpr bool REUSE_OUTPUTS = true;
+
+// Name of the output manifest within the served directory
+const constexpr char OUTPUT_MANIFEST_FILENAME[] = ".exposure-outputs";
+
+// Whether the server holds histograms as cumulative distributions quantised to 16 bits, halving
+// their memory. Enabled on the server with `--quantise-histograms`.
+const constexpr bool QUANTISE_HISTOGRAMS = false;
+
+// Most frames the server computes or holds histograms for at once, or zero for no limit. Histograms
+// are released once both mappings they are needed for are built, so a window bounds the server's
+// memory on long sequences, at the cost of computing histograms no further ahead of equalisation.
+// Overridden on the server with `--histogram-window`.
+const constexpr std::size_t HISTOGRAM_WINDOW = 0;
+
+// Frames whose mean histogram each frame is equalised to, being the frames immediately before it.
+// One equalises each frame to the frame before it alone, while longer windows smooth out flicker
+// between frames. Overridden on the server with `--smoothing-window`.
+const constexpr std::size_t SMOOTHING_WINDOW = 1;
+
+// Most equalised frames held waiting for the frames before them, when writing a frame stream with
+// `--stream`. Frames are only dispatched this far ahead of the stream, so this bounds the server's
+// memory. Overridden on the server with `--stream-buffer`.
+const constexpr std::size_t STREAM_REORDER_FRAMES = 16;
+
+// Frames per second declared in the header of Y4M frame streams
+const constexpr std::size_t STREAM_FRAME_RATE = 25;
+
+// Quality of equalised images encoded with a lossy codec, from 1 to 100. Overridden on the server
+// with `--output-quality`.
+const constexpr std::uint8_t OUTPUT_QUALITY = 92;
+
+// Threads the server writes equalised images to disk on, so slow storage never holds up receiving
+const constexpr std::size_t OUTPUT_WRITE_THREADS = 2;
+
+// Most bytes of equalised images queued for writing to disk before the server stops dispatching
+// equalisations, until writing catches up. Overridden on the server with `--write-budget`, in MiB.
+const constexpr std::uint64_t OUTPUT_WRITE_BUDGET = 1024 * 1024ULL * 1024ULL;
+
+// Files found while scanning the served directory before they are handed out as a batch, whose
+// histogram jobs are dispatched while the scan continues
+const constexpr std::size_t SCAN_BATCH_FILES = 256;
+
+// Longest the server waits for more scanned files before handling results from workers
+const constexpr std::chrono::milliseconds SCAN_POLL_INTERVAL{ 10 };
+
+// Bytes read from each end of a file to identify its contents between runs
+const constexpr std::size_t CONTENT_HASH_SPAN = 4096;
+
 // The maximum expected hardware concurrency in threads. Used solely to define communication
 // semaphore limits. With threaded ImageMagick, this is forced to be 1, as
 // using only a single thread avoids some parallelism overhead.
@@ -0,0 +1,117 @@
+#include "decode.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <libraw/libraw.h>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+
+#include "config.hpp"
+
+using ProcessedRawImage =
+    std::unique_ptr<libraw_processed_image_t, void (*)(libraw_processed_image_t*)>;
+
+static ProcessedRawImage processed_raw_image(libraw_processed_image_t* image) {
+	return ProcessedRawImage{ image, &LibRaw::dcraw_clear_mem };
+}
+
+static std::string reduced_geometry(const std::size_t decodeSize) {
+	return std::to_string(decodeSize) + "x" + std::to_string(decodeSize);
+}
+
+// Reads a JPEG (or other ImageMagick readable) blob or file, hinting that only `decodeSize` pixels
+// along the longest edge are needed.
+template <typename Source>
+static Magick::Image read_with_size_hint(const Source& source, const std::size_t decodeSize) {
+	Magick::Image image{};
+
+	image.defineValue("jpeg", "size", reduced_geometry(decodeSize));
+	image.size(Magick::Geometry{ decodeSize, decodeSize });
+	image.read(source);
+
+	return image;
+}
+
+// Decodes the embedded preview of an opened RAW file, if it is a JPEG at least as large as required
+static std::optional<Magick::Image> read_raw_preview(LibRaw& raw, const std::size_t decodeSize) {
+	const auto& thumbnail = raw.imgdata.thumbnail;
+
+	if (thumbnail.tformat != LIBRAW_THUMBNAIL_JPEG ||
+	    std::max<std::size_t>(thumbnail.twidth, thumbnail.theight) < decodeSize ||
+	    raw.unpack_thumb() != LIBRAW_SUCCESS) {
+		return std::nullopt;
+	}
+
+	int error = LIBRAW_SUCCESS;
+	const ProcessedRawImage preview = processed_raw_image(raw.dcraw_make_mem_thumb(&error));
+
+	if (!preview || preview->type != LIBRAW_IMAGE_JPEG) {
+		return std::nullopt;
+	}
+
+	return read_with_size_hint(Magick::Blob{ preview->data, preview->data_size }, decodeSize);
+}
+
+// Demosaics an opened RAW file at half resolution, skipping the interpolation of the full sensor
+static std::optional<Magick::Image> read_raw_half_size(LibRaw& raw, const std::size_t decodeSize) {
+	const auto& sizes = raw.imgdata.sizes;
+
+	if (std::max<std::size_t>(sizes.width, sizes.height) / 2 < decodeSize) {
+		return std::nullopt;
+	}
+
+	// Match the defaults ImageMagick's own LibRaw coder decodes with
+	raw.imgdata.params.half_size = 1;
+	raw.imgdata.params.output_bps = 16;
+	raw.imgdata.params.use_camera_wb = 1;
+
+	if (raw.unpack() != LIBRAW_SUCCESS || raw.dcraw_process() != LIBRAW_SUCCESS) {
+		return std::nullopt;
+	}
+
+	int error = LIBRAW_SUCCESS;
+	const ProcessedRawImage image = processed_raw_image(raw.dcraw_make_mem_image(&error));
+
+	if (!image || image->type != LIBRAW_IMAGE_BITMAP || image->colors != 3 || image->bits != 16) {
+		return std::nullopt;
+	}
+
+	return Magick::Image{ image->width, image->height, "RGB", Magick::ShortPixel, image->data };
+}
+
+static std::optional<Magick::Image> read_reduced_raw_image(const std::string& filename,
+                                                           const std::size_t decodeSize) {
+	LibRaw raw{};
+
+	// Only parses the metadata, failing quickly for anything other than a RAW file
+	if (raw.open_file(filename.c_str()) != LIBRAW_SUCCESS) {
+		return std::nullopt;
+	}
+
+	if (RAW_PREVIEW_DECODE) {
+		if (auto preview = read_raw_preview(raw, decodeSize)) {
+			return preview;
+		}
+	}
+
+	return read_raw_half_size(raw, decodeSize);
+}
+
+Magick::Image read_reduced_image(const std::string& filename, const std::size_t decodeSize) {
+	try {
+		if (decodeSize == 0) {
+			return Magick::Image{ filename };
+		}
+
+		if (auto rawImage = read_reduced_raw_image(filename, decodeSize)) {
+			return std::move(*rawImage);
+		}
+
+		return read_with_size_hint(filename, decodeSize);
+	} catch (Magick::Exception& error) {
+		std::cerr << "Error loading input: " << error.what() << std::endl;
+		throw;
+	}
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <Magick++.h>
+#include <cstddef>
+#include <string>
+
+/**
+ * @brief Read an image at reduced resolution, for when only its histogram is required.
+ *
+ * Asks each codec for the smallest image whose longest edge is at least `decodeSize` pixels:
+ * - RAW files are demosaiced by LibRaw at half size, or, with RAW_PREVIEW_DECODE, replaced by their
+ *   embedded JPEG preview when it is large enough.
+ * - JPEGs use libjpeg's DCT scaling (1/2 to 1/8) through ImageMagick's `jpeg:size` hint.
+ * - Other formats are given ImageMagick's size hint, which most decode at full size regardless.
+ *
+ * @param filename The image to read
+ * @param decodeSize Minimum longest edge to decode to, or zero to decode at full resolution
+ * @return The (possibly) reduced image
+ */
+Magick::Image read_reduced_image(const std::string& filename, std::size_t decodeSize);
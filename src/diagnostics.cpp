@@ -0,0 +1,429 @@
+#include "diagnostics.hpp"
+
+#include <Magick++.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <set>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "algorithm.hpp"
+#include "colour.hpp"
+#include "equalisation.hpp"
+#include "histogram.hpp"
+#include "sampling.hpp"
+#include "smoothing.hpp"
+
+template <typename Function>
+static double time_milliseconds(Function&& function) {
+	const auto start = std::chrono::steady_clock::now();
+	function();
+	const auto end = std::chrono::steady_clock::now();
+
+	return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+static void report_timing(const char* name, const double milliseconds, const std::size_t pixelCount,
+                          const bool matches) {
+	std::clog << std::setw(24) << std::left << name << std::setw(10) << std::right << std::fixed
+	          << std::setprecision(2) << milliseconds << " ms " << std::setw(8)
+	          << (milliseconds * 1e6 / static_cast<double>(pixelCount)) << " ns/pixel"
+	          << (matches ? "" : "  MISMATCH") << "\n";
+}
+
+static std::vector<Magick::Quantum> synthetic_lightness_channel(const std::size_t pixelCount) {
+	std::mt19937_64 re{ pixelCount };
+	std::uniform_real_distribution<double> quantumDistribution{ 0.0, QuantumRange };
+	std::vector<Magick::Quantum> pixels(pixelCount);
+
+	for (auto& pixel : pixels) {
+		pixel = static_cast<Magick::Quantum>(quantumDistribution(re));
+	}
+
+	return pixels;
+}
+
+static bool benchmark_histogram_kernels(const std::vector<Magick::Quantum>& pixels) {
+	HistogramCounts reference{};
+	const double referenceTime = time_milliseconds([&pixels, &reference]() {
+		accumulate_quantum_histogram(HistogramKernel::Scalar, pixels.data(), pixels.size(), reference);
+	});
+	report_timing("histogram (scalar)", referenceTime, pixels.size(), true);
+
+	bool allMatch = true;
+
+	for (const auto kernel :
+	     { HistogramKernel::LookupTable, HistogramKernel::AVX2, HistogramKernel::AVX512 }) {
+		if (!histogram_kernel_supported(kernel)) {
+			continue;
+		}
+
+		HistogramCounts counts{};
+		const double kernelTime = time_milliseconds([&pixels, &counts, kernel]() {
+			accumulate_quantum_histogram(kernel, pixels.data(), pixels.size(), counts);
+		});
+		const bool matches = counts == reference;
+		allMatch = allMatch && matches;
+
+		const std::string name = std::string{ "histogram (" } + histogram_kernel_name(kernel) + ")";
+		report_timing(name.c_str(), kernelTime, pixels.size(), matches);
+	}
+
+	std::clog << "Preferred histogram kernel: " << histogram_kernel_name(preferred_histogram_kernel())
+	          << "\n";
+
+	return allMatch;
+}
+
+static Histogram proportional_histogram(const HistogramCounts& counts) {
+	Histogram histogram{};
+	std::uint64_t total = 0;
+
+	for (const auto count : counts) {
+		total += count;
+	}
+
+	for (std::size_t i = 0; i < HISTOGRAM_SEGMENTS; i++) {
+		histogram[i] = static_cast<double>(counts[i]) / static_cast<double>(total);
+	}
+
+	return histogram;
+}
+
+// A mapping which equalises a darkened copy of `lightnessChannel` back onto the original, returned
+// alongside the darkened copy
+static std::pair<std::vector<Magick::Quantum>, EqualisationHistogramMapping>
+darkening_mapping(const std::vector<Magick::Quantum>& lightnessChannel) {
+	std::vector<Magick::Quantum> darkened{ lightnessChannel };
+
+	for (auto& pixel : darkened) {
+		pixel = static_cast<Magick::Quantum>(pixel * pixel / QuantumRange);
+	}
+
+	HistogramCounts originalCounts{};
+	HistogramCounts darkenedCounts{};
+	accumulate_quantum_histogram(lightnessChannel.data(), lightnessChannel.size(), originalCounts);
+	accumulate_quantum_histogram(darkened.data(), darkened.size(), darkenedCounts);
+
+	auto mapping = get_equalisation_parameters(proportional_histogram(originalCounts),
+	                                           proportional_histogram(darkenedCounts));
+
+	return { std::move(darkened), std::move(mapping) };
+}
+
+static Magick::Image synthetic_srgb_image(const std::size_t pixelCount) {
+	const std::size_t columns = BENCHMARK_COLUMNS;
+	const std::size_t rows = std::max<std::size_t>(1, pixelCount / columns);
+
+	std::mt19937_64 re{ pixelCount };
+	std::uniform_real_distribution<float> channelDistribution{ 0.F, 1.F };
+	std::vector<float> rgbPixels(columns * rows * 3);
+
+	for (auto& channel : rgbPixels) {
+		channel = channelDistribution(re);
+	}
+
+	return Magick::Image{ columns, rows, "RGB", Magick::FloatPixel, rgbPixels.data() };
+}
+
+static bool benchmark_equalisation_kernels(const std::vector<Magick::Quantum>& lightnessChannel) {
+	// Map a darkened copy of the synthetic frame onto the original
+	const auto darkening = darkening_mapping(lightnessChannel);
+	const auto& darkened = darkening.first;
+	const auto& mapping = darkening.second;
+
+	// Lay the frame out as interleaved three channel Lab pixels
+	std::vector<Magick::Quantum> referencePixels(darkened.size() * 3);
+
+	for (std::size_t i = 0; i < darkened.size(); i++) {
+		referencePixels[i * 3] = darkened[i];
+	}
+
+	std::vector<Magick::Quantum> tablePixels{ referencePixels };
+
+	const double referenceTime = time_milliseconds([&referencePixels, &mapping]() {
+		for (std::size_t i = 0; i < referencePixels.size(); i += 3) {
+			referencePixels[i] = linear_map(referencePixels[i], mapping);
+		}
+	});
+	report_timing("equalise (linear_map)", referenceTime, darkened.size(), true);
+
+	const double tableTime = time_milliseconds([&tablePixels, &mapping]() {
+		const EqualisationLookupTable lookupTable{ mapping };
+		lookupTable.apply(tablePixels.data(), tablePixels.size() / 3, 3);
+	});
+
+	// Integer quantum tables are exact, HDRI tables are allowed rounding of the result.
+	double maxError = 0.0;
+
+	for (std::size_t i = 0; i < referencePixels.size(); i += 3) {
+		const double reference = referencePixels[i];
+		const double error = std::abs(static_cast<double>(tablePixels[i]) - reference) /
+		                     std::max<double>(QuantumRange, std::abs(reference));
+		maxError = std::max(maxError, error);
+	}
+
+	const bool matches = maxError <= EQUALISATION_TABLE_TOLERANCE;
+	report_timing("equalise (lookup table)", tableTime, darkened.size(), matches);
+	std::clog << "Maximum relative lookup table error: " << std::scientific << maxError << "\n"
+	          << std::defaultfloat;
+
+	return matches;
+}
+
+static bool benchmark_lightness_conversion(const std::size_t pixelCount) {
+	const Magick::Image image = synthetic_srgb_image(pixelCount);
+	const std::size_t columns = image.columns();
+	const std::size_t rows = image.rows();
+	Magick::Image lightnessChannel{ image };
+
+	const double magickTime = time_milliseconds([&lightnessChannel]() {
+		lightnessChannel.colorSpace(Magick::LabColorspace);
+		lightnessChannel.channel(Magick::ChannelType::LChannel);
+	});
+	report_timing("lightness (ImageMagick)", magickTime, columns * rows, true);
+
+	const Magick::Quantum* sourcePixels = image.getConstPixels(0, 0, columns, rows);
+	std::vector<Magick::Quantum> nativeLightness(columns * rows);
+
+	const double nativeTime = time_milliseconds([&image, &sourcePixels, &nativeLightness]() {
+		srgb_to_lightness(sourcePixels, nativeLightness.size(), image.channels(),
+		                  nativeLightness.data());
+	});
+
+	// Both results are rounded to a quantum in integer builds, so allow half a quantum each
+	const double tolerance = NATIVE_LIGHTNESS_TOLERANCE +
+	                         (std::is_integral_v<Magick::Quantum> ? 100.0 / QuantumRange : 0.0);
+	const Magick::Quantum* magickLightness = lightnessChannel.getConstPixels(0, 0, columns, rows);
+	double maxError = 0.0;
+
+	for (std::size_t i = 0; i < nativeLightness.size(); i++) {
+		const double error =
+		    std::abs(static_cast<double>(nativeLightness[i]) - magickLightness[i]) * 100.0 /
+		    QuantumRange;
+		maxError = std::max(maxError, error);
+	}
+
+	const bool matches = maxError <= tolerance;
+	report_timing("lightness (native)", nativeTime, columns * rows, matches);
+	std::clog << "Maximum native lightness error: " << std::scientific << maxError << " L*\n"
+	          << std::defaultfloat;
+
+	return matches;
+}
+
+static bool benchmark_lab_equalisation(const std::size_t pixelCount,
+                                       const EqualisationHistogramMapping& mapping) {
+	const Magick::Image image = synthetic_srgb_image(pixelCount);
+	const std::size_t columns = image.columns();
+	const std::size_t rows = image.rows();
+	const EqualisationLookupTable lookupTable{ mapping };
+
+	Magick::Image magickImage{ image };
+	const double magickTime = time_milliseconds([&magickImage, &lookupTable]() {
+		equalise_image_magick(magickImage, lookupTable);
+	});
+	report_timing("Lab equalise (ImageMagick)", magickTime, columns * rows, true);
+
+	Magick::Image nativeImage{ image };
+	const double nativeTime = time_milliseconds([&nativeImage, &lookupTable]() {
+		equalise_image_native(nativeImage, lookupTable);
+	});
+
+	// The native path clamps out of gamut results, whilst HDRI builds of ImageMagick do not. Integer
+	// builds additionally round the intermediate Lab image to a quantum.
+	const double tolerance = NATIVE_EQUALISATION_TOLERANCE +
+	                         (std::is_integral_v<Magick::Quantum> ? 4.0 / QuantumRange : 0.0);
+	const std::size_t channels = image.channels();
+	const Magick::Quantum* magickPixels = magickImage.getConstPixels(0, 0, columns, rows);
+	const Magick::Quantum* nativePixels = nativeImage.getConstPixels(0, 0, columns, rows);
+	double maxError = 0.0;
+
+	for (std::size_t i = 0; i < columns * rows * channels; i++) {
+		const double reference = std::clamp<double>(magickPixels[i], 0.0, QuantumRange);
+		const double error = std::abs(static_cast<double>(nativePixels[i]) - reference) / QuantumRange;
+		maxError = std::max(maxError, error);
+	}
+
+	const bool matches = maxError <= tolerance;
+	report_timing("Lab equalise (native)", nativeTime, columns * rows, matches);
+	std::clog << "Maximum native Lab equalisation error: " << std::scientific << maxError << "\n"
+	          << std::defaultfloat;
+
+	return matches;
+}
+
+// Compares the means of a sliding window of histograms kept by running sums against means
+// recomputed from every histogram in the window
+static bool benchmark_window_smoothing() {
+	std::mt19937_64 re{ BENCHMARK_SMOOTHING_FRAMES };
+	std::uniform_real_distribution<float> binDistribution{ 0.0F, 1.0F };
+	std::vector<Histogram> histograms(BENCHMARK_SMOOTHING_FRAMES);
+
+	for (auto& histogram : histograms) {
+		float total = 0.0F;
+
+		for (auto& bin : histogram) {
+			bin = binDistribution(re);
+			total += bin;
+		}
+
+		for (auto& bin : histogram) {
+			bin /= total;
+		}
+	}
+
+	std::vector<Histogram> runningMeans(histograms.size());
+	const double runningTime = time_milliseconds([&histograms, &runningMeans]() {
+		HistogramWindow window{};
+
+		for (std::size_t frame = 0; frame < histograms.size(); frame++) {
+			const Histogram* leaving = (frame >= BENCHMARK_SMOOTHING_WINDOW)
+			                               ? &histograms[frame - BENCHMARK_SMOOTHING_WINDOW]
+			                               : nullptr;
+			window.slide(histograms[frame], leaving);
+			runningMeans[frame] = window.mean();
+		}
+	});
+
+	std::vector<Histogram> recomputedMeans(histograms.size());
+	const double recomputedTime = time_milliseconds([&histograms, &recomputedMeans]() {
+		for (std::size_t frame = 0; frame < histograms.size(); frame++) {
+			const std::size_t first =
+			    (frame >= BENCHMARK_SMOOTHING_WINDOW) ? frame + 1 - BENCHMARK_SMOOTHING_WINDOW : 0;
+
+			for (std::size_t bin = 0; bin < HISTOGRAM_SEGMENTS; bin++) {
+				double sum = 0.0;
+
+				for (std::size_t windowFrame = first; windowFrame <= frame; windowFrame++) {
+					sum += histograms[windowFrame][bin];
+				}
+
+				const auto windowLength = static_cast<double>(frame + 1 - first);
+				recomputedMeans[frame][bin] = static_cast<float>(sum / windowLength);
+			}
+		}
+	});
+
+	double maxError = 0.0;
+
+	for (std::size_t frame = 0; frame < histograms.size(); frame++) {
+		for (std::size_t bin = 0; bin < HISTOGRAM_SEGMENTS; bin++) {
+			maxError = std::max(maxError, static_cast<double>(std::abs(runningMeans[frame][bin] -
+			                                                           recomputedMeans[frame][bin])));
+		}
+	}
+
+	const bool matches = maxError <= 1e-6;
+	std::clog << "Smoothing " << histograms.size() << " histograms over "
+	          << BENCHMARK_SMOOTHING_WINDOW << " frames took " << std::fixed << std::setprecision(2)
+	          << runningTime << " ms with running sums, " << recomputedTime << " ms recomputed"
+	          << (matches ? "" : "  MISMATCH") << "\n"
+	          << "Maximum running mean error: " << std::scientific << maxError << "\n"
+	          << std::defaultfloat;
+
+	return matches;
+}
+
+int run_benchmarks(const std::size_t pixelCount) {
+	std::clog << "Benchmarking kernels over " << pixelCount << " synthetic pixels\n";
+
+	const auto lightnessChannel = synthetic_lightness_channel(pixelCount);
+	const bool histogramsMatch = benchmark_histogram_kernels(lightnessChannel);
+	const bool equalisationsMatch = benchmark_equalisation_kernels(lightnessChannel);
+	const bool lightnessMatches = benchmark_lightness_conversion(pixelCount);
+	const bool labEqualisationsMatch =
+	    benchmark_lab_equalisation(pixelCount, darkening_mapping(lightnessChannel).second);
+	const bool smoothingMatches = benchmark_window_smoothing();
+	const bool allMatch = histogramsMatch && equalisationsMatch && lightnessMatches &&
+	                      labEqualisationsMatch && smoothingMatches;
+
+	return allMatch ? 0 : 1;
+}
+
+int validate_histogram_sampling(const std::filesystem::path& directory,
+                                const std::uint64_t sampleBudget, const std::size_t decodeSize) {
+	// Order images as the server does, so that mappings are between the same pairs of images
+	std::set<std::string> filenames{};
+
+	for (const auto& file : std::filesystem::directory_iterator{ directory }) {
+		if (std::filesystem::is_regular_file(file)) {
+			filenames.insert(file.path());
+		}
+	}
+
+	std::clog << "Validating " << sampleBudget << " pixel histogram samples";
+
+	if (decodeSize != 0) {
+		std::clog << " of images decoded to at least " << decodeSize << " pixels";
+	}
+
+	std::clog << " over " << filenames.size() << " images\n";
+
+	std::optional<std::pair<Histogram, Histogram>> previousHistograms{};
+	double fullTime = 0.0;
+	double sampledTime = 0.0;
+	double worstDistance = 0.0;
+	double worstMappingError = 0.0;
+	std::size_t exceededBounds = 0;
+	bool allRead = true;
+
+	for (const auto& filename : filenames) {
+		std::optional<SampledHistogram> full{};
+		std::optional<SampledHistogram> sampled{};
+
+		const double fullMilliseconds =
+		    time_milliseconds([&full, &filename]() { full = image_get_histogram(filename); });
+		const double sampledMilliseconds =
+		    time_milliseconds([&sampled, &filename, sampleBudget, decodeSize]() {
+			    sampled = image_get_histogram(filename, sampleBudget, decodeSize);
+		    });
+
+		if (!full || !sampled) {
+			std::cerr << "Skipping unreadable image: " << filename << "\n";
+			allRead = false;
+			continue;
+		}
+
+		const double distance = histogram_cdf_distance(full->histogram, sampled->histogram);
+		double mappingError = 0.0;
+
+		if (previousHistograms) {
+			const auto fullMapping =
+			    get_equalisation_parameters(previousHistograms->first, full->histogram);
+			const auto sampledMapping =
+			    get_equalisation_parameters(previousHistograms->second, sampled->histogram);
+
+			for (std::size_t i = 0; i < HISTOGRAM_SEGMENTS; i++) {
+				mappingError = std::max<double>(
+				    mappingError, std::abs(fullMapping[i] - sampledMapping[i]) / QuantumRange);
+			}
+		}
+
+		std::clog << filename << ": " << sampled->sample_count << " samples, CDF error " << distance
+		          << " (bound " << sampled->cdf_error_bound << "), mapping error " << mappingError
+		          << ", " << fullMilliseconds << " ms full, " << sampledMilliseconds << " ms sampled\n";
+
+		fullTime += fullMilliseconds;
+		sampledTime += sampledMilliseconds;
+		worstDistance = std::max(worstDistance, distance);
+		worstMappingError = std::max(worstMappingError, mappingError);
+		exceededBounds += (distance > sampled->cdf_error_bound) ? 1 : 0;
+		previousHistograms = std::make_pair(full->histogram, sampled->histogram);
+	}
+
+	std::clog << "Worst CDF error " << worstDistance << " (" << exceededBounds
+	          << " images exceeded their bound), worst mapping error " << worstMappingError
+	          << " of QuantumRange\n";
+	std::clog << "Histograms took " << fullTime << " ms in full, " << sampledTime << " ms sampled\n";
+
+	return allRead ? 0 : 1;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+// Default synthetic frame size used by the micro-benchmarks, roughly a 45 MP frame
+const constexpr std::size_t BENCHMARK_PIXEL_COUNT = 45'000'000;
+const constexpr std::size_t BENCHMARK_COLUMNS = 8192;
+
+// Synthetic histograms, and the window they are smoothed over, used by the smoothing benchmark
+const constexpr std::size_t BENCHMARK_SMOOTHING_FRAMES = 4096;
+const constexpr std::size_t BENCHMARK_SMOOTHING_WINDOW = 64;
+
+// Default number of pixels sampled per image when validating histogram sampling
+const constexpr std::uint64_t VALIDATION_SAMPLE_BUDGET = 1'000'000;
+
+/**
+ * @brief Run the per-pixel kernel micro-benchmarks over a synthetic frame.
+ *
+ * @param pixelCount Number of pixels in the synthetic frame
+ * @return Process exit code, non-zero if any kernel disagreed with its reference implementation
+ */
+int run_benchmarks(std::size_t pixelCount = BENCHMARK_PIXEL_COUNT);
+
+/**
+ * @brief Compare sampled (and optionally reduced resolution) histograms, and the equalisation
+ * mappings computed from them, against the full histograms of every image in a directory.
+ *
+ * Reports, per image, the time taken by each histogram, the CDF distance between the sampled and
+ * full histograms alongside its estimated bound, and the largest difference between the sampled and
+ * full mappings onto the previous image.
+ *
+ * @param directory The directory of images, processed in the same order as the server
+ * @param sampleBudget Number of pixels to sample per image
+ * @param decodeSize Minimum longest edge to decode sampled images to, or zero for full resolution
+ * @return Process exit code, non-zero if any image could not be read
+ */
+int validate_histogram_sampling(const std::filesystem::path& directory, std::uint64_t sampleBudget,
+                                std::size_t decodeSize = 0);
@@ -0,0 +1,134 @@
+#include "directory_scan.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <fnmatch.h>
+#include <iostream>
+#include <iterator>
+#include <system_error>
+#include <utility>
+
+#include "config.hpp"
+#include "thread_pool.hpp"
+
+bool FrameFilter::accepts(const std::filesystem::path& path) const {
+	const std::string filename = path.filename().string();
+
+	if (!extensions.empty()) {
+		std::string extension = path.extension().string();
+
+		if (!extension.empty()) {
+			extension.erase(0, 1);
+		}
+
+		const auto matchesExtension = [&extension](const std::string& candidate) {
+			return std::equal(extension.begin(), extension.end(), candidate.begin(), candidate.end(),
+			                  [](const char a, const char b) {
+				                  return std::tolower(static_cast<unsigned char>(a)) ==
+				                         std::tolower(static_cast<unsigned char>(b));
+			                  });
+		};
+
+		if (std::none_of(extensions.begin(), extensions.end(), matchesExtension)) {
+			return false;
+		}
+	}
+
+	return patterns.empty() ||
+	       std::any_of(patterns.begin(), patterns.end(), [&filename](const std::string& pattern) {
+		       return ::fnmatch(pattern.c_str(), filename.c_str(), 0) == 0;
+	       });
+}
+
+DirectoryScan::DirectoryScan(std::filesystem::path root, FrameFilter filter, const bool recursive)
+    : root{ std::move(root) }, filter{ std::move(filter) }, recursive{ recursive }, found{},
+      finished{ false } {
+	scanJob = std::async(std::launch::async, &DirectoryScan::scan, this);
+}
+
+DirectoryScan::~DirectoryScan() {
+	scanJob.wait();
+}
+
+std::optional<std::vector<std::string>>
+DirectoryScan::next_batch(const std::chrono::milliseconds timeout) {
+	std::unique_lock<std::mutex> foundLock{ foundMutex };
+	foundCondition.wait_for(foundLock, timeout, [this]() { return finished || !found.empty(); });
+
+	if (finished && found.empty()) {
+		return std::nullopt;
+	}
+
+	return std::exchange(found, {});
+}
+
+void DirectoryScan::scan() {
+	std::vector<std::filesystem::path> level{ root };
+
+	while (!level.empty()) {
+		std::vector<std::filesystem::path> nextLevel{};
+		std::mutex nextLevelMutex{};
+
+		ThreadPool::shared().parallel_for(level.size(), [&](const std::size_t i) {
+			std::vector<std::filesystem::path> subdirectories = this->scan_directory(level[i]);
+			std::unique_lock<std::mutex> nextLevelLock{ nextLevelMutex };
+
+			std::move(subdirectories.begin(), subdirectories.end(), std::back_inserter(nextLevel));
+		});
+
+		level = std::move(nextLevel);
+	}
+
+	{
+		std::unique_lock<std::mutex> foundLock{ foundMutex };
+		finished = true;
+	}
+
+	foundCondition.notify_all();
+}
+
+std::vector<std::filesystem::path>
+DirectoryScan::scan_directory(const std::filesystem::path& directory) {
+	std::vector<std::filesystem::path> subdirectories{};
+	std::vector<std::string> files{};
+	std::error_code error{};
+
+	for (std::filesystem::directory_iterator entry{ directory, error }, end{}; !error && entry != end;
+	     entry.increment(error)) {
+		// An entry that cannot be typed is skipped, rather than ending the directory. Symbolic links
+		// are not followed into directories, as they may form cycles.
+		std::error_code typeError{};
+
+		if (recursive && !entry->is_symlink(typeError) && entry->is_directory(typeError)) {
+			subdirectories.push_back(entry->path());
+		} else if (entry->is_regular_file(typeError) && filter.accepts(entry->path())) {
+			files.push_back(entry->path());
+
+			if (files.size() >= SCAN_BATCH_FILES) {
+				this->publish(files);
+			}
+		}
+	}
+
+	if (error) {
+		std::clog << "Unable to read directory '" << directory.string() << "': " << error.message()
+		          << "\n";
+	}
+
+	this->publish(files);
+	return subdirectories;
+}
+
+void DirectoryScan::publish(std::vector<std::string>& files) {
+	if (files.empty()) {
+		return;
+	}
+
+	{
+		std::unique_lock<std::mutex> foundLock{ foundMutex };
+		std::move(files.begin(), files.end(), std::back_inserter(found));
+	}
+
+	files.clear();
+	foundCondition.notify_all();
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Which files are taken as frames, by their names alone so that files are filtered without being
+// read or stat'd
+struct FrameFilter {
+	// Extensions of frames, without the dot and compared case insensitively, or empty for any
+	std::vector<std::string> extensions{};
+	// Glob patterns (see fnmatch(3)) a frame's filename must match one of, or empty for any
+	std::vector<std::string> patterns{};
+
+	[[nodiscard]] bool accepts(const std::filesystem::path& path) const;
+};
+
+/**
+ * @brief Lists the files of a directory tree in the background, handing them out in batches.
+ *
+ * Files are typed from the directory entries themselves, so most filesystems need no stat call per
+ * file, and are published every SCAN_BATCH_FILES files rather than once the whole tree is read.
+ * Subdirectories of a recursive scan are read in parallel, a level of the tree at a time, as each
+ * read is a round trip on network filesystems.
+ */
+class DirectoryScan {
+public:
+	DirectoryScan(std::filesystem::path root, FrameFilter filter, bool recursive);
+	DirectoryScan(const DirectoryScan& other) = delete;
+	DirectoryScan& operator=(const DirectoryScan& other) = delete;
+	// Waits for the scan to finish
+	~DirectoryScan();
+
+	// Waits up to `timeout` for more files, returning those found since last called, which may be
+	// none. Returns nothing once every file found has been returned.
+	[[nodiscard]] std::optional<std::vector<std::string>>
+	next_batch(std::chrono::milliseconds timeout);
+
+protected:
+	void scan();
+	// Reads a single directory, returning its subdirectories
+	std::vector<std::filesystem::path> scan_directory(const std::filesystem::path& directory);
+	void publish(std::vector<std::string>& files);
+
+	const std::filesystem::path root;
+	const FrameFilter filter;
+	const bool recursive;
+
+	std::mutex foundMutex;
+	std::condition_variable foundCondition;
+	std::vector<std::string> found;
+	bool finished;
+	std::future<void> scanJob;
+};
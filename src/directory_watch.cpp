@@ -0,0 +1,137 @@
+#include "directory_watch.hpp"
+
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <sys/inotify.h>
+#include <system_error>
+#include <unistd.h>
+#include <utility>
+
+DirectoryWatch::DirectoryWatch(std::filesystem::path directory, const bool recursive)
+    : directory{ std::move(directory) }, recursive{ recursive }, file{ -1 }, watchedDirectories{} {
+	file = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+	if (file < 0 || !this->add_watch(this->directory)) {
+		std::clog << "Unable to watch '" << this->directory.string()
+		          << "' for new frames: " << std::strerror(errno) << "\n";
+
+		if (file >= 0) {
+			::close(file);
+			file = -1;
+		}
+	}
+}
+
+DirectoryWatch::~DirectoryWatch() {
+	if (file >= 0) {
+		::close(file);
+	}
+}
+
+bool DirectoryWatch::is_open() const {
+	return file >= 0;
+}
+
+int DirectoryWatch::descriptor() const {
+	return file;
+}
+
+std::vector<std::filesystem::path> DirectoryWatch::take_completed_files() {
+	std::vector<std::filesystem::path> files{};
+
+	if (!this->is_open()) {
+		return files;
+	}
+
+	alignas(inotify_event) std::array<char, 64 * 1024> events{};
+	ssize_t length = 0;
+
+	while ((length = ::read(file, events.data(), events.size())) > 0) {
+		for (ssize_t offset = 0; offset < length;) {
+			const auto* event = reinterpret_cast<const inotify_event*>(events.data() + offset);
+			offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+
+			const auto watchedDirectory = watchedDirectories.find(event->wd);
+
+			if (watchedDirectory == watchedDirectories.end()) {
+				continue;
+			}
+
+			// The directory was removed, along with its watch
+			if ((event->mask & IN_IGNORED) != 0) {
+				watchedDirectories.erase(watchedDirectory);
+				continue;
+			}
+
+			if (event->len == 0) {
+				continue;
+			}
+
+			const std::filesystem::path path = watchedDirectory->second / event->name;
+
+			if ((event->mask & IN_ISDIR) != 0) {
+				// Only a directory moved in is known to hold completed files
+				const bool movedIn = (event->mask & IN_MOVED_TO) != 0;
+
+				if (recursive && !this->add_watch(path, movedIn ? &files : nullptr)) {
+					std::clog << "Unable to watch '" << path.string()
+					          << "' for new frames: " << std::strerror(errno) << "\n";
+				}
+			} else if ((event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) != 0) {
+				files.push_back(path);
+			}
+		}
+	}
+
+	if (length < 0 && errno != EAGAIN && errno != EINTR) {
+		std::clog << "Unable to read new frames in '" << directory.string()
+		          << "': " << std::strerror(errno) << "\n";
+	}
+
+	return files;
+}
+
+bool DirectoryWatch::add_watch(const std::filesystem::path& watchedDirectory,
+                               std::vector<std::filesystem::path>* existingFiles) {
+	const std::uint32_t mask = IN_CLOSE_WRITE | IN_MOVED_TO | (recursive ? IN_CREATE : 0U);
+	const int watch = ::inotify_add_watch(file, watchedDirectory.c_str(), mask);
+
+	if (watch < 0) {
+		return false;
+	}
+
+	watchedDirectories.insert_or_assign(watch, watchedDirectory);
+
+	if (!recursive && existingFiles == nullptr) {
+		return true;
+	}
+
+	// Subdirectories are watched once their parent is, so none created in between is missed
+	std::error_code error{};
+
+	for (std::filesystem::directory_iterator entry{ watchedDirectory, error }, end{};
+	     !error && entry != end; entry.increment(error)) {
+		// As when scanning, symbolic links are not followed into directories, as they may form cycles
+		// or watch a directory twice
+		std::error_code typeError{};
+
+		if (recursive && !entry->is_symlink(typeError) && entry->is_directory(typeError)) {
+			if (!this->add_watch(entry->path(), existingFiles)) {
+				std::clog << "Unable to watch '" << entry->path().string()
+				          << "' for new frames: " << std::strerror(errno) << "\n";
+			}
+		} else if (existingFiles != nullptr && entry->is_regular_file(typeError)) {
+			existingFiles->push_back(entry->path());
+		}
+	}
+
+	if (error) {
+		std::clog << "Unable to read watched directory '" << watchedDirectory.string()
+		          << "': " << error.message() << "\n";
+	}
+
+	return true;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <filesystem>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Reports files completed in a directory, through inotify.
+ *
+ * Files count as completed once they are closed after being written, or moved into the directory,
+ * so frames are not picked up while a camera is still writing them. A recursive watch also watches
+ * each subdirectory, including those created or moved in later. The files of a directory moved in
+ * are reported with it, while those of a directory created are reported as each is completed.
+ */
+class DirectoryWatch {
+public:
+	explicit DirectoryWatch(std::filesystem::path directory, bool recursive = false);
+	DirectoryWatch(const DirectoryWatch& other) = delete;
+	DirectoryWatch& operator=(const DirectoryWatch& other) = delete;
+	~DirectoryWatch();
+
+	[[nodiscard]] bool is_open() const;
+
+	// Readable whenever files have been completed, for polling alongside sockets
+	[[nodiscard]] int descriptor() const;
+
+	// Files completed since last called, without blocking
+	[[nodiscard]] std::vector<std::filesystem::path> take_completed_files();
+
+protected:
+	// Watches `watchedDirectory`, and its subdirectories when recursive, adding the files already in
+	// them to `existingFiles` when given. Returns whether `watchedDirectory` itself is watched.
+	bool add_watch(const std::filesystem::path& watchedDirectory,
+	               std::vector<std::filesystem::path>* existingFiles = nullptr);
+
+	const std::filesystem::path directory;
+	const bool recursive;
+	int file;
+	// The directory each watch descriptor is for
+	std::unordered_map<int, std::filesystem::path> watchedDirectories;
+};
@@ -0,0 +1,207 @@
+#include "equalisation.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+
+#include "colour.hpp"
+#include "simd.hpp"
+#include "thread_pool.hpp"
+
+constexpr bool QUANTUM_TABLE_SUPPORTED =
+    std::is_integral_v<Magick::Quantum> && sizeof(Magick::Quantum) <= sizeof(std::uint16_t);
+constexpr bool QUANTUM_SIMD_SUPPORTED =
+    SIMD_X86_KERNELS && std::is_same_v<Magick::Quantum, float>;
+
+// Rows of pixels equalised at a time by the native path
+const constexpr std::size_t EQUALISATION_TILE_ROWS = 32;
+
+// Scale from a quantum onto the (fractional) histogram bin it falls in. Interpolation is done in
+// double precision, as the final mapping bin can be very steep.
+const constexpr double QUANTUM_BIN_SCALE =
+    static_cast<double>(HISTOGRAM_SEGMENTS - 1) / static_cast<double>(QuantumRange);
+const constexpr double MAX_BIN = HISTOGRAM_SEGMENTS - 1;
+
+double lerp(double a, double b, double t) {
+	return a + (b - a) * t;
+}
+
+Magick::Quantum linear_map(Magick::Quantum value, const EqualisationHistogramMapping& mapping) {
+	const double histogramBin = (static_cast<double>(value) / static_cast<double>(QuantumRange)) *
+	                            static_cast<double>(mapping.size() - 1);
+	const uint32_t histogramBinRounded = static_cast<size_t>(round(histogramBin));
+	const double errorDelta = histogramBin - static_cast<double>(histogramBinRounded);
+	const double baseValue = mapping[histogramBinRounded];
+	const double belowValue = mapping[(histogramBinRounded == 0) ? 0 : (histogramBinRounded - 1)];
+	const double aboveValue =
+	    mapping[(histogramBinRounded >= mapping.size() - 1) ? histogramBinRounded
+	                                                        : (histogramBinRounded + 1)];
+
+	assert((belowValue <= baseValue && aboveValue >= baseValue));
+
+	// What value needs to be interpolated with the current value
+	double interpolateValue = 0.0;
+
+	if (errorDelta >= 0.0) {
+		interpolateValue = aboveValue;
+	} else {
+		interpolateValue = belowValue;
+	}
+
+	const auto absErrorDelta = abs(errorDelta);
+
+	// Linearly interpolate between the base value and the interpolated value.
+	return static_cast<Magick::Quantum>(lerp(baseValue, interpolateValue, absErrorDelta));
+}
+
+EqualisationLookupTable::EqualisationLookupTable(const EqualisationHistogramMapping& mapping)
+    : quantum_table{}, bin_bases{}, bin_slopes{} {
+	for (std::size_t bin = 0; bin < HISTOGRAM_SEGMENTS; bin++) {
+		const std::size_t nextBin = std::min<std::size_t>(bin + 1, HISTOGRAM_SEGMENTS - 1);
+
+		assert(mapping[bin] <= mapping[nextBin]);
+
+		bin_bases[bin] = mapping[bin];
+		bin_slopes[bin] = mapping[nextBin] - mapping[bin];
+	}
+
+	if constexpr (QUANTUM_TABLE_SUPPORTED) {
+		quantum_table.resize(static_cast<std::size_t>(QuantumRange) + 1);
+
+		for (std::size_t quantum = 0; quantum < quantum_table.size(); quantum++) {
+			quantum_table[quantum] = linear_map(static_cast<Magick::Quantum>(quantum), mapping);
+		}
+	}
+}
+
+static inline Magick::Quantum
+interpolate_bins(const Magick::Quantum value, const std::array<double, HISTOGRAM_SEGMENTS>& bases,
+                 const std::array<double, HISTOGRAM_SEGMENTS>& slopes) {
+	const double histogramBin = std::clamp(value * QUANTUM_BIN_SCALE, 0.0, MAX_BIN);
+	const auto bin = static_cast<std::uint32_t>(histogramBin);
+
+	return static_cast<Magick::Quantum>(bases[bin] + slopes[bin] * (histogramBin - bin));
+}
+
+Magick::Quantum EqualisationLookupTable::operator()(const Magick::Quantum value) const {
+	if constexpr (QUANTUM_TABLE_SUPPORTED) {
+		return quantum_table[value];
+	} else {
+		return interpolate_bins(value, bin_bases, bin_slopes);
+	}
+}
+
+#if SIMD_X86_KERNELS
+
+SIMD_KERNELS_BEGIN
+
+// Maps four pixels at a time, gathering the stride-separated lightness values and the per-bin
+// interpolation parameters. AVX2 has no scatter, so results are written back individually.
+__attribute__((target("avx2,fma"))) static std::size_t
+apply_bins_avx2(float* pixels, const std::size_t pixelCount, const std::size_t channels,
+                const std::array<double, HISTOGRAM_SEGMENTS>& bases,
+                const std::array<double, HISTOGRAM_SEGMENTS>& slopes) {
+	const __m256d scale = _mm256_set1_pd(QUANTUM_BIN_SCALE);
+	const __m256d zero = _mm256_setzero_pd();
+	const __m256d maxBin = _mm256_set1_pd(MAX_BIN);
+	const __m128i strides = _mm_mullo_epi32(_mm_setr_epi32(0, 1, 2, 3),
+	                                        _mm_set1_epi32(static_cast<int>(channels)));
+
+	alignas(16) float mapped[4];
+	std::size_t i = 0;
+
+	for (; i + 4 <= pixelCount; i += 4) {
+		float* const block = pixels + i * channels;
+		const __m256d values = _mm256_cvtps_pd(_mm_i32gather_ps(block, strides, sizeof(float)));
+		const __m256d histogramBin =
+		    _mm256_min_pd(_mm256_max_pd(_mm256_mul_pd(values, scale), zero), maxBin);
+		const __m128i bin = _mm256_cvttpd_epi32(histogramBin);
+		const __m256d fraction = _mm256_sub_pd(histogramBin, _mm256_cvtepi32_pd(bin));
+		const __m256d base = _mm256_i32gather_pd(bases.data(), bin, sizeof(double));
+		const __m256d slope = _mm256_i32gather_pd(slopes.data(), bin, sizeof(double));
+
+		_mm_store_ps(mapped, _mm256_cvtpd_ps(_mm256_fmadd_pd(slope, fraction, base)));
+
+		for (std::size_t lane = 0; lane < 4; lane++) {
+			block[lane * channels] = mapped[lane];
+		}
+	}
+
+	return i;
+}
+
+SIMD_KERNELS_END
+
+#endif
+
+void EqualisationLookupTable::apply(Magick::Quantum* pixels, const std::size_t pixelCount,
+                                    const std::size_t channels) const {
+	std::size_t i = 0;
+
+#if SIMD_X86_KERNELS
+	if (QUANTUM_SIMD_SUPPORTED && cpu_supports_avx2()) {
+		i = apply_bins_avx2(reinterpret_cast<float*>(pixels), pixelCount, channels, bin_bases,
+		                    bin_slopes);
+	}
+#endif
+
+	for (; i < pixelCount; i++) {
+		Magick::Quantum& lightness = pixels[i * channels];
+		lightness = (*this)(lightness);
+	}
+}
+
+void equalise_image_magick(Magick::Image& image, const EqualisationLookupTable& lookupTable,
+                           const std::size_t bandCount) {
+	image.colorSpace(Magick::LabColorspace);
+	image.modifyImage();
+
+	const std::size_t columns = image.columns();
+	const std::size_t channels = image.channels();
+	const std::size_t bands = row_band_count(image.rows(), bandCount);
+	Magick::Quantum* pixels = image.getPixels(0, 0, columns, image.rows());
+
+	// Map the L channel, skipping over the a and b (and any alpha) channels of each pixel
+	ThreadPool::shared().parallel_for(bands, [&](const std::size_t band) {
+		const auto [firstRow, endRow] = band_range(image.rows(), bands, band);
+
+		lookupTable.apply(pixels + firstRow * columns * channels, (endRow - firstRow) * columns,
+		                  channels);
+	});
+
+	image.syncPixels();
+	image.colorSpace(Magick::sRGBColorspace);
+}
+
+void equalise_image_native(Magick::Image& image, const EqualisationLookupTable& lookupTable,
+                           const std::size_t bandCount) {
+	assert(native_equalisation_supported(image));
+
+	image.modifyImage();
+
+	Magick::Quantum* pixels = image.getPixels(0, 0, image.columns(), image.rows());
+	equalise_srgb_rows(pixels, image.columns(), image.rows(), image.channels(), lookupTable,
+	                   bandCount);
+
+	image.syncPixels();
+}
+
+void equalise_srgb_rows(Magick::Quantum* pixels, const std::size_t columns, const std::size_t rows,
+                        const std::size_t channels, const EqualisationLookupTable& lookupTable,
+                        const std::size_t bandCount) {
+	const std::size_t bands = row_band_count(rows, bandCount);
+
+	// Each band walks its rows a tile at a time, so that the intermediate Lab values stay in cache
+	ThreadPool::shared().parallel_for(bands, [&](const std::size_t band) {
+		const auto [firstRow, endRow] = band_range(rows, bands, band);
+
+		for (std::size_t row = firstRow; row < endRow; row += EQUALISATION_TILE_ROWS) {
+			const std::size_t tileRows = std::min(EQUALISATION_TILE_ROWS, endRow - row);
+
+			equalise_srgb_lightness(pixels + row * columns * channels, columns * tileRows, channels,
+			                        lookupTable);
+		}
+	});
+}
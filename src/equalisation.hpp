@@ -0,0 +1,52 @@
+#pragma once
+
+#include <Magick++.h>
+#include <array>
+#include <cstddef>
+#include <vector>
+
+#include "algorithm.hpp"
+
+// Maximum error of the lookup table relative to `linear_map`, as a proportion of the larger of
+// QuantumRange and the mapped value. Integer quantum builds are exact.
+const constexpr double EQUALISATION_TABLE_TOLERANCE = 1e-6;
+
+// Reference per-value mapping of a lightness quantum through an equalisation mapping.
+Magick::Quantum linear_map(Magick::Quantum value, const EqualisationHistogramMapping& mapping);
+
+// An equalisation mapping expanded once per job into a form that is cheap to apply per pixel.
+//
+// Integer quantum builds (Q8/Q16) expand the mapping into a dense Quantum -> Quantum table that is
+// exactly `linear_map`. HDRI builds cannot enumerate their inputs, so instead keep a compact table
+// of per-bin bases and slopes: `linear_map` is a continuous piecewise-linear interpolation between
+// adjacent mapping entries, so this reproduces it to within rounding of the result.
+class EqualisationLookupTable {
+public:
+	explicit EqualisationLookupTable(const EqualisationHistogramMapping& mapping);
+
+	[[nodiscard]] Magick::Quantum operator()(Magick::Quantum value) const;
+
+	// Maps the first channel of each of `pixelCount` pixels, `channels` quantums apart, in place.
+	void apply(Magick::Quantum* pixels, std::size_t pixelCount, std::size_t channels) const;
+
+protected:
+	std::vector<Magick::Quantum> quantum_table;
+	std::array<double, HISTOGRAM_SEGMENTS> bin_bases;
+	std::array<double, HISTOGRAM_SEGMENTS> bin_slopes;
+};
+
+// Equalises the lightness of an sRGB `image` in place through ImageMagick's Lab conversion. The L
+// channel is mapped in up to `bandCount` row bands in parallel.
+void equalise_image_magick(Magick::Image& image, const EqualisationLookupTable& lookupTable,
+                           std::size_t bandCount = 1);
+
+// Equalises the lightness of an sRGB `image` in place with a fused native Lab round trip over row
+// tiles, split into up to `bandCount` row bands in parallel. Requires
+// `native_equalisation_supported(image)`.
+void equalise_image_native(Magick::Image& image, const EqualisationLookupTable& lookupTable,
+                           std::size_t bandCount = 1);
+
+// Equalises `rows` rows of interleaved sRGB pixels in place, as `equalise_image_native` does.
+void equalise_srgb_rows(Magick::Quantum* pixels, std::size_t columns, std::size_t rows,
+                        std::size_t channels, const EqualisationLookupTable& lookupTable,
+                        std::size_t bandCount = 1);
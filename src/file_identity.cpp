@@ -0,0 +1,72 @@
+#include "file_identity.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <system_error>
+#include <vector>
+
+#include "config.hpp"
+
+// Prime of the 64 bit FNV-1a hash
+static const constexpr std::uint64_t FNV_PRIME = 0x100000001b3ULL;
+
+bool FileIdentity::operator==(const FileIdentity& other) const {
+	return size == other.size && modified == other.modified && content_hash == other.content_hash;
+}
+
+bool FileIdentity::operator!=(const FileIdentity& other) const {
+	return !(*this == other);
+}
+
+std::optional<FileIdentity> read_file_identity(const std::filesystem::path& path) {
+	std::error_code error{};
+	const std::uint64_t size = std::filesystem::file_size(path, error);
+
+	if (error) {
+		return std::nullopt;
+	}
+
+	const auto modified = std::filesystem::last_write_time(path, error);
+
+	if (error) {
+		return std::nullopt;
+	}
+
+	std::ifstream file{ path, std::ios_base::binary | std::ios_base::in };
+
+	if (!file) {
+		return std::nullopt;
+	}
+
+	// Hash the head of the file, then the tail where it does not overlap the head
+	const std::uint64_t headSize = std::min<std::uint64_t>(size, CONTENT_HASH_SPAN);
+	const std::uint64_t tailStart = std::max<std::uint64_t>(headSize, size - headSize);
+	std::vector<char> head(headSize);
+	std::vector<char> tail(size - tailStart);
+
+	file.read(head.data(), static_cast<std::streamsize>(head.size()));
+	file.seekg(static_cast<std::streamoff>(tailStart));
+	file.read(tail.data(), static_cast<std::streamsize>(tail.size()));
+
+	if (!file) {
+		return std::nullopt;
+	}
+
+	std::uint64_t contentHash = hash_bytes(&size, sizeof(size));
+	contentHash = hash_bytes(head.data(), head.size(), contentHash);
+	contentHash = hash_bytes(tail.data(), tail.size(), contentHash);
+
+	return FileIdentity{ size, static_cast<std::int64_t>(modified.time_since_epoch().count()),
+		                   contentHash };
+}
+
+std::uint64_t hash_bytes(const void* data, const std::size_t size, std::uint64_t hash) {
+	const auto* bytes = static_cast<const unsigned char*>(data);
+
+	for (std::size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= FNV_PRIME;
+	}
+
+	return hash;
+}
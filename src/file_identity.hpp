@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+
+// Offset basis of the 64 bit FNV-1a hash
+const constexpr std::uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325ULL;
+
+// Identifies the contents of a file between runs, without reading all of it
+struct FileIdentity {
+	std::uint64_t size;
+	// Ticks of `std::filesystem::file_time_type` since its epoch
+	std::int64_t modified;
+	// Hash of the first and last `CONTENT_HASH_SPAN` bytes of the file, and its size
+	std::uint64_t content_hash;
+
+	bool operator==(const FileIdentity& other) const;
+	bool operator!=(const FileIdentity& other) const;
+};
+
+// Reads the identity of the file at `path`, if it can be read
+std::optional<FileIdentity> read_file_identity(const std::filesystem::path& path);
+
+// 64 bit FNV-1a hash of `size` bytes from `data`, continuing from `hash`
+std::uint64_t hash_bytes(const void* data, std::size_t size, std::uint64_t hash = FNV_OFFSET_BASIS);
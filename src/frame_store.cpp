@@ -0,0 +1,164 @@
+#include "frame_store.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+InternedPaths::InternedPaths(const std::vector<std::string>& paths) : characters{}, offsets{} {
+	assert(std::is_sorted(paths.begin(), paths.end()));
+
+	std::size_t totalLength = 0;
+
+	for (const auto& path : paths) {
+		totalLength += path.size();
+	}
+
+	characters.reserve(totalLength);
+	offsets.reserve(paths.size() + 1);
+
+	for (const auto& path : paths) {
+		offsets.push_back(characters.size());
+		characters.append(path);
+	}
+
+	offsets.push_back(characters.size());
+}
+
+std::size_t InternedPaths::size() const {
+	return offsets.empty() ? 0 : offsets.size() - 1;
+}
+
+bool InternedPaths::empty() const {
+	return this->size() == 0;
+}
+
+std::string_view InternedPaths::operator[](const std::size_t index) const {
+	return std::string_view{ characters }.substr(offsets[index], offsets[index + 1] - offsets[index]);
+}
+
+std::optional<std::size_t> InternedPaths::find(const std::string_view path) const {
+	std::size_t first = 0;
+	std::size_t last = this->size();
+
+	while (first < last) {
+		const std::size_t middle = first + (last - first) / 2;
+
+		if ((*this)[middle] < path) {
+			first = middle + 1;
+		} else {
+			last = middle;
+		}
+	}
+
+	if (first == this->size() || (*this)[first] != path) {
+		return std::nullopt;
+	}
+
+	return first;
+}
+
+void InternedPaths::push_back(const std::string_view path) {
+	assert(this->empty() || (*this)[this->size() - 1] < path);
+
+	if (offsets.empty()) {
+		offsets.push_back(0);
+	}
+
+	characters.append(path);
+	offsets.push_back(characters.size());
+}
+
+std::size_t InternedPaths::memory_bytes() const {
+	return characters.capacity() + offsets.capacity() * sizeof(std::uint64_t);
+}
+
+FrameHistograms::FrameHistograms(const std::size_t frameCount, const bool quantised)
+    : quantised{ quantised }, frameSlots(frameCount, NO_SLOT) {}
+
+bool FrameHistograms::contains(const std::size_t frame) const {
+	return frameSlots[frame] != NO_SLOT;
+}
+
+Histogram FrameHistograms::at(const std::size_t frame) const {
+	assert(this->contains(frame));
+
+	const std::size_t first = static_cast<std::size_t>(frameSlots[frame]) * HISTOGRAM_SEGMENTS;
+	Histogram histogram{};
+
+	if (!quantised) {
+		std::copy_n(bins.begin() + first, HISTOGRAM_SEGMENTS, histogram.begin());
+		return histogram;
+	}
+
+	const float scale = 1.0F / std::numeric_limits<std::uint16_t>::max();
+	std::uint16_t previous = 0;
+
+	for (std::size_t bin = 0; bin < HISTOGRAM_SEGMENTS; bin++) {
+		const std::uint16_t cumulative = quantisedBins[first + bin];
+		histogram[bin] = static_cast<float>(cumulative - previous) * scale;
+		previous = cumulative;
+	}
+
+	return histogram;
+}
+
+void FrameHistograms::insert(const std::size_t frame, const Histogram& histogram) {
+	if (!this->contains(frame)) {
+		if (!freeSlots.empty()) {
+			frameSlots[frame] = freeSlots.back();
+			freeSlots.pop_back();
+		} else {
+			frameSlots[frame] = slotCount++;
+
+			if (quantised) {
+				quantisedBins.resize(static_cast<std::size_t>(slotCount) * HISTOGRAM_SEGMENTS);
+			} else {
+				bins.resize(static_cast<std::size_t>(slotCount) * HISTOGRAM_SEGMENTS);
+			}
+		}
+
+		heldCount++;
+		peakHeldCount = std::max(peakHeldCount, heldCount);
+	}
+
+	const std::size_t first = static_cast<std::size_t>(frameSlots[frame]) * HISTOGRAM_SEGMENTS;
+
+	if (!quantised) {
+		std::copy(histogram.begin(), histogram.end(), bins.begin() + first);
+		return;
+	}
+
+	// Quantise the running sum rather than each bin, so that errors do not accumulate
+	double cumulative = 0.0;
+
+	for (std::size_t bin = 0; bin < HISTOGRAM_SEGMENTS; bin++) {
+		cumulative += histogram[bin];
+		quantisedBins[first + bin] = static_cast<std::uint16_t>(
+		    std::lround(std::clamp(cumulative, 0.0, 1.0) * std::numeric_limits<std::uint16_t>::max()));
+	}
+}
+
+void FrameHistograms::erase(const std::size_t frame) {
+	if (!this->contains(frame)) {
+		return;
+	}
+
+	freeSlots.push_back(frameSlots[frame]);
+	frameSlots[frame] = NO_SLOT;
+	heldCount--;
+}
+
+void FrameHistograms::add_frame() {
+	frameSlots.push_back(NO_SLOT);
+}
+
+std::size_t FrameHistograms::peak_held_count() const {
+	return peakHeldCount;
+}
+
+std::size_t FrameHistograms::memory_bytes() const {
+	return frameSlots.capacity() * sizeof(std::uint32_t) +
+	       freeSlots.capacity() * sizeof(std::uint32_t) + bins.capacity() * sizeof(float) +
+	       quantisedBins.capacity() * sizeof(std::uint16_t);
+}
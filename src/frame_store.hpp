@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "algorithm.hpp"
+
+/**
+ * @brief The paths of a run's frames, interned in a single buffer.
+ *
+ * Paths are kept in sorted order, the order frames are equalised in, so the frame of a path is
+ * found by binary search rather than through a separate index.
+ */
+class InternedPaths {
+public:
+	InternedPaths() = default;
+	// `paths` must be sorted
+	explicit InternedPaths(const std::vector<std::string>& paths);
+
+	[[nodiscard]] std::size_t size() const;
+	[[nodiscard]] bool empty() const;
+	[[nodiscard]] std::string_view operator[](std::size_t index) const;
+
+	// The index of `path`, if it is one of the paths
+	[[nodiscard]] std::optional<std::size_t> find(std::string_view path) const;
+
+	// Adds a path, which must sort after every path already held
+	void push_back(std::string_view path);
+
+	[[nodiscard]] std::size_t memory_bytes() const;
+
+protected:
+	std::string characters;
+	// Offset of each path in `characters`, followed by the end of the last
+	std::vector<std::uint64_t> offsets;
+};
+
+/**
+ * @brief The histograms of a run's frames, held contiguously.
+ *
+ * Histograms are held in a pool of fixed-size slots, taken as histograms are inserted and reused
+ * once they are erased, so holding a sliding window of frames needs only as many slots as the
+ * window.
+ * Histograms may instead be held as cumulative distributions quantised to 16 bits, halving their
+ * size. This moves each point of the distribution by at most 1 / 131070, well within the error of
+ * sampled histograms.
+ */
+class FrameHistograms {
+public:
+	FrameHistograms() = default;
+	FrameHistograms(std::size_t frameCount, bool quantised);
+
+	[[nodiscard]] bool contains(std::size_t frame) const;
+	// The histogram of `frame`, which must be held
+	[[nodiscard]] Histogram at(std::size_t frame) const;
+
+	// Holds the histogram of `frame`, replacing any already held
+	void insert(std::size_t frame, const Histogram& histogram);
+	// Releases the histogram of `frame`, if held
+	void erase(std::size_t frame);
+
+	// Adds a frame after the last, without a histogram
+	void add_frame();
+
+	// The most histograms held at once
+	[[nodiscard]] std::size_t peak_held_count() const;
+	[[nodiscard]] std::size_t memory_bytes() const;
+
+protected:
+	static const constexpr std::uint32_t NO_SLOT = UINT32_MAX;
+
+	bool quantised = false;
+
+	// Slot holding each frame's histogram, or NO_SLOT
+	std::vector<std::uint32_t> frameSlots;
+	std::vector<std::uint32_t> freeSlots;
+	std::uint32_t slotCount = 0;
+	std::size_t heldCount = 0;
+	std::size_t peakHeldCount = 0;
+
+	// HISTOGRAM_SEGMENTS bins for each slot, in whichever form histograms are held
+	std::vector<float> bins;
+	std::vector<std::uint16_t> quantisedBins;
+};
@@ -0,0 +1,284 @@
+#include "frame_stream.hpp"
+
+#include <Magick++.h>
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+FrameStream::FrameStream(const std::string& path, const FrameStreamFormat format,
+                         const std::size_t frameRate)
+    : path{ path }, format{ format }, frameRate{ frameRate }, file{ -1 }, ownsFile{ false },
+      writtenFile{ -1 }, submitted{}, writing{ false }, stopping{ false }, nextFrame{ 0 },
+      peakBufferedCount{ 0 }, reorderBuffer{}, columns{ 0 }, rows{ 0 }, pixels{}, planes{},
+      writeThread{} {
+	// A reader that goes away is reported as a failed write, rather than ending the process
+	std::signal(SIGPIPE, SIG_IGN);
+
+	if (path == "-") {
+		file = STDOUT_FILENO;
+	} else {
+		this->open_path();
+	}
+
+	if (!this->is_open()) {
+		return;
+	}
+
+	writtenFile = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	if (writtenFile < 0) {
+		std::clog << "Unable to create frame stream completion event: " << std::strerror(errno)
+		          << "\n";
+	}
+
+	writeThread = std::thread{ &FrameStream::run_writes, this };
+}
+
+void FrameStream::open_path() {
+	struct stat pathStat {};
+
+	if (::stat(path.c_str(), &pathStat) != 0 && errno == ENOENT &&
+	    ::mkfifo(path.c_str(), 0644) != 0) {
+		std::clog << "Unable to create frame stream pipe '" << path << "': " << std::strerror(errno)
+		          << "\n";
+		return;
+	}
+
+	file = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+	if (file < 0) {
+		std::clog << "Unable to open frame stream '" << path << "': " << std::strerror(errno) << "\n";
+		return;
+	}
+
+	ownsFile = true;
+}
+
+FrameStream::~FrameStream() {
+	if (writeThread.joinable()) {
+		{
+			std::unique_lock<std::mutex> submittedLock{ submittedMutex };
+			stopping = true;
+		}
+
+		submittedCondition.notify_all();
+		writeThread.join();
+	}
+
+	if (!reorderBuffer.empty()) {
+		std::clog << "Frame stream ended before frame " << nextFrame << ", leaving "
+		          << reorderBuffer.size() << " later frames unwritten\n";
+	}
+
+	this->close();
+
+	if (writtenFile >= 0) {
+		::close(writtenFile);
+	}
+}
+
+bool FrameStream::is_open() const {
+	return file >= 0;
+}
+
+void FrameStream::submit(const std::size_t frame, ImageData tiffData) {
+	if (!writeThread.joinable()) {
+		return;
+	}
+
+	{
+		std::unique_lock<std::mutex> submittedLock{ submittedMutex };
+		submitted.emplace_back(frame, std::move(tiffData));
+	}
+
+	submittedCondition.notify_all();
+}
+
+int FrameStream::descriptor() const {
+	return writtenFile;
+}
+
+bool FrameStream::take_written() {
+	std::uint64_t writtenCount = 0;
+
+	if (writtenFile < 0 || ::read(writtenFile, &writtenCount, sizeof(writtenCount)) < 0) {
+		return false;
+	}
+
+	return writtenCount != 0;
+}
+
+void FrameStream::drain() {
+	std::unique_lock<std::mutex> submittedLock{ submittedMutex };
+	submittedCondition.wait(submittedLock, [this]() { return submitted.empty() && !writing; });
+}
+
+std::size_t FrameStream::next_frame() const {
+	std::unique_lock<std::mutex> submittedLock{ submittedMutex };
+	return nextFrame;
+}
+
+std::size_t FrameStream::peak_buffered_count() const {
+	std::unique_lock<std::mutex> submittedLock{ submittedMutex };
+	return peakBufferedCount;
+}
+
+void FrameStream::run_writes() {
+	while (true) {
+		std::pair<std::size_t, ImageData> submission{};
+
+		{
+			std::unique_lock<std::mutex> submittedLock{ submittedMutex };
+			submittedCondition.wait(submittedLock, [this]() { return stopping || !submitted.empty(); });
+
+			if (submitted.empty()) {
+				return;
+			}
+
+			submission = std::move(submitted.front());
+			submitted.pop_front();
+			writing = true;
+		}
+
+		this->reorder(submission.first, std::move(submission.second));
+
+		{
+			std::unique_lock<std::mutex> submittedLock{ submittedMutex };
+			writing = false;
+		}
+
+		submittedCondition.notify_all();
+	}
+}
+
+void FrameStream::reorder(const std::size_t frame, ImageData tiffData) {
+	if (frame < nextFrame) {
+		return;
+	}
+
+	reorderBuffer.insert_or_assign(frame, std::move(tiffData));
+
+	{
+		std::unique_lock<std::mutex> submittedLock{ submittedMutex };
+		peakBufferedCount = std::max(peakBufferedCount, reorderBuffer.size());
+	}
+
+	for (auto next = reorderBuffer.begin(); next != reorderBuffer.end() && next->first == nextFrame;
+	     next = reorderBuffer.erase(next)) {
+		this->write_frame(next->second);
+
+		{
+			std::unique_lock<std::mutex> submittedLock{ submittedMutex };
+			nextFrame++;
+		}
+
+		// Frames written make room for frames further ahead to be dispatched
+		if (writtenFile >= 0) {
+			const std::uint64_t written = 1;
+			[[maybe_unused]] const ssize_t length = ::write(writtenFile, &written, sizeof(written));
+		}
+	}
+}
+
+void FrameStream::write_frame(const ImageData& tiffData) {
+	if (!this->is_open()) {
+		return;
+	}
+
+	Magick::Image image{};
+
+	try {
+		image.read(Magick::Blob{ tiffData.data(), tiffData.size() });
+
+		if (columns == 0) {
+			columns = image.columns();
+			rows = image.rows();
+			pixels.resize(columns * rows * 3);
+
+			if (format == FrameStreamFormat::Y4M) {
+				const std::string header = "YUV4MPEG2 W" + std::to_string(columns) + " H" +
+				                           std::to_string(rows) + " F" + std::to_string(frameRate) +
+				                           ":1 Ip A1:1 C444\n";
+				planes.resize(pixels.size());
+				this->write_bytes(header.data(), header.size());
+			}
+		} else if (image.columns() != columns || image.rows() != rows) {
+			Magick::Geometry size{ columns, rows };
+			size.aspect(true);
+			image.resize(size);
+		}
+
+		image.write(0, 0, columns, rows, "RGB", Magick::CharPixel, pixels.data());
+	} catch (Magick::Exception& error) {
+		std::clog << "Unable to decode frame " << nextFrame << " for the frame stream: " << error.what()
+		          << "\n";
+		std::fill(pixels.begin(), pixels.end(), 0);
+	}
+
+	// Without a first frame, the stream's dimensions are still unknown
+	if (columns == 0) {
+		return;
+	}
+
+	if (format == FrameStreamFormat::RGB) {
+		this->write_bytes(pixels.data(), pixels.size());
+		return;
+	}
+
+	// BT.601 studio range, in 8 bit fixed point
+	const std::size_t pixelCount = columns * rows;
+	std::uint8_t* const yPlane = planes.data();
+	std::uint8_t* const uPlane = yPlane + pixelCount;
+	std::uint8_t* const vPlane = uPlane + pixelCount;
+
+	for (std::size_t i = 0; i < pixelCount; i++) {
+		const int r = pixels[i * 3];
+		const int g = pixels[i * 3 + 1];
+		const int b = pixels[i * 3 + 2];
+
+		yPlane[i] = static_cast<std::uint8_t>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+		uPlane[i] = static_cast<std::uint8_t>(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+		vPlane[i] = static_cast<std::uint8_t>(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+	}
+
+	static const char frameHeader[] = "FRAME\n";
+	this->write_bytes(frameHeader, sizeof(frameHeader) - 1);
+	this->write_bytes(planes.data(), planes.size());
+}
+
+void FrameStream::write_bytes(const void* data, std::size_t size) {
+	const auto* bytes = static_cast<const char*>(data);
+
+	while (size != 0 && this->is_open()) {
+		const ssize_t written = ::write(file, bytes, size);
+
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			std::clog << "Unable to write frame stream '" << path << "': " << std::strerror(errno)
+			          << "\n";
+			this->close();
+			return;
+		}
+
+		bytes += written;
+		size -= static_cast<std::size_t>(written);
+	}
+}
+
+void FrameStream::close() {
+	if (ownsFile && file >= 0) {
+		::close(file);
+	}
+
+	file = -1;
+}
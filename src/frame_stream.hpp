@@ -0,0 +1,102 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "image_data.hpp"
+
+// Encoding of the frames written to a frame stream
+enum class FrameStreamFormat {
+	// YUV4MPEG2 with full resolution (4:4:4) chroma, read directly by most encoders
+	Y4M,
+	// Headerless interleaved 8 bit RGB, whose dimensions the reader must be told
+	RGB,
+};
+
+/**
+ * @brief Writes equalised images to a single stream, in frame order, as they arrive in any order.
+ *
+ * Images arriving ahead of the next frame to write are held in a reorder buffer until every frame
+ * before them has been written. The buffer is only bounded by how far ahead of the stream frames
+ * are dispatched, see `next_frame`. Every frame is written at the dimensions of the first, as a
+ * stream cannot change size.
+ *
+ * Frames are decoded and written on a thread of their own, as writes block for as long as the
+ * stream's reader is behind, which is usual when an encoder reads the stream.
+ */
+class FrameStream {
+public:
+	// Writes to standard output when `path` is "-". A path that does not exist is created as a named
+	// pipe, and opening any pipe blocks until it has a reader.
+	FrameStream(const std::string& path, FrameStreamFormat format, std::size_t frameRate);
+	FrameStream(const FrameStream& other) = delete;
+	FrameStream& operator=(const FrameStream& other) = delete;
+	// Writes every frame already submitted that can be
+	~FrameStream();
+
+	// Whether the stream opened. A stream that failed to open, or whose reader went away, discards
+	// its frames.
+	[[nodiscard]] bool is_open() const;
+
+	// Accepts the equalised TIFF of `frame`, writing it and the buffered frames following it once
+	// every frame before it is written
+	void submit(std::size_t frame, ImageData tiffData);
+
+	// Readable whenever frames have been written, for polling alongside sockets
+	[[nodiscard]] int descriptor() const;
+	// Whether frames have been written since last called, without blocking
+	[[nodiscard]] bool take_written();
+
+	// Waits for every submitted frame to be written or buffered
+	void drain();
+
+	// The next frame to be written, before which every frame has been written
+	[[nodiscard]] std::size_t next_frame() const;
+	[[nodiscard]] std::size_t peak_buffered_count() const;
+
+protected:
+	void open_path();
+	void run_writes();
+	// Buffers a frame, writing it and the frames following it once every frame before it is written
+	void reorder(std::size_t frame, ImageData tiffData);
+	void write_frame(const ImageData& tiffData);
+	void write_bytes(const void* data, std::size_t size);
+	void close();
+
+	const std::string path;
+	const FrameStreamFormat format;
+	const std::size_t frameRate;
+	int file;
+	bool ownsFile;
+	int writtenFile;
+
+	// Frames submitted but not yet taken by the write thread
+	mutable std::mutex submittedMutex;
+	std::condition_variable submittedCondition;
+	std::deque<std::pair<std::size_t, ImageData>> submitted;
+	bool writing;
+	bool stopping;
+
+	// Only changed by the write thread, and then under `submittedMutex`
+	std::size_t nextFrame;
+	std::size_t peakBufferedCount;
+
+	// Owned by the write thread
+	std::map<std::size_t, ImageData> reorderBuffer;
+
+	// Dimensions of the stream, from its first frame
+	std::size_t columns;
+	std::size_t rows;
+	std::vector<std::uint8_t> pixels;
+	std::vector<std::uint8_t> planes;
+
+	std::thread writeThread;
+};
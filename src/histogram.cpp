@@ -0,0 +1,257 @@
+#include "histogram.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+#include "simd.hpp"
+
+// Number of private sub-histograms that consecutive pixels are spread across. Neighbouring pixels
+// usually share a bucket, so incrementing a single histogram serialises on store-to-load forwarding
+// of the same counter.
+const constexpr std::size_t SUB_HISTOGRAM_COUNT = 4;
+
+using SubHistograms = std::array<HistogramCounts, SUB_HISTOGRAM_COUNT>;
+
+constexpr bool QUANTUM_LOOKUP_TABLE_SUPPORTED =
+    std::is_integral_v<Magick::Quantum> && sizeof(Magick::Quantum) <= sizeof(std::uint16_t);
+constexpr bool QUANTUM_SIMD_SUPPORTED =
+    SIMD_X86_KERNELS && std::is_same_v<Magick::Quantum, float>;
+
+// Reference bucketing for a single quantum. Must exactly match the historical per-pixel
+// computation, as every other kernel is validated against it.
+static inline std::uint32_t quantum_bucket(const Magick::Quantum quantum) {
+	const float pixel = quantum / QuantumRange;
+	const float bucket = std::round(std::clamp(pixel * (HISTOGRAM_SEGMENTS - 1), 0.F,
+	                                           static_cast<float>(HISTOGRAM_SEGMENTS - 1)));
+	return static_cast<std::uint32_t>(bucket);
+}
+
+static void merge_sub_histograms(const SubHistograms& subHistograms, HistogramCounts& counts) {
+	for (const auto& subHistogram : subHistograms) {
+		for (std::size_t i = 0; i < HISTOGRAM_SEGMENTS; i++) {
+			counts[i] += subHistogram[i];
+		}
+	}
+}
+
+static void accumulate_scalar(const Magick::Quantum* pixels, const std::size_t count,
+                              HistogramCounts& counts) {
+	for (std::size_t i = 0; i < count; i++) {
+		counts[quantum_bucket(pixels[i])]++;
+	}
+}
+
+static void accumulate_lookup_table(const Magick::Quantum* pixels, const std::size_t count,
+                                    HistogramCounts& counts) {
+	if constexpr (QUANTUM_LOOKUP_TABLE_SUPPORTED) {
+		static const std::vector<std::uint16_t> bucketTable = []() {
+			std::vector<std::uint16_t> table(static_cast<std::size_t>(QuantumRange) + 1);
+
+			for (std::size_t quantum = 0; quantum < table.size(); quantum++) {
+				table[quantum] = quantum_bucket(static_cast<Magick::Quantum>(quantum));
+			}
+
+			return table;
+		}();
+
+		SubHistograms subHistograms{};
+		std::size_t i = 0;
+
+		for (; i + SUB_HISTOGRAM_COUNT <= count; i += SUB_HISTOGRAM_COUNT) {
+			subHistograms[0][bucketTable[pixels[i + 0]]]++;
+			subHistograms[1][bucketTable[pixels[i + 1]]]++;
+			subHistograms[2][bucketTable[pixels[i + 2]]]++;
+			subHistograms[3][bucketTable[pixels[i + 3]]]++;
+		}
+
+		for (; i < count; i++) {
+			subHistograms[0][bucketTable[pixels[i]]]++;
+		}
+
+		merge_sub_histograms(subHistograms, counts);
+	} else {
+		accumulate_scalar(pixels, count, counts);
+	}
+}
+
+#if SIMD_X86_KERNELS
+
+SIMD_KERNELS_BEGIN
+
+// Increments the sub-histograms from a block of computed bucket indices
+template <std::size_t Lanes>
+static inline void increment_buckets(const std::int32_t (&buckets)[Lanes],
+                                     SubHistograms& subHistograms) {
+	for (std::size_t lane = 0; lane < Lanes; lane++) {
+		subHistograms[lane % SUB_HISTOGRAM_COUNT][buckets[lane]]++;
+	}
+}
+
+// Each SIMD kernel reproduces `quantum_bucket` exactly: the quantum is divided by QuantumRange in
+// double precision, narrowed to float, scaled, clamped and rounded half away from zero (which, for
+// non-negative values, is truncation plus one when the truncated fraction is at least one half).
+
+__attribute__((target("avx2"))) static void
+accumulate_avx2(const float* pixels, const std::size_t count, HistogramCounts& counts) {
+	const __m256d quantumRange = _mm256_set1_pd(QuantumRange);
+	const __m256 scale = _mm256_set1_ps(HISTOGRAM_SEGMENTS - 1);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 half = _mm256_set1_ps(0.5F);
+	const __m256 one = _mm256_set1_ps(1.F);
+
+	SubHistograms subHistograms{};
+	alignas(32) std::int32_t buckets[8];
+	std::size_t i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		const __m256 quantums = _mm256_loadu_ps(pixels + i);
+		const __m128 low = _mm256_cvtpd_ps(
+		    _mm256_div_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(quantums)), quantumRange));
+		const __m128 high = _mm256_cvtpd_ps(
+		    _mm256_div_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(quantums, 1)), quantumRange));
+		const __m256 scaled =
+		    _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_set_m128(high, low), scale), zero), scale);
+		const __m256 truncated = _mm256_round_ps(scaled, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+		const __m256 roundUp =
+		    _mm256_and_ps(_mm256_cmp_ps(_mm256_sub_ps(scaled, truncated), half, _CMP_GE_OQ), one);
+
+		_mm256_store_si256(reinterpret_cast<__m256i*>(buckets),
+		                   _mm256_cvttps_epi32(_mm256_add_ps(truncated, roundUp)));
+		increment_buckets(buckets, subHistograms);
+	}
+
+	for (; i < count; i++) {
+		subHistograms[0][quantum_bucket(pixels[i])]++;
+	}
+
+	merge_sub_histograms(subHistograms, counts);
+}
+
+__attribute__((target("avx512f"))) static void
+accumulate_avx512(const float* pixels, const std::size_t count, HistogramCounts& counts) {
+	const __m512d quantumRange = _mm512_set1_pd(QuantumRange);
+	const __m512 scale = _mm512_set1_ps(HISTOGRAM_SEGMENTS - 1);
+	const __m512 zero = _mm512_setzero_ps();
+	const __m512 half = _mm512_set1_ps(0.5F);
+	const __m512 one = _mm512_set1_ps(1.F);
+
+	SubHistograms subHistograms{};
+	alignas(64) std::int32_t buckets[16];
+	std::size_t i = 0;
+
+	for (; i + 16 <= count; i += 16) {
+		const __m512 quantums = _mm512_loadu_ps(pixels + i);
+		const __m256 low = _mm512_cvtpd_ps(_mm512_div_pd(
+		    _mm512_cvtps_pd(_mm512_castps512_ps256(quantums)), quantumRange));
+		const __m256 high = _mm512_cvtpd_ps(_mm512_div_pd(
+		    _mm512_cvtps_pd(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(quantums), 1))),
+		    quantumRange));
+		const __m512 normalised = _mm512_castpd_ps(_mm512_insertf64x4(
+		    _mm512_castps_pd(_mm512_castps256_ps512(low)), _mm256_castps_pd(high), 1));
+		const __m512 scaled =
+		    _mm512_min_ps(_mm512_max_ps(_mm512_mul_ps(normalised, scale), zero), scale);
+		const __m512 truncated =
+		    _mm512_roundscale_ps(scaled, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+		const __mmask16 roundUp =
+		    _mm512_cmp_ps_mask(_mm512_sub_ps(scaled, truncated), half, _CMP_GE_OQ);
+
+		_mm512_store_si512(buckets,
+		                   _mm512_cvttps_epi32(_mm512_mask_add_ps(truncated, roundUp, truncated, one)));
+		increment_buckets(buckets, subHistograms);
+	}
+
+	for (; i < count; i++) {
+		subHistograms[0][quantum_bucket(pixels[i])]++;
+	}
+
+	merge_sub_histograms(subHistograms, counts);
+}
+
+SIMD_KERNELS_END
+
+#endif
+
+bool histogram_kernel_supported(const HistogramKernel kernel) {
+	switch (kernel) {
+		case HistogramKernel::Scalar:
+			return true;
+		case HistogramKernel::LookupTable:
+			return QUANTUM_LOOKUP_TABLE_SUPPORTED;
+		case HistogramKernel::AVX2:
+			return QUANTUM_SIMD_SUPPORTED && cpu_supports_avx2();
+		case HistogramKernel::AVX512:
+			return QUANTUM_SIMD_SUPPORTED && cpu_supports_avx512();
+	}
+
+	return false;
+}
+
+const char* histogram_kernel_name(const HistogramKernel kernel) {
+	switch (kernel) {
+		case HistogramKernel::Scalar:
+			return "scalar";
+		case HistogramKernel::LookupTable:
+			return "lookup table";
+		case HistogramKernel::AVX2:
+			return "AVX2";
+		case HistogramKernel::AVX512:
+			return "AVX-512";
+	}
+
+	return "unknown";
+}
+
+HistogramKernel preferred_histogram_kernel() {
+	static const HistogramKernel preferredKernel = []() {
+		// The kernels are bound by double precision division throughput, which AVX-512 does not
+		// improve on current cores, so AVX2 is preferred to avoid the AVX-512 frequency penalty.
+		for (const auto kernel : { HistogramKernel::LookupTable, HistogramKernel::AVX2,
+		                           HistogramKernel::AVX512 }) {
+			if (histogram_kernel_supported(kernel)) {
+				return kernel;
+			}
+		}
+
+		return HistogramKernel::Scalar;
+	}();
+
+	return preferredKernel;
+}
+
+void accumulate_quantum_histogram(const Magick::Quantum* pixels, const std::size_t count,
+                                  HistogramCounts& counts) {
+	accumulate_quantum_histogram(preferred_histogram_kernel(), pixels, count, counts);
+}
+
+void accumulate_quantum_histogram(const HistogramKernel kernel, const Magick::Quantum* pixels,
+                                  const std::size_t count, HistogramCounts& counts) {
+	if (!histogram_kernel_supported(kernel)) {
+		accumulate_scalar(pixels, count, counts);
+		return;
+	}
+
+	switch (kernel) {
+		case HistogramKernel::Scalar:
+			accumulate_scalar(pixels, count, counts);
+			break;
+		case HistogramKernel::LookupTable:
+			accumulate_lookup_table(pixels, count, counts);
+			break;
+#if SIMD_X86_KERNELS
+		case HistogramKernel::AVX2:
+			accumulate_avx2(reinterpret_cast<const float*>(pixels), count, counts);
+			break;
+		case HistogramKernel::AVX512:
+			accumulate_avx512(reinterpret_cast<const float*>(pixels), count, counts);
+			break;
+#else
+		default:
+			accumulate_scalar(pixels, count, counts);
+			break;
+#endif
+	}
+}
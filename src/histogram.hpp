@@ -0,0 +1,37 @@
+#pragma once
+
+#include <Magick++.h>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "config.hpp"
+
+using HistogramCounts = std::array<std::uint64_t, HISTOGRAM_SEGMENTS>;
+
+// Kernels used to bucket lightness values into a histogram.
+//
+// All kernels produce bit-identical bucket counts to the original per-pixel
+// `std::round(pixel / QuantumRange * (HISTOGRAM_SEGMENTS - 1))` loop. Integer
+// quantum builds (Q8/Q16) use a quantum-indexed bucket lookup table, whilst HDRI
+// builds use the widest SIMD kernel supported by the running CPU.
+
+enum class HistogramKernel {
+	Scalar,
+	LookupTable,
+	AVX2,
+	AVX512,
+};
+
+const char* histogram_kernel_name(HistogramKernel kernel);
+bool histogram_kernel_supported(HistogramKernel kernel);
+
+// The kernel selected for this build and CPU.
+HistogramKernel preferred_histogram_kernel();
+
+// Adds each of the `count` contiguous quantums starting at `pixels` to `counts`. Unsupported
+// kernels fall back to the scalar implementation.
+void accumulate_quantum_histogram(const Magick::Quantum* pixels, std::size_t count,
+                                  HistogramCounts& counts);
+void accumulate_quantum_histogram(HistogramKernel kernel, const Magick::Quantum* pixels,
+                                  std::size_t count, HistogramCounts& counts);
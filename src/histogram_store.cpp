@@ -0,0 +1,60 @@
+#include "histogram_store.hpp"
+
+#include <utility>
+
+static const constexpr char STORE_MAGIC[8] = { 'E', 'X', 'P', 'H', 'I', 'S', 'T', '\0' };
+
+// Incremented whenever the layout of a record changes, so stores of older layouts are replaced
+static const constexpr std::uint32_t STORE_VERSION = 1;
+
+static std::uint64_t path_hash(const std::string& filename) {
+	return hash_bytes(filename.data(), filename.size());
+}
+
+HistogramStore::HistogramStore(std::filesystem::path storePath)
+    : recordFile{ std::move(storePath), "histogram store", STORE_MAGIC, STORE_VERSION,
+	                sizeof(Record) },
+      recordIndex{} {
+	for (std::size_t i = 0; i < recordFile.record_count(); i++) {
+		const auto* record = static_cast<const Record*>(recordFile.record(i));
+		recordIndex.insert_or_assign(record->path_hash, i);
+	}
+}
+
+bool HistogramStore::is_open() const {
+	return recordFile.is_open();
+}
+
+std::optional<StoredHistogram> HistogramStore::find(const std::string& filename,
+                                                    const FileIdentity& identity,
+                                                    const std::uint64_t sampleBudget,
+                                                    const std::uint32_t decodeSize) const {
+	const auto recordIter = recordIndex.find(path_hash(filename));
+
+	if (recordIter == recordIndex.end()) {
+		return std::nullopt;
+	}
+
+	const auto* record = static_cast<const Record*>(recordFile.record(recordIter->second));
+
+	if (record->identity != identity || record->sample_budget != sampleBudget ||
+	    record->decode_size != decodeSize) {
+		return std::nullopt;
+	}
+
+	return StoredHistogram{ record->histogram, record->cdf_error_bound };
+}
+
+void HistogramStore::insert(const std::string& filename, const FileIdentity& identity,
+                            const std::uint64_t sampleBudget, const std::uint32_t decodeSize,
+                            const StoredHistogram& histogram) {
+	Record record{};
+	record.path_hash = path_hash(filename);
+	record.identity = identity;
+	record.sample_budget = sampleBudget;
+	record.decode_size = decodeSize;
+	record.cdf_error_bound = histogram.cdf_error_bound;
+	record.histogram = histogram.histogram;
+
+	recordFile.append(&record);
+}
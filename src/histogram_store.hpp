@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+
+#include "algorithm.hpp"
+#include "file_identity.hpp"
+#include "record_file.hpp"
+
+// A histogram kept from an earlier run
+struct StoredHistogram {
+	Histogram histogram;
+	double cdf_error_bound;
+};
+
+/**
+ * @brief Histograms computed by earlier runs, kept in a flat file alongside the frames.
+ *
+ * Each histogram computed is appended to a `RecordFile` as a fixed-size record, keyed by a hash of
+ * the frame's path, the frame's identity (see `FileIdentity`) and the settings the histogram was
+ * computed with, so a record is only used while none of these have changed. The newest record for
+ * a path wins. Histograms inserted are found by the stores opened afterwards.
+ */
+class HistogramStore {
+public:
+	explicit HistogramStore(std::filesystem::path storePath);
+
+	[[nodiscard]] bool is_open() const;
+
+	[[nodiscard]] std::optional<StoredHistogram> find(const std::string& filename,
+	                                                  const FileIdentity& identity,
+	                                                  std::uint64_t sampleBudget,
+	                                                  std::uint32_t decodeSize) const;
+
+	void insert(const std::string& filename, const FileIdentity& identity,
+	            std::uint64_t sampleBudget, std::uint32_t decodeSize,
+	            const StoredHistogram& histogram);
+
+protected:
+	struct Record {
+		std::uint64_t path_hash;
+		FileIdentity identity;
+		std::uint64_t sample_budget;
+		std::uint32_t decode_size;
+		std::uint32_t reserved;
+		double cdf_error_bound;
+		Histogram histogram;
+	};
+
+	static_assert(std::is_trivially_copyable_v<Record>);
+
+	RecordFile recordFile;
+
+	// Path hash to the newest of its records
+	std::unordered_map<std::uint64_t, std::size_t> recordIndex;
+};
@@ -0,0 +1,70 @@
+#include "image_cache.hpp"
+
+#include <iterator>
+#include <system_error>
+#include <utility>
+
+// Approximate memory held by the pixel cache of `image`
+static std::size_t image_bytes(const Magick::Image& image) {
+	return image.columns() * image.rows() * image.channels() * sizeof(Magick::Quantum);
+}
+
+DecodedImageCache::DecodedImageCache(const std::size_t byteBudget)
+    : byteBudget{ byteBudget }, cachedBytes{ 0 }, images{}, imageIndex{}, imagesMutex{} {}
+
+void DecodedImageCache::insert(const std::string& filename, const Magick::Image& image) {
+	const std::size_t bytes = image_bytes(image);
+
+	if (bytes > byteBudget) {
+		return;
+	}
+
+	std::error_code error{};
+	const auto modified = std::filesystem::last_write_time(filename, error);
+
+	if (error) {
+		return;
+	}
+
+	std::unique_lock<std::mutex> imagesLock{ this->imagesMutex };
+
+	if (const auto existing = imageIndex.find(filename); existing != imageIndex.end()) {
+		this->erase(existing->second);
+	}
+
+	while (cachedBytes + bytes > byteBudget) {
+		this->erase(std::prev(images.end()));
+	}
+
+	images.push_front(CachedImage{ filename, modified, image, bytes });
+	imageIndex.emplace(filename, images.begin());
+	cachedBytes += bytes;
+}
+
+std::optional<Magick::Image> DecodedImageCache::take(const std::string& filename) {
+	std::unique_lock<std::mutex> imagesLock{ this->imagesMutex };
+	const auto cachedImage = imageIndex.find(filename);
+
+	if (cachedImage == imageIndex.end()) {
+		return std::nullopt;
+	}
+
+	Magick::Image image = cachedImage->second->image;
+	const auto modified = cachedImage->second->modified;
+	this->erase(cachedImage->second);
+	imagesLock.unlock();
+
+	std::error_code error{};
+
+	if (std::filesystem::last_write_time(filename, error) != modified || error) {
+		return std::nullopt;
+	}
+
+	return image;
+}
+
+void DecodedImageCache::erase(const std::list<CachedImage>::iterator cachedImage) {
+	cachedBytes -= cachedImage->bytes;
+	imageIndex.erase(cachedImage->filename);
+	images.erase(cachedImage);
+}
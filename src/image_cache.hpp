@@ -0,0 +1,52 @@
+#pragma once
+
+#include <Magick++.h>
+#include <cstddef>
+#include <filesystem>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include "config.hpp"
+
+/**
+ * @brief Decoded images kept on a worker between the histogram and equalisation phases.
+ *
+ * The histogram job for a frame decodes it in full, and the server sends that frame's equalisation
+ * job back to the same worker where it can, so keeping the decoded image saves reading and decoding
+ * it a second time. Images are evicted least recently inserted first once the cache would exceed
+ * its byte budget, and are dropped if their file has been modified since they were decoded.
+ */
+class DecodedImageCache {
+public:
+	explicit DecodedImageCache(std::size_t byteBudget = DECODED_IMAGE_CACHE_BYTES);
+	DecodedImageCache(const DecodedImageCache& other) = delete;
+	DecodedImageCache& operator=(const DecodedImageCache& other) = delete;
+
+	// Keeps `image`, decoded from `filename`, evicting older images to stay within budget. Images
+	// larger than the whole budget are not kept.
+	void insert(const std::string& filename, const Magick::Image& image);
+
+	// Removes and returns the image decoded from `filename`, if it is still held and up to date
+	std::optional<Magick::Image> take(const std::string& filename);
+
+protected:
+	struct CachedImage {
+		std::string filename;
+		std::filesystem::file_time_type modified;
+		Magick::Image image;
+		std::size_t bytes;
+	};
+
+	void erase(std::list<CachedImage>::iterator cachedImage);
+
+	const std::size_t byteBudget;
+	std::size_t cachedBytes;
+
+	// Most recently inserted first
+	std::list<CachedImage> images;
+	std::unordered_map<std::string, std::list<CachedImage>::iterator> imageIndex;
+	std::mutex imagesMutex;
+};
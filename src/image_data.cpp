@@ -0,0 +1,50 @@
+#include "image_data.hpp"
+
+#include <cassert>
+#include <utility>
+
+ImageData::ImageData(std::vector<std::uint8_t> bytes) {
+	auto ownedBytes = std::make_shared<const std::vector<std::uint8_t>>(std::move(bytes));
+
+	this->bytes = ownedBytes->data();
+	this->length = ownedBytes->size();
+	this->owner = std::move(ownedBytes);
+}
+
+ImageData::ImageData(std::shared_ptr<const void> owner, const std::uint8_t* data,
+                     const std::size_t size)
+    : owner{ std::move(owner) }, bytes{ data }, length{ size } {}
+
+const std::uint8_t* ImageData::data() const {
+	return bytes;
+}
+
+std::size_t ImageData::size() const {
+	return length;
+}
+
+bool ImageData::empty() const {
+	return length == 0;
+}
+
+const std::uint8_t* ImageData::begin() const {
+	return bytes;
+}
+
+const std::uint8_t* ImageData::end() const {
+	return bytes + length;
+}
+
+ImageData ImageData::slice(const std::size_t offset, const std::size_t size) const {
+	assert(offset + size <= length);
+
+	return ImageData{ owner, bytes + offset, size };
+}
+
+void* ImageData::retain() const {
+	return new std::shared_ptr<const void>{ owner };
+}
+
+void ImageData::release(void* /* data */, void* hint) {
+	delete static_cast<std::shared_ptr<const void>*>(hint);
+}
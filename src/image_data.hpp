@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/**
+ * @brief The bytes of an encoded image, shared rather than copied on their way to disk.
+ *
+ * The bytes are kept alive by an owner of any type: the buffer the image was encoded into, or the
+ * network message it was received in. Copies share the same bytes, which are never modified.
+ */
+class ImageData {
+public:
+	ImageData() = default;
+	ImageData(std::vector<std::uint8_t> bytes);
+	// `data` must stay valid for as long as `owner` is held
+	ImageData(std::shared_ptr<const void> owner, const std::uint8_t* data, std::size_t size);
+
+	[[nodiscard]] const std::uint8_t* data() const;
+	[[nodiscard]] std::size_t size() const;
+	[[nodiscard]] bool empty() const;
+
+	[[nodiscard]] const std::uint8_t* begin() const;
+	[[nodiscard]] const std::uint8_t* end() const;
+
+	// `size` bytes from `offset`, sharing these bytes rather than copying them
+	[[nodiscard]] ImageData slice(std::size_t offset, std::size_t size) const;
+
+	// Keeps the bytes alive until `release` is called with the returned hint, for handing them to C
+	// interfaces which free through a callback, such as `zmq_msg_init_data`
+	[[nodiscard]] void* retain() const;
+	static void release(void* data, void* hint);
+
+protected:
+	std::shared_ptr<const void> owner;
+	const std::uint8_t* bytes = nullptr;
+	std::size_t length = 0;
+};
@@ -1,13 +1,16 @@
+#include <algorithm>
 #include <cstring>
 #include <filesystem>
 #include <future>
 #include <iostream>
+#include <sstream>
 #include <string>
 #include <utility>
 #include <zmqpp/context.hpp>
 #include <zmqpp/context_options.hpp>
 
 #include "Magick++/Functions.h"
+#include "diagnostics.hpp"
 #include "network.hpp"
 #include "server.hpp"
 #include "worker.hpp"
@@ -20,6 +23,22 @@ int main(int argc, char* argv[]) {
 		return -1;
 	}
 
+	if (strcmp(argv[1], "--benchmark") == 0) {
+		const std::size_t pixelCount =
+		    (argc > 2) ? std::stoull(argv[2]) : static_cast<std::size_t>(BENCHMARK_PIXEL_COUNT);
+		Magick::InitializeMagick(*argv);
+		return run_benchmarks(pixelCount);
+	}
+
+	if (strcmp(argv[1], "--validate-sampling") == 0 && argc > 2) {
+		const std::uint64_t sampleBudget =
+		    (argc > 3) ? std::stoull(argv[3]) : VALIDATION_SAMPLE_BUDGET;
+		const std::size_t decodeSize = (argc > 4) ? std::stoull(argv[4]) : HISTOGRAM_DECODE_SIZE;
+		Magick::InitializeMagick(*argv);
+		return validate_histogram_sampling(std::filesystem::path{ argv[2] }, sampleBudget,
+		                                   decodeSize);
+	}
+
 	zmqpp::context context{};
 
 	// Enable IPv6 port communications
@@ -37,12 +56,108 @@ int main(int argc, char* argv[]) {
 		return 0;
 	}
 
+	ServerOptions options{};
+	int pathArgument = 1;
+
+	for (; pathArgument < argc - 1 && strncmp(argv[pathArgument], "--", 2) == 0; pathArgument++) {
+		if (strcmp(argv[pathArgument], "--sample-budget") == 0) {
+			options.histogram_sample_budget = std::stoull(argv[++pathArgument]);
+		} else if (strcmp(argv[pathArgument], "--decode-size") == 0) {
+			options.histogram_decode_size = std::stoul(argv[++pathArgument]);
+		} else if (strcmp(argv[pathArgument], "--fused") == 0) {
+			options.fused_jobs = true;
+		} else if (strcmp(argv[pathArgument], "--no-histogram-store") == 0) {
+			options.store_histograms = false;
+		} else if (strcmp(argv[pathArgument], "--no-output-reuse") == 0) {
+			options.reuse_outputs = false;
+		} else if (strcmp(argv[pathArgument], "--quantise-histograms") == 0) {
+			options.quantise_histograms = true;
+		} else if (strcmp(argv[pathArgument], "--histogram-window") == 0) {
+			options.histogram_window = std::stoull(argv[++pathArgument]);
+		} else if (strcmp(argv[pathArgument], "--smoothing-window") == 0) {
+			options.smoothing_window = std::max<std::size_t>(std::stoull(argv[++pathArgument]), 1);
+		} else if (strcmp(argv[pathArgument], "--watch") == 0) {
+			options.watch_directory = true;
+		} else if (strcmp(argv[pathArgument], "--recursive") == 0) {
+			options.recursive = true;
+		} else if (strcmp(argv[pathArgument], "--extensions") == 0) {
+			std::stringstream extensions{ argv[++pathArgument] };
+
+			for (std::string extension{}; std::getline(extensions, extension, ',');) {
+				if (!extension.empty()) {
+					options.frame_filter.extensions.push_back(extension);
+				}
+			}
+		} else if (strcmp(argv[pathArgument], "--include") == 0) {
+			options.frame_filter.patterns.emplace_back(argv[++pathArgument]);
+		} else if (strcmp(argv[pathArgument], "--output-codec") == 0) {
+			const std::optional<OutputCodec> codec = parse_output_codec(argv[++pathArgument]);
+
+			if (!codec) {
+				std::cerr << "Unknown output codec: " << argv[pathArgument] << " (expected one of";
+
+				for (const OutputCodec knownCodec : OUTPUT_CODECS) {
+					std::cerr << " " << output_codec_name(knownCodec);
+				}
+
+				std::cerr << ")\n";
+				return -1;
+			}
+
+			options.output_encoding.codec = *codec;
+		} else if (strcmp(argv[pathArgument], "--output-quality") == 0) {
+			options.output_encoding.quality =
+			    static_cast<std::uint8_t>(std::clamp(std::stoi(argv[++pathArgument]), 1, 100));
+		} else if (strcmp(argv[pathArgument], "--stream") == 0) {
+			options.stream_path = argv[++pathArgument];
+		} else if (strcmp(argv[pathArgument], "--stream-format") == 0) {
+			const std::string format = argv[++pathArgument];
+
+			if (format == "y4m") {
+				options.stream_format = FrameStreamFormat::Y4M;
+			} else if (format == "rgb") {
+				options.stream_format = FrameStreamFormat::RGB;
+			} else {
+				std::cerr << "Unknown stream format: " << format << " (expected y4m or rgb)\n";
+				return -1;
+			}
+		} else if (strcmp(argv[pathArgument], "--stream-buffer") == 0) {
+			options.stream_reorder_frames = std::max<std::size_t>(std::stoull(argv[++pathArgument]), 1);
+		} else if (strcmp(argv[pathArgument], "--write-budget") == 0) {
+			options.output_write_budget =
+			    std::max<std::uint64_t>(std::stoull(argv[++pathArgument]), 1) * 1024ULL * 1024ULL;
+		} else {
+			std::cerr << "Unknown option: " << argv[pathArgument] << "\n";
+			return -1;
+		}
+	}
+
+	if (pathArgument >= argc) {
+		std::cerr << "Usage: " << argv[0] << " [options] <image/to/process> ...\n";
+		return -1;
+	}
+
+	if (options.watch_directory && options.fused_jobs) {
+		std::cerr << "--watch cannot be combined with --fused\n";
+		return -1;
+	}
+
+	if (!options.stream_path.empty()) {
+		if (options.fused_jobs) {
+			std::cerr << "--stream cannot be combined with --fused\n";
+			return -1;
+		}
+
+		// Streamed frames are decoded on the server
+		Magick::InitializeMagick(*argv);
+	}
+
 	std::clog << "Starting server\n";
-	Server server{ context };
+	Server server{ context, options };
 
 	auto mdnsService = start_mdns_service();
 
-	server.serve_work(std::filesystem::path{ argv[1] });
+	server.serve_work(std::filesystem::path{ argv[pathArgument] });
 
 	stop_mdns_service(std::move(mdnsService));
 
@@ -0,0 +1,104 @@
+#include "output_encoding.hpp"
+
+#include <algorithm>
+#include <memory>
+#include <utility>
+
+bool OutputEncoding::operator==(const OutputEncoding& other) const {
+	return codec == other.codec && quality == other.quality;
+}
+
+bool OutputEncoding::operator!=(const OutputEncoding& other) const {
+	return !(*this == other);
+}
+
+std::string output_codec_name(const OutputCodec codec) {
+	switch (codec) {
+		case OutputCodec::Tiff:
+			return "tiff";
+		case OutputCodec::TiffDeflate:
+			return "tiff-deflate";
+		case OutputCodec::TiffLzw:
+			return "tiff-lzw";
+		case OutputCodec::TiffZstd:
+			return "tiff-zstd";
+		case OutputCodec::Png:
+			return "png";
+		case OutputCodec::Jpeg:
+			return "jpeg";
+		case OutputCodec::JpegXl:
+			return "jxl";
+	}
+
+	return "unknown";
+}
+
+std::optional<OutputCodec> parse_output_codec(const std::string& name) {
+	const auto codec = std::find_if(OUTPUT_CODECS.begin(), OUTPUT_CODECS.end(),
+	                                [&name](const OutputCodec codec) {
+		                                return output_codec_name(codec) == name;
+	                                });
+
+	if (codec == OUTPUT_CODECS.end()) {
+		return std::nullopt;
+	}
+
+	return *codec;
+}
+
+std::string output_extension(const OutputCodec codec) {
+	switch (codec) {
+		case OutputCodec::Tiff:
+		case OutputCodec::TiffDeflate:
+		case OutputCodec::TiffLzw:
+		case OutputCodec::TiffZstd:
+			return ".tiff";
+		case OutputCodec::Png:
+			return ".png";
+		case OutputCodec::Jpeg:
+			return ".jpg";
+		case OutputCodec::JpegXl:
+			return ".jxl";
+	}
+
+	return ".tiff";
+}
+
+ImageData encode_image(Magick::Image& image, const OutputEncoding& encoding) {
+	switch (encoding.codec) {
+		case OutputCodec::Tiff:
+			image.magick("TIFF");
+			break;
+		case OutputCodec::TiffDeflate:
+			image.magick("TIFF");
+			image.compressType(Magick::ZipCompression);
+			image.defineValue("tiff", "predictor", "2");
+			break;
+		case OutputCodec::TiffLzw:
+			image.magick("TIFF");
+			image.compressType(Magick::LZWCompression);
+			image.defineValue("tiff", "predictor", "2");
+			break;
+		case OutputCodec::TiffZstd:
+			image.magick("TIFF");
+			image.compressType(Magick::ZstdCompression);
+			image.defineValue("tiff", "predictor", "2");
+			break;
+		case OutputCodec::Png:
+			image.magick("PNG");
+			image.depth(std::min<std::size_t>(image.depth(), 16));
+			break;
+		case OutputCodec::Jpeg:
+		case OutputCodec::JpegXl:
+			image.magick((encoding.codec == OutputCodec::Jpeg) ? "JPEG" : "JXL");
+			image.quality(encoding.quality);
+			break;
+	}
+
+	auto blob = std::make_shared<Magick::Blob>();
+	image.write(blob.get());
+
+	const auto* const blobData = static_cast<const std::uint8_t*>(blob->data());
+	const std::size_t blobLength = blob->length();
+	return ImageData{ std::move(blob), blobData, blobLength };
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <Magick++.h>
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+#include "config.hpp"
+#include "image_data.hpp"
+
+// How equalised images are encoded by workers for their trip back to the server
+enum class OutputCodec : std::uint16_t {
+	// Uncompressed, which large images can be streamed into without being held whole
+	Tiff,
+	TiffDeflate,
+	TiffLzw,
+	TiffZstd,
+	// Lossless, at 16 bits per sample for deep images
+	Png,
+	Jpeg,
+	JpegXl,
+};
+
+const constexpr std::array<OutputCodec, 7> OUTPUT_CODECS{
+	OutputCodec::Tiff,   OutputCodec::TiffDeflate, OutputCodec::TiffLzw, OutputCodec::TiffZstd,
+	OutputCodec::Png,    OutputCodec::Jpeg,        OutputCodec::JpegXl,
+};
+
+// The codec and settings a run's images are encoded with, chosen by the server and sent with each
+// job
+struct OutputEncoding {
+	OutputCodec codec = OutputCodec::Tiff;
+	// Quality of lossy codecs, from 1 to 100
+	std::uint8_t quality = OUTPUT_QUALITY;
+
+	bool operator==(const OutputEncoding& other) const;
+	bool operator!=(const OutputEncoding& other) const;
+};
+
+// The name a codec is chosen by on the command line, such as "tiff-zstd"
+std::string output_codec_name(OutputCodec codec);
+std::optional<OutputCodec> parse_output_codec(const std::string& name);
+
+// Extension, including the dot, of images written with `codec`
+std::string output_extension(OutputCodec codec);
+
+// Encodes an equalised image. TIFFs are compressed with horizontal differencing, which suits
+// continuous tone images. The encoded image is shared with the blob it was written to, not copied.
+ImageData encode_image(Magick::Image& image, const OutputEncoding& encoding);
@@ -0,0 +1,73 @@
+#include "output_manifest.hpp"
+
+#include <optional>
+#include <utility>
+
+#include "config.hpp"
+
+static const constexpr char MANIFEST_MAGIC[8] = { 'E', 'X', 'P', 'O', 'U', 'T', 'S', '\0' };
+
+// Incremented whenever the layout of a record changes, so manifests of older layouts are replaced
+static const constexpr std::uint32_t MANIFEST_VERSION = 1;
+
+// Incremented whenever the images written for the same input and mapping change, so that images
+// written by older versions are written again
+static const constexpr std::uint32_t OUTPUT_FORMAT_VERSION = 1;
+
+static std::uint64_t path_hash(const std::string& filename) {
+	return hash_bytes(filename.data(), filename.size());
+}
+
+std::uint64_t output_key(const EqualisationHistogramMapping& mapping,
+                         const OutputEncoding& outputEncoding) {
+	const std::uint32_t formatVersion = OUTPUT_FORMAT_VERSION;
+	const bool nativeEqualisation = NATIVE_LAB_EQUALISATION;
+
+	std::uint64_t key = hash_bytes(&formatVersion, sizeof(formatVersion));
+	key = hash_bytes(&nativeEqualisation, sizeof(nativeEqualisation), key);
+	key = hash_bytes(&outputEncoding.codec, sizeof(outputEncoding.codec), key);
+	key = hash_bytes(&outputEncoding.quality, sizeof(outputEncoding.quality), key);
+
+	return hash_bytes(mapping.data(), sizeof(mapping), key);
+}
+
+OutputManifest::OutputManifest(std::filesystem::path manifestPath)
+    : recordFile{ std::move(manifestPath), "output manifest", MANIFEST_MAGIC, MANIFEST_VERSION,
+	                sizeof(Record) },
+      recordIndex{} {
+	for (std::size_t i = 0; i < recordFile.record_count(); i++) {
+		const auto* record = static_cast<const Record*>(recordFile.record(i));
+		recordIndex.insert_or_assign(record->path_hash, i);
+	}
+}
+
+bool OutputManifest::is_current(const std::string& filename, const FileIdentity& inputIdentity,
+                                const std::uint64_t outputKey,
+                                const std::filesystem::path& outputPath) const {
+	const auto recordIter = recordIndex.find(path_hash(filename));
+
+	if (recordIter == recordIndex.end()) {
+		return false;
+	}
+
+	const auto* record = static_cast<const Record*>(recordFile.record(recordIter->second));
+
+	if (record->input_identity != inputIdentity || record->output_key != outputKey) {
+		return false;
+	}
+
+	const std::optional<FileIdentity> outputIdentity = read_file_identity(outputPath);
+
+	return outputIdentity && *outputIdentity == record->output_identity;
+}
+
+void OutputManifest::insert(const std::string& filename, const FileIdentity& inputIdentity,
+                            const std::uint64_t outputKey, const FileIdentity& outputIdentity) {
+	Record record{};
+	record.path_hash = path_hash(filename);
+	record.input_identity = inputIdentity;
+	record.output_key = outputKey;
+	record.output_identity = outputIdentity;
+
+	recordFile.append(&record);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+
+#include "algorithm.hpp"
+#include "file_identity.hpp"
+#include "output_encoding.hpp"
+#include "record_file.hpp"
+
+// Hash of everything an equalised image depends on besides its input: the mapping it was equalised
+// through, and how it was written
+std::uint64_t output_key(const EqualisationHistogramMapping& mapping,
+                         const OutputEncoding& outputEncoding);
+
+/**
+ * @brief The equalised images written by earlier runs, kept in a flat file alongside the frames.
+ *
+ * Each image written is appended to a `RecordFile` as a fixed-size record, keyed by a hash of its
+ * frame's path, the frame's identity (see `FileIdentity`) and its `output_key`, alongside the
+ * identity of the image written. An image is current while none of these have changed, and it has
+ * not itself been modified or removed since. The newest record for a path wins.
+ */
+class OutputManifest {
+public:
+	explicit OutputManifest(std::filesystem::path manifestPath);
+
+	// Whether the image at `outputPath`, written by an earlier run for `filename`, is what this run
+	// would write
+	[[nodiscard]] bool is_current(const std::string& filename, const FileIdentity& inputIdentity,
+	                              std::uint64_t outputKey,
+	                              const std::filesystem::path& outputPath) const;
+
+	void insert(const std::string& filename, const FileIdentity& inputIdentity,
+	            std::uint64_t outputKey, const FileIdentity& outputIdentity);
+
+protected:
+	struct Record {
+		std::uint64_t path_hash;
+		FileIdentity input_identity;
+		std::uint64_t output_key;
+		FileIdentity output_identity;
+	};
+
+	static_assert(std::is_trivially_copyable_v<Record>);
+
+	RecordFile recordFile;
+
+	// Path hash to the newest of its records
+	std::unordered_map<std::uint64_t, std::size_t> recordIndex;
+};
@@ -0,0 +1,249 @@
+#include "output_writer.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <sys/eventfd.h>
+#include <system_error>
+#include <unistd.h>
+#include <utility>
+
+OutputWriter::OutputWriter(const std::size_t threadCount, const std::uint64_t byteBudget)
+    : byteBudget{ byteBudget }, writeThreads{}, completionFile{ -1 },
+      queuedWrites{ 0 }, queuedBytes{ 0 }, peakQueuedWrites{ 0 }, peakQueuedBytes{ 0 },
+      writtenParts{ 0 }, totalLatency{ 0 }, worstLatency{ 0 }, completed{}, writtenCount{ 0 },
+      failedCount{ 0 } {
+	completionFile = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	if (completionFile < 0) {
+		std::clog << "Unable to create output completion event: " << std::strerror(errno) << "\n";
+	}
+
+	for (std::size_t i = 0; i < std::max<std::size_t>(threadCount, 1); i++) {
+		writeThreads.push_back(std::make_unique<WriteThread>());
+	}
+
+	for (auto& writeThread : writeThreads) {
+		writeThread->thread = std::thread{ &OutputWriter::run_writes, this, std::ref(*writeThread) };
+	}
+}
+
+OutputWriter::~OutputWriter() {
+	for (auto& writeThread : writeThreads) {
+		{
+			std::unique_lock<std::mutex> writesLock{ writeThread->writesMutex };
+			writeThread->stopping = true;
+		}
+
+		writeThread->writesCondition.notify_all();
+	}
+
+	for (auto& writeThread : writeThreads) {
+		writeThread->thread.join();
+	}
+
+	if (completionFile >= 0) {
+		::close(completionFile);
+	}
+}
+
+void OutputWriter::begin(const std::string& filename, const std::filesystem::path& path) {
+	this->queue_write(QueuedWrite{ QueuedWrite::Kind::Begin, filename, path, {}, {} });
+}
+
+void OutputWriter::append(const std::string& filename, ImageData data) {
+	this->queue_write(QueuedWrite{ QueuedWrite::Kind::Append, filename, {}, std::move(data), {} });
+}
+
+void OutputWriter::finish(const std::string& filename) {
+	this->queue_write(QueuedWrite{ QueuedWrite::Kind::Finish, filename, {}, {}, {} });
+}
+
+void OutputWriter::discard(const std::string& filename) {
+	this->queue_write(QueuedWrite{ QueuedWrite::Kind::Discard, filename, {}, {}, {} });
+}
+
+int OutputWriter::descriptor() const {
+	return completionFile;
+}
+
+std::vector<CompletedOutput> OutputWriter::take_completed() {
+	if (completionFile >= 0) {
+		std::uint64_t completions = 0;
+		[[maybe_unused]] const ssize_t length =
+		    ::read(completionFile, &completions, sizeof(completions));
+	}
+
+	std::unique_lock<std::mutex> completedLock{ completedMutex };
+	std::vector<CompletedOutput> taken{};
+	taken.swap(completed);
+	return taken;
+}
+
+void OutputWriter::drain() {
+	std::unique_lock<std::mutex> queuedLock{ queuedMutex };
+	queuedCondition.wait(queuedLock, [this]() { return queuedWrites == 0; });
+}
+
+bool OutputWriter::over_budget() const {
+	std::unique_lock<std::mutex> queuedLock{ queuedMutex };
+	return queuedBytes >= byteBudget;
+}
+
+void OutputWriter::report_statistics() const {
+	std::unique_lock<std::mutex> queuedLock{ queuedMutex };
+	std::unique_lock<std::mutex> completedLock{ completedMutex };
+
+	if (writtenParts == 0) {
+		return;
+	}
+
+	using Milliseconds = std::chrono::duration<double, std::milli>;
+
+	std::clog << "Wrote " << writtenCount << " images to disk, taking "
+	          << Milliseconds{ totalLatency }.count() / static_cast<double>(writtenParts)
+	          << " ms on average (at worst " << Milliseconds{ worstLatency }.count()
+	          << " ms) from receipt to write. At most " << peakQueuedWrites << " writes ("
+	          << static_cast<double>(peakQueuedBytes) / (1024.0 * 1024.0)
+	          << " MiB) were queued at once\n";
+
+	if (failedCount != 0) {
+		std::clog << "Unable to write " << failedCount << " images\n";
+	}
+}
+
+void OutputWriter::queue_write(QueuedWrite write) {
+	write.queued = std::chrono::steady_clock::now();
+
+	{
+		std::unique_lock<std::mutex> queuedLock{ queuedMutex };
+		queuedWrites++;
+		queuedBytes += write.data.size();
+		peakQueuedWrites = std::max(peakQueuedWrites, queuedWrites);
+		peakQueuedBytes = std::max(peakQueuedBytes, queuedBytes);
+	}
+
+	// Every part of an image goes to the same thread, so its parts are written in order
+	WriteThread& writeThread =
+	    *writeThreads[std::hash<std::string>{}(write.filename) % writeThreads.size()];
+
+	{
+		std::unique_lock<std::mutex> writesLock{ writeThread.writesMutex };
+		writeThread.writes.push_back(std::move(write));
+	}
+
+	writeThread.writesCondition.notify_one();
+}
+
+void OutputWriter::run_writes(WriteThread& writeThread) {
+	struct OpenOutput {
+		std::filesystem::path path;
+		std::ofstream file;
+	};
+
+	std::map<std::string, OpenOutput> openOutputs{};
+
+	while (true) {
+		QueuedWrite write{};
+
+		{
+			std::unique_lock<std::mutex> writesLock{ writeThread.writesMutex };
+			writeThread.writesCondition.wait(
+			    writesLock, [&]() { return writeThread.stopping || !writeThread.writes.empty(); });
+
+			if (writeThread.writes.empty()) {
+				return;
+			}
+
+			write = std::move(writeThread.writes.front());
+			writeThread.writes.pop_front();
+		}
+
+		auto openOutput = openOutputs.find(write.filename);
+
+		switch (write.kind) {
+			case QueuedWrite::Kind::Begin: {
+				// Close any earlier attempt before its file is opened again
+				if (openOutput != openOutputs.end()) {
+					openOutputs.erase(openOutput);
+				}
+
+				OpenOutput& output = openOutputs[write.filename];
+				output.path = write.path;
+				output.file.open(write.path,
+				                 std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+				break;
+			}
+			case QueuedWrite::Kind::Append:
+				if (openOutput != openOutputs.end() && openOutput->second.file) {
+					openOutput->second.file.write(reinterpret_cast<const char*>(write.data.data()),
+					                              static_cast<std::streamsize>(write.data.size()));
+				}
+
+				break;
+			case QueuedWrite::Kind::Finish:
+				if (openOutput == openOutputs.end()) {
+					this->complete_output(CompletedOutput{ write.filename, false });
+					break;
+				}
+
+				openOutput->second.file.close();
+				this->complete_output(CompletedOutput{ write.filename, !openOutput->second.file.fail() });
+				openOutputs.erase(openOutput);
+				break;
+			case QueuedWrite::Kind::Discard:
+				if (openOutput != openOutputs.end()) {
+					openOutput->second.file.close();
+
+					std::error_code removeError{};
+					std::filesystem::remove(openOutput->second.path, removeError);
+					openOutputs.erase(openOutput);
+				}
+
+				break;
+		}
+
+		this->account_write(write);
+	}
+}
+
+void OutputWriter::account_write(const QueuedWrite& write) {
+	{
+		std::unique_lock<std::mutex> queuedLock{ queuedMutex };
+		queuedWrites--;
+		queuedBytes -= write.data.size();
+
+		if (write.kind == QueuedWrite::Kind::Append) {
+			const auto latency = std::chrono::steady_clock::now() - write.queued;
+			writtenParts++;
+			totalLatency += latency;
+			worstLatency = std::max(worstLatency, latency);
+		}
+	}
+
+	queuedCondition.notify_all();
+}
+
+void OutputWriter::complete_output(CompletedOutput output) {
+	{
+		std::unique_lock<std::mutex> completedLock{ completedMutex };
+
+		if (output.written) {
+			writtenCount++;
+		} else {
+			failedCount++;
+		}
+
+		completed.push_back(std::move(output));
+	}
+
+	if (completionFile >= 0) {
+		const std::uint64_t completion = 1;
+		[[maybe_unused]] const ssize_t length =
+		    ::write(completionFile, &completion, sizeof(completion));
+	}
+}
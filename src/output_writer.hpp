@@ -0,0 +1,107 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "image_data.hpp"
+
+// An equalised image the writer has finished with, and whether all of it reached its file
+struct CompletedOutput {
+	std::string filename;
+	bool written;
+};
+
+/**
+ * @brief Writes equalised images to disk on threads of its own, away from the receive loop.
+ *
+ * Each image is written as a series of parts, any of which may still be arriving from its worker
+ * when the first is queued. An image's parts are always written by the same thread, in the order
+ * they were queued, while images are spread across threads. Writes are not bounded, but the bytes
+ * queued are measured against a budget, which the server holds back work to respect.
+ */
+class OutputWriter {
+public:
+	OutputWriter(std::size_t threadCount, std::uint64_t byteBudget);
+	OutputWriter(const OutputWriter& other) = delete;
+	OutputWriter& operator=(const OutputWriter& other) = delete;
+	// Completes every queued write
+	~OutputWriter();
+
+	// Starts the output of the frame `filename` at `path`, replacing any output already started
+	void begin(const std::string& filename, const std::filesystem::path& path);
+	void append(const std::string& filename, ImageData data);
+	// Completes the output, after which it is reported by `take_completed`
+	void finish(const std::string& filename);
+	// Abandons the output, removing its file
+	void discard(const std::string& filename);
+
+	// Readable whenever outputs have been completed, for polling alongside sockets
+	[[nodiscard]] int descriptor() const;
+	// Outputs completed since last called, without blocking
+	[[nodiscard]] std::vector<CompletedOutput> take_completed();
+
+	// Waits for every queued write to complete
+	void drain();
+
+	// Whether the bytes queued to be written have reached the budget
+	[[nodiscard]] bool over_budget() const;
+
+	// Logs how long images took to write, and how far writing fell behind
+	void report_statistics() const;
+
+protected:
+	struct QueuedWrite {
+		enum class Kind { Begin, Append, Finish, Discard };
+
+		Kind kind;
+		std::string filename;
+		std::filesystem::path path;
+		ImageData data;
+		std::chrono::steady_clock::time_point queued;
+	};
+
+	struct WriteThread {
+		std::thread thread;
+		std::deque<QueuedWrite> writes;
+		std::mutex writesMutex;
+		std::condition_variable writesCondition;
+		bool stopping = false;
+	};
+
+	void queue_write(QueuedWrite write);
+	void run_writes(WriteThread& writeThread);
+	// Accounts for a write having been made
+	void account_write(const QueuedWrite& write);
+	void complete_output(CompletedOutput output);
+
+	const std::uint64_t byteBudget;
+	std::vector<std::unique_ptr<WriteThread>> writeThreads;
+	int completionFile;
+
+	// Writes queued but not yet made, across every thread
+	mutable std::mutex queuedMutex;
+	std::condition_variable queuedCondition;
+	std::size_t queuedWrites;
+	std::uint64_t queuedBytes;
+	std::size_t peakQueuedWrites;
+	std::uint64_t peakQueuedBytes;
+
+	// Time from parts of images being queued to their being written
+	std::size_t writtenParts;
+	std::chrono::steady_clock::duration totalLatency;
+	std::chrono::steady_clock::duration worstLatency;
+
+	mutable std::mutex completedMutex;
+	std::vector<CompletedOutput> completed;
+	std::size_t writtenCount;
+	std::size_t failedCount;
+};
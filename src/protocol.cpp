@@ -18,15 +18,41 @@
 
 #include "algorithm.hpp"
 
-void split_equalisation_tiff(capnp::List<capnp::Data>::Builder tiffDataBuilder,
-                             const std::vector<std::uint8_t>& rawTiffData) {
-	for (size_t i = 0; i < tiffDataBuilder.size(); i++) {
-		const auto chunkSize = std::min(rawTiffData.size() - (i * MAX_CHUNK_SIZE), MAX_CHUNK_SIZE);
+std::unique_ptr<WorkerCommand> command_from_words(const kj::ArrayPtr<const capnp::word> words,
+                                                  std::optional<ImageData> payload) {
+	capnp::ReaderOptions commandReaderOptions{};
+	// Raise message size limit to 4GB (somewhat reasonable per tiff image)
+	commandReaderOptions.traversalLimitInWords = MAX_MESSAGE_SIZE;
 
-		const auto* const startIter = rawTiffData.data() + (i * MAX_CHUNK_SIZE);
-		capnp::Data::Reader reader{ startIter, chunkSize };
+	capnp::FlatArrayMessageReader messageReader{ words, commandReaderOptions };
 
-		tiffDataBuilder.set(i, reader);
+	const auto commandReader = messageReader.getRoot<ProtocolCommand>();
+
+	const std::string command{ commandReader.getCommand() };
+	const auto data = commandReader.getData();
+
+	switch (data.which()) {
+		case ProtocolCommand::Data::HELO:
+			assert(command == "HELO");
+			return WorkerHeloCommand::from_data(data.getHelo());
+		case ProtocolCommand::Data::EHLO:
+			assert(command == "EHLO");
+			return WorkerEhloCommand::from_data();
+		case ProtocolCommand::Data::JOB:
+			assert(command == "JOB");
+			return WorkerJobCommand::from_data(data.getJob());
+		case ProtocolCommand::Data::RESULT:
+			assert(command == "RESULT");
+			return WorkerResultCommand::from_data(data.getResult(), std::move(payload));
+		case ProtocolCommand::Data::HEARTBEAT:
+			assert(command == "HEARTBEAT");
+			return WorkerHeartbeatCommand::from_data(data.getHeartbeat());
+		case ProtocolCommand::Data::BYE:
+			assert(command == "BYE");
+			return WorkerByeCommand::from_data();
+		default:
+			std::clog << "Invalid command detected\n";
+			return nullptr;
 	}
 }
 
@@ -53,51 +79,64 @@ zmqpp::message& WorkerCommand::add_to_message(zmqpp::message& msg) const {
 	const auto messageWords = capnp::messageToFlatArray(message);
 	const auto messageChars = messageWords.asChars();
 
-	msg.add(std::string{ messageChars.begin(), messageChars.end() });
+	msg.add_raw(messageChars.begin(), messageChars.size());
+
+	const ImageData* const payload = this->image_payload();
+
+	if (payload == nullptr) {
+		return msg;
+	}
+
+	if (payload->empty()) {
+		msg.add(std::string{});
+	} else {
+		// zmq releases its reference to the image once the frame has been sent
+		msg.add_nocopy_const(payload->data(), payload->size(), &ImageData::release,
+		                     payload->retain());
+	}
 
 	return msg;
 }
 
+const ImageData* WorkerCommand::image_payload() const {
+	return nullptr;
+}
+
 std::unique_ptr<WorkerCommand>
 WorkerCommand::from_serialised_string(const std::string& serialisedString) {
 	const size_t wordCount = serialisedString.size() / sizeof(capnp::word) * sizeof(char);
 	std::vector<capnp::word> wordArray(wordCount);
 	std::memcpy(wordArray.data(), serialisedString.c_str(), serialisedString.size() * sizeof(char));
-	const kj::ArrayPtr<capnp::word> wordArrayPtr{ wordArray.data(), wordCount };
-	capnp::ReaderOptions commandReaderOptions{};
-	// Raise message size limit to 4GB (somewhat reasonable per tiff image)
-	commandReaderOptions.traversalLimitInWords = MAX_MESSAGE_SIZE;
 
-	capnp::FlatArrayMessageReader messageReader{ wordArrayPtr, commandReaderOptions };
+	return command_from_words(kj::ArrayPtr<const capnp::word>{ wordArray.data(), wordCount },
+	                          std::nullopt);
+}
 
-	const auto commandReader = messageReader.getRoot<ProtocolCommand>();
+std::unique_ptr<WorkerCommand> WorkerCommand::from_message(zmqpp::message message,
+                                                           const std::size_t part) {
+	const auto heldMessage = std::make_shared<const zmqpp::message>(std::move(message));
+	std::optional<ImageData> payload{};
 
-	const std::string command{ commandReader.getCommand() };
-	const auto data = commandReader.getData();
+	if (heldMessage->parts() > part + 1) {
+		payload.emplace(heldMessage, static_cast<const std::uint8_t*>(heldMessage->raw_data(part + 1)),
+		                heldMessage->size(part + 1));
+	}
 
-	switch (data.which()) {
-		case ProtocolCommand::Data::HELO:
-			assert(command == "HELO");
-			return WorkerHeloCommand::from_data(data.getHelo());
-		case ProtocolCommand::Data::EHLO:
-			assert(command == "EHLO");
-			return WorkerEhloCommand::from_data();
-		case ProtocolCommand::Data::JOB:
-			assert(command == "JOB");
-			return WorkerJobCommand::from_data(data.getJob());
-		case ProtocolCommand::Data::RESULT:
-			assert(command == "RESULT");
-			return WorkerResultCommand::from_data(data.getResult());
-		case ProtocolCommand::Data::HEARTBEAT:
-			assert(command == "HEARTBEAT");
-			return WorkerHeartbeatCommand::from_data(data.getHeartbeat());
-		case ProtocolCommand::Data::BYE:
-			assert(command == "BYE");
-			return WorkerByeCommand::from_data();
-		default:
-			std::clog << "Invalid command detected\n";
-			return nullptr;
+	const void* const commandData = heldMessage->raw_data(part);
+	const size_t wordCount = heldMessage->size(part) / sizeof(capnp::word);
+
+	// Received frames are word aligned in practice, so the command is only copied as a fallback
+	if (reinterpret_cast<std::uintptr_t>(commandData) % alignof(capnp::word) != 0) {
+		std::vector<capnp::word> wordArray(wordCount);
+		std::memcpy(wordArray.data(), commandData, wordCount * sizeof(capnp::word));
+
+		return command_from_words(kj::ArrayPtr<const capnp::word>{ wordArray.data(), wordCount },
+		                          std::move(payload));
 	}
+
+	return command_from_words(
+	    kj::ArrayPtr<const capnp::word>{ static_cast<const capnp::word*>(commandData), wordCount },
+	    std::move(payload));
 }
 
 WorkerHeloCommand::WorkerHeloCommand(std::uint32_t concurrency)
@@ -136,12 +175,15 @@ void WorkerEhloCommand::visit(CommandVisitor& visitor) const {
 	return visitor.visit_ehlo(*this);
 }
 
-WorkerJobCommand::WorkerJobCommand(std::string jobType)
-    : WorkerCommand{ "JOB" }, job_type{ std::move(jobType) } {}
+WorkerJobCommand::WorkerJobCommand(std::string jobType, std::string filename)
+    : WorkerCommand{ "JOB" }, job_type{ std::move(jobType) }, filename{ std::move(filename) },
+      job_id{ 0 }, path_id{ 0 }, send_path{ true } {}
 
 void WorkerJobCommand::command_data(ProtocolCommand::Data::Builder& dataBuilder) const {
 	auto jobBuilder = dataBuilder.initJob();
 	jobBuilder.setType(this->job_type);
+	jobBuilder.setJobId(this->job_id);
+	jobBuilder.setPathId(this->path_id);
 
 	auto jobDataBuilder = jobBuilder.initData();
 	this->command_data(jobDataBuilder);
@@ -150,74 +192,118 @@ void WorkerJobCommand::command_data(ProtocolCommand::Data::Builder& dataBuilder)
 std::unique_ptr<WorkerJobCommand> WorkerJobCommand::from_data(const ProtocolJob::Reader reader) {
 	const std::string decodedType{ reader.getType() };
 	const auto data = reader.getData();
+	std::unique_ptr<WorkerJobCommand> job{};
 
 	switch (data.which()) {
 		case ProtocolJob::Data::HISTOGRAM:
 			assert(decodedType == "HISTOGRAM");
-			return WorkerHistogramJobCommand::from_data(data.getHistogram());
+			job = WorkerHistogramJobCommand::from_data(data.getHistogram());
+			break;
 		case ProtocolJob::Data::EQUALISATION:
 			assert(decodedType == "EQUALISATION");
-			return WorkerEqualisationJobCommand::from_data(data.getEqualisation());
+			job = WorkerEqualisationJobCommand::from_data(data.getEqualisation());
+			break;
+		case ProtocolJob::Data::FUSED:
+			assert(decodedType == "FUSED");
+			job = WorkerFusedJobCommand::from_data(data.getFused());
+			break;
 		default:
 			return nullptr;
 	}
+
+	job->set_job_id(reader.getJobId());
+	job->set_path_id(reader.getPathId(), !job->filename.empty());
+	return job;
+}
+
+const std::string& WorkerJobCommand::get_filename() const {
+	return this->filename;
+}
+
+std::uint64_t WorkerJobCommand::get_job_id() const {
+	return this->job_id;
+}
+
+void WorkerJobCommand::set_job_id(const std::uint64_t jobId) {
+	this->job_id = jobId;
 }
 
-bool WorkerJobCommand::operator==(const WorkerJobCommand& other) const {
-	return this->job_type == other.job_type;
+void WorkerJobCommand::set_path_id(const std::uint32_t pathId, const bool sendPath) {
+	this->path_id = pathId;
+	this->send_path = sendPath;
 }
 
-bool WorkerJobCommand::operator==(const WorkerResultCommand& other) const {
-	return this->job_type == other.result_type;
+bool WorkerJobCommand::resolve_path(std::vector<std::string>& knownPaths) {
+	if (this->send_path) {
+		if (knownPaths.size() <= this->path_id) {
+			knownPaths.resize(this->path_id + 1);
+		}
+
+		knownPaths[this->path_id] = this->filename;
+		return true;
+	}
+
+	if (this->path_id >= knownPaths.size() || knownPaths[this->path_id].empty()) {
+		return false;
+	}
+
+	this->filename = knownPaths[this->path_id];
+	return true;
 }
 
-WorkerHistogramJobCommand::WorkerHistogramJobCommand(std::string filename)
-    : WorkerJobCommand{ "HISTOGRAM" }, filename{ std::move(filename) } {}
+const std::string& WorkerJobCommand::sent_filename() const {
+	static const std::string unsentFilename{};
+
+	return this->send_path ? this->filename : unsentFilename;
+}
+
+WorkerHistogramJobCommand::WorkerHistogramJobCommand(std::string filename,
+                                                     const std::uint64_t sampleBudget,
+                                                     const std::uint32_t decodeSize)
+    : WorkerJobCommand{ "HISTOGRAM", std::move(filename) }, sample_budget{ sampleBudget },
+      decode_size{ decodeSize } {}
 
 std::unique_ptr<WorkerHistogramJobCommand>
 WorkerHistogramJobCommand::from_data(const HistogramJob::Reader reader) {
 	const std::string filename{ reader.getFilename() };
+	const std::uint64_t sampleBudget{ reader.getSampleBudget() };
+	const std::uint32_t decodeSize{ reader.getDecodeSize() };
 
-	return std::make_unique<WorkerHistogramJobCommand>(filename);
+	return std::make_unique<WorkerHistogramJobCommand>(filename, sampleBudget, decodeSize);
 }
 
 void WorkerHistogramJobCommand::command_data(ProtocolJob::Data::Builder& dataBuilder) const {
-	dataBuilder.initHistogram().setFilename(this->filename);
-}
+	auto histogramJob = dataBuilder.initHistogram();
 
-std::string WorkerHistogramJobCommand::get_filename() const {
-	return this->filename;
+	histogramJob.setFilename(this->sent_filename());
+	histogramJob.setSampleBudget(this->sample_budget);
+	histogramJob.setDecodeSize(this->decode_size);
 }
 
-void WorkerHistogramJobCommand::visit(CommandVisitor& visitor) const {
-	return visitor.visit_histogram_job(*this);
+std::uint64_t WorkerHistogramJobCommand::get_sample_budget() const {
+	return this->sample_budget;
 }
 
-bool WorkerHistogramJobCommand::operator==(const WorkerJobCommand& other) const {
-	if (!WorkerJobCommand::operator==(other)) {
-		return false;
-	}
-
-	const auto& otherHistogramJob = dynamic_cast<const WorkerHistogramJobCommand&>(other);
-
-	return this->filename == otherHistogramJob.filename;
+std::uint32_t WorkerHistogramJobCommand::get_decode_size() const {
+	return this->decode_size;
 }
 
-bool WorkerHistogramJobCommand::operator==(const WorkerResultCommand& other) const {
-	if (!WorkerJobCommand::operator==(other)) {
-		return false;
-	}
-
-	const auto& otherHistogramJob = dynamic_cast<const WorkerHistogramResultCommand&>(other);
+void WorkerHistogramJobCommand::visit(CommandVisitor& visitor) const {
+	return visitor.visit_histogram_job(*this);
+}
 
-	return this->filename == otherHistogramJob.filename;
+// `ProtocolOutputCodec` lists its codecs in the same order as `OutputCodec`
+static OutputEncoding decode_output_encoding(const ProtocolOutputCodec codec,
+                                             const std::uint8_t quality) {
+	return OutputEncoding{ static_cast<OutputCodec>(codec),
+		                     (quality != 0) ? quality : OUTPUT_QUALITY };
 }
 
 WorkerEqualisationJobCommand::WorkerEqualisationJobCommand(
-    std::string filename, EqualisationHistogramMapping histogramMapping)
-    : WorkerJobCommand{ "EQUALISATION" }, filename{ std::move(filename) }, histogramMapping{
-	      std::move(histogramMapping)
-      } {}
+    std::string filename, EqualisationHistogramMapping histogramMapping,
+    OutputEncoding outputEncoding)
+    : WorkerJobCommand{ "EQUALISATION", std::move(filename) },
+      histogramMapping{ std::move(histogramMapping) }, output_encoding{ outputEncoding } {}
 
 std::unique_ptr<WorkerEqualisationJobCommand>
 WorkerEqualisationJobCommand::from_data(const EqualisationJob::Reader reader) {
@@ -229,13 +315,18 @@ WorkerEqualisationJobCommand::from_data(const EqualisationJob::Reader reader) {
 		mapping[i] = messageHistogramOffsets[i];
 	}
 
-	return std::make_unique<WorkerEqualisationJobCommand>(filename, mapping);
+	const OutputEncoding outputEncoding =
+	    decode_output_encoding(reader.getOutputCodec(), reader.getOutputQuality());
+
+	return std::make_unique<WorkerEqualisationJobCommand>(filename, mapping, outputEncoding);
 }
 
 void WorkerEqualisationJobCommand::command_data(ProtocolJob::Data::Builder& dataBuilder) const {
 	auto equalisationJob = dataBuilder.initEqualisation();
 
-	equalisationJob.setFilename(this->filename);
+	equalisationJob.setFilename(this->sent_filename());
+	equalisationJob.setOutputCodec(static_cast<ProtocolOutputCodec>(this->output_encoding.codec));
+	equalisationJob.setOutputQuality(this->output_encoding.quality);
 	auto jobHistogramOffsets = equalisationJob.initHistogramMapping(this->histogramMapping.size());
 
 	for (size_t i = 0; i < this->histogramMapping.size(); i++) {
@@ -243,81 +334,140 @@ void WorkerEqualisationJobCommand::command_data(ProtocolJob::Data::Builder& data
 	}
 }
 
-std::string WorkerEqualisationJobCommand::get_filename() const {
-	return this->filename;
-}
-
 EqualisationHistogramMapping WorkerEqualisationJobCommand::get_histogram_mapping() const {
 	return this->histogramMapping;
 }
 
+const OutputEncoding& WorkerEqualisationJobCommand::get_output_encoding() const {
+	return this->output_encoding;
+}
+
 void WorkerEqualisationJobCommand::visit(CommandVisitor& visitor) const {
 	return visitor.visit_equalisation_job(*this);
 }
 
-bool WorkerEqualisationJobCommand::operator==(const WorkerJobCommand& other) const {
-	if (!WorkerJobCommand::operator==(other)) {
-		return false;
-	}
+WorkerFusedJobCommand::WorkerFusedJobCommand(std::string filename,
+                                             std::optional<Histogram> previousHistogram,
+                                             const std::uint64_t sampleBudget,
+                                             OutputEncoding outputEncoding)
+    : WorkerJobCommand{ "FUSED", std::move(filename) },
+      previous_histogram{ std::move(previousHistogram) }, sample_budget{ sampleBudget },
+      output_encoding{ outputEncoding } {}
 
-	const auto& otherEqualisationJob = dynamic_cast<const WorkerEqualisationJobCommand&>(other);
+std::unique_ptr<WorkerFusedJobCommand>
+WorkerFusedJobCommand::from_data(const FusedJob::Reader reader) {
+	const std::string filename{ reader.getFilename() };
+	const auto encodedHistogram = reader.getPreviousHistogram();
+	std::optional<Histogram> previousHistogram{};
+
+	if (encodedHistogram.size() != 0) {
+		assert(encodedHistogram.size() == HISTOGRAM_SEGMENTS);
+		previousHistogram.emplace();
+
+		for (size_t i = 0; i < previousHistogram->size(); i++) {
+			(*previousHistogram)[i] = encodedHistogram[i];
+		}
+	}
 
-	return this->filename == otherEqualisationJob.filename;
+	return std::make_unique<WorkerFusedJobCommand>(
+	    filename, previousHistogram, reader.getSampleBudget(),
+	    decode_output_encoding(reader.getOutputCodec(), reader.getOutputQuality()));
 }
 
-bool WorkerEqualisationJobCommand::operator==(const WorkerResultCommand& other) const {
-	if (!WorkerJobCommand::operator==(other)) {
-		return false;
+void WorkerFusedJobCommand::command_data(ProtocolJob::Data::Builder& dataBuilder) const {
+	auto fusedJob = dataBuilder.initFused();
+
+	fusedJob.setFilename(this->sent_filename());
+	fusedJob.setSampleBudget(this->sample_budget);
+	fusedJob.setOutputCodec(static_cast<ProtocolOutputCodec>(this->output_encoding.codec));
+	fusedJob.setOutputQuality(this->output_encoding.quality);
+
+	if (this->previous_histogram) {
+		auto encodedHistogram = fusedJob.initPreviousHistogram(this->previous_histogram->size());
+
+		for (size_t i = 0; i < this->previous_histogram->size(); i++) {
+			encodedHistogram.set(i, (*this->previous_histogram)[i]);
+		}
 	}
+}
+
+const std::optional<Histogram>& WorkerFusedJobCommand::get_previous_histogram() const {
+	return this->previous_histogram;
+}
+
+std::uint64_t WorkerFusedJobCommand::get_sample_budget() const {
+	return this->sample_budget;
+}
 
-	const auto& otherEqualisationJob = dynamic_cast<const WorkerEqualisationResultCommand&>(other);
+const OutputEncoding& WorkerFusedJobCommand::get_output_encoding() const {
+	return this->output_encoding;
+}
 
-	return this->filename == otherEqualisationJob.filename;
+void WorkerFusedJobCommand::visit(CommandVisitor& visitor) const {
+	return visitor.visit_fused_job(*this);
 }
 
-WorkerResultCommand::WorkerResultCommand(std::string resultType)
-    : WorkerCommand{ "RESULT" }, result_type{ std::move(resultType) } {}
+WorkerResultCommand::WorkerResultCommand(std::string resultType, const std::uint64_t jobId)
+    : WorkerCommand{ "RESULT" }, result_type{ std::move(resultType) }, job_id{ jobId } {}
 
 void WorkerResultCommand::command_data(ProtocolCommand::Data::Builder& dataBuilder) const {
 	auto resultBuilder = dataBuilder.initResult();
 	resultBuilder.setType(this->result_type);
+	resultBuilder.setJobId(this->job_id);
 
 	auto resultDataBuilder = resultBuilder.initData();
 	this->command_data(resultDataBuilder);
 }
 
 std::unique_ptr<WorkerResultCommand>
-WorkerResultCommand::from_data(const ProtocolResult::Reader reader) {
+WorkerResultCommand::from_data(const ProtocolResult::Reader reader,
+                               std::optional<ImageData> payload) {
 	const std::string decodedType{ reader.getType() };
 	const auto data = reader.getData();
+	const std::uint64_t jobId{ reader.getJobId() };
 
 	switch (data.which()) {
 		case ProtocolResult::Data::HISTOGRAM:
 			assert(decodedType == "HISTOGRAM");
-			return WorkerHistogramResultCommand::from_data(data.getHistogram());
+			return WorkerHistogramResultCommand::from_data(data.getHistogram(), jobId);
 		case ProtocolResult::Data::EQUALISATION:
 			assert(decodedType == "EQUALISATION");
-			return WorkerEqualisationResultCommand::from_data(data.getEqualisation());
+			return WorkerEqualisationResultCommand::from_data(data.getEqualisation(), jobId,
+			                                                  std::move(payload));
+		case ProtocolResult::Data::FUSED:
+			assert(decodedType == "FUSED");
+			return WorkerFusedResultCommand::from_data(data.getFused(), jobId, std::move(payload));
+		case ProtocolResult::Data::STREAM_HEADER:
+			assert(decodedType == "STREAM_HEADER");
+			return WorkerStreamHeaderCommand::from_data(data.getStreamHeader(), jobId);
+		case ProtocolResult::Data::STREAM_CHUNK:
+			assert(decodedType == "STREAM_CHUNK");
+			return WorkerStreamChunkCommand::from_data(data.getStreamChunk(), jobId,
+			                                           std::move(payload));
+		case ProtocolResult::Data::STREAM_TRAILER:
+			assert(decodedType == "STREAM_TRAILER");
+			return WorkerStreamTrailerCommand::from_data(data.getStreamTrailer(), jobId);
+		case ProtocolResult::Data::UNKNOWN_PATH:
+			assert(decodedType == "UNKNOWN_PATH");
+			return WorkerUnknownPathCommand::from_data(jobId);
 		default:
 			return nullptr;
 	}
 }
 
-bool WorkerResultCommand::operator==(const WorkerJobCommand& other) const {
-	return this->result_type == other.job_type;
-}
-
-bool WorkerResultCommand::operator==(const WorkerResultCommand& other) const {
-	return this->result_type == other.result_type;
+std::uint64_t WorkerResultCommand::get_job_id() const {
+	return this->job_id;
 }
 
-WorkerHistogramResultCommand::WorkerHistogramResultCommand(std::string filename,
-                                                           const Histogram& histogram)
-    : WorkerResultCommand{ "HISTOGRAM" }, filename{ std::move(filename) }, histogram{ histogram } {}
+WorkerHistogramResultCommand::WorkerHistogramResultCommand(const std::uint64_t jobId,
+                                                           const Histogram& histogram,
+                                                           const double cdfErrorBound)
+    : WorkerResultCommand{ "HISTOGRAM", jobId }, histogram{ histogram },
+      cdf_error_bound{ cdfErrorBound } {}
 
 std::unique_ptr<WorkerHistogramResultCommand>
-WorkerHistogramResultCommand::from_data(const HistogramResult::Reader histogramReader) {
-	const std::string filename{ histogramReader.getFilename() };
+WorkerHistogramResultCommand::from_data(const HistogramResult::Reader histogramReader,
+                                        const std::uint64_t jobId) {
 	const auto encodedHistogram{ histogramReader.getHistogram() };
 	Histogram histogram{};
 
@@ -327,132 +477,234 @@ WorkerHistogramResultCommand::from_data(const HistogramResult::Reader histogramR
 		histogram[i] = encodedHistogram[i];
 	}
 
-	return std::make_unique<WorkerHistogramResultCommand>(filename, histogram);
+	return std::make_unique<WorkerHistogramResultCommand>(jobId, histogram,
+	                                                      histogramReader.getCdfErrorBound());
 }
 
 void WorkerHistogramResultCommand::command_data(ProtocolResult::Data::Builder& dataBuilder) const {
 	HistogramResult::Builder histogramBuilder = dataBuilder.initHistogram();
-	histogramBuilder.setFilename(filename);
 	auto serializableHistogram = histogramBuilder.initHistogram(histogram.size());
 
 	for (size_t i = 0; i < histogram.size(); i++) {
 		serializableHistogram.set(i, histogram[i]);
 	}
+
+	histogramBuilder.setCdfErrorBound(cdf_error_bound);
 }
 
 void WorkerHistogramResultCommand::visit(CommandVisitor& visitor) const {
 	return visitor.visit_histogram_result(*this);
 }
 
-std::string WorkerHistogramResultCommand::get_filename() const {
-	return this->filename;
-}
-
 Histogram WorkerHistogramResultCommand::get_histogram() const {
 	return this->histogram;
 }
 
-bool WorkerHistogramResultCommand::operator==(const WorkerJobCommand& jobCommand) const {
-	if (!WorkerResultCommand::operator==(jobCommand)) {
-		return false;
-	}
+double WorkerHistogramResultCommand::get_cdf_error_bound() const {
+	return this->cdf_error_bound;
+}
 
-	const auto& histogramJobCommand = dynamic_cast<const WorkerHistogramJobCommand&>(jobCommand);
+WorkerEqualisationResultCommand::WorkerEqualisationResultCommand(
+    const std::uint64_t jobId, std::optional<ImageData> tiffData)
+    : WorkerResultCommand{ "EQUALISATION", jobId }, tiff_data{ std::move(tiffData) } {}
 
-	return this->filename == histogramJobCommand.filename;
+std::unique_ptr<WorkerEqualisationResultCommand>
+WorkerEqualisationResultCommand::from_data(const EqualisationResult::Reader equalisationReader,
+                                           const std::uint64_t jobId,
+                                           std::optional<ImageData> payload) {
+	return std::make_unique<WorkerEqualisationResultCommand>(jobId, std::move(payload));
 }
 
-bool WorkerHistogramResultCommand::operator==(const WorkerResultCommand& jobCommand) const {
-	if (!WorkerResultCommand::operator==(jobCommand)) {
-		return false;
-	}
+void WorkerEqualisationResultCommand::command_data(
+    ProtocolResult::Data::Builder& dataBuilder) const {
+	dataBuilder.initEqualisation();
 
-	const auto& histogramJobCommand = dynamic_cast<const WorkerHistogramResultCommand&>(jobCommand);
+	// The image follows in its own frame, see `image_payload`
+}
 
-	return this->filename == histogramJobCommand.filename;
+void WorkerEqualisationResultCommand::visit(CommandVisitor& visitor) const {
+	return visitor.visit_equalisation_result(*this);
+}
+
+bool WorkerEqualisationResultCommand::has_tiff_data() const {
+	return this->tiff_data.has_value();
 }
 
-WorkerEqualisationResultCommand::WorkerEqualisationResultCommand(std::string filename,
-                                                                 std::vector<std::uint8_t> tiffData)
-    : WorkerResultCommand{ "EQUALISATION" }, filename{ std::move(filename) }, tiff_data{ std::move(
-	                                                                                tiffData) } {}
+const ImageData& WorkerEqualisationResultCommand::get_tiff_data() const {
+	return *this->tiff_data;
+}
 
-// This decoding step is complex by necessity. There is sufficient memory moving around here to make
-// efficiency in doing so pretty important.
-std::unique_ptr<WorkerEqualisationResultCommand>
-WorkerEqualisationResultCommand::from_data(const EqualisationResult::Reader equalisationReader) {
-	const std::string filename{ equalisationReader.getFilename() };
-	const auto& tiffDataList = equalisationReader.getTiffResult();
-	std::vector<uint8_t> tiffData{};
+const ImageData* WorkerEqualisationResultCommand::image_payload() const {
+	return this->tiff_data ? &*this->tiff_data : nullptr;
+}
 
-	/* Pre-allocate in order to avoid expensive resizes. */
-	{
-		size_t totalTiffDataSize = 0;
+WorkerFusedResultCommand::WorkerFusedResultCommand(const std::uint64_t jobId,
+                                                   const Histogram& histogram,
+                                                   const double cdfErrorBound,
+                                                   std::optional<ImageData> tiffData)
+    : WorkerResultCommand{ "FUSED", jobId }, histogram{ histogram },
+      cdf_error_bound{ cdfErrorBound }, tiff_data{ std::move(tiffData) } {}
 
-		for (const auto& tiffDataChunk : tiffDataList) {
-			totalTiffDataSize += tiffDataChunk.asBytes().size();
-		}
+std::unique_ptr<WorkerFusedResultCommand>
+WorkerFusedResultCommand::from_data(const FusedResult::Reader fusedReader,
+                                    const std::uint64_t jobId, std::optional<ImageData> payload) {
+	const auto encodedHistogram{ fusedReader.getHistogram() };
+	Histogram histogram{};
 
-		tiffData.resize(totalTiffDataSize);
+	assert(encodedHistogram.size() == histogram.size());
+
+	for (size_t i = 0; i < encodedHistogram.size(); i++) {
+		histogram[i] = encodedHistogram[i];
 	}
 
-	size_t cumulativeSize = 0;
+	return std::make_unique<WorkerFusedResultCommand>(jobId, histogram,
+	                                                  fusedReader.getCdfErrorBound(),
+	                                                  std::move(payload));
+}
 
-	for (const auto& tiffDataChunk : tiffDataList) {
-		const auto& tiffDataChunkBytes = tiffDataChunk.asBytes();
-		auto* const endElem = tiffData.data() + cumulativeSize;
-		cumulativeSize += tiffDataChunkBytes.size();
+void WorkerFusedResultCommand::command_data(ProtocolResult::Data::Builder& dataBuilder) const {
+	FusedResult::Builder fusedBuilder = dataBuilder.initFused();
+	auto serializableHistogram = fusedBuilder.initHistogram(histogram.size());
 
-		// Avoid member-by-member copying a-la std::vector::insert
-		std::memcpy(endElem, tiffDataChunkBytes.begin(), tiffDataChunkBytes.size());
+	for (size_t i = 0; i < histogram.size(); i++) {
+		serializableHistogram.set(i, histogram[i]);
 	}
 
-	return std::make_unique<WorkerEqualisationResultCommand>(filename, std::move(tiffData));
+	fusedBuilder.setCdfErrorBound(cdf_error_bound);
+
+	// The image follows in its own frame, see `image_payload`
 }
 
-void WorkerEqualisationResultCommand::command_data(
-    ProtocolResult::Data::Builder& dataBuilder) const {
-	EqualisationResult::Builder equalisationBuilder = dataBuilder.initEqualisation();
-	equalisationBuilder.setFilename(filename);
+void WorkerFusedResultCommand::visit(CommandVisitor& visitor) const {
+	return visitor.visit_fused_result(*this);
+}
 
-	const auto chunkDiv = std::lldiv(this->tiff_data.size(), MAX_CHUNK_SIZE);
-	const auto chunkCount = chunkDiv.quot + ((chunkDiv.rem == 0) ? 0ULL : 1ULL);
-	auto tiffResultBuilder = equalisationBuilder.initTiffResult(chunkCount);
-	split_equalisation_tiff(tiffResultBuilder, this->tiff_data);
+Histogram WorkerFusedResultCommand::get_histogram() const {
+	return this->histogram;
 }
 
-void WorkerEqualisationResultCommand::visit(CommandVisitor& visitor) const {
-	return visitor.visit_equalisation_result(*this);
+double WorkerFusedResultCommand::get_cdf_error_bound() const {
+	return this->cdf_error_bound;
 }
 
-std::string WorkerEqualisationResultCommand::get_filename() const {
-	return this->filename;
+bool WorkerFusedResultCommand::has_tiff_data() const {
+	return this->tiff_data.has_value();
 }
 
-const std::vector<std::uint8_t>& WorkerEqualisationResultCommand::get_tiff_data() const {
-	return this->tiff_data;
+const ImageData& WorkerFusedResultCommand::get_tiff_data() const {
+	return *this->tiff_data;
 }
 
-bool WorkerEqualisationResultCommand::operator==(const WorkerJobCommand& jobCommand) const {
-	if (!WorkerResultCommand::operator==(jobCommand)) {
-		return false;
-	}
+const ImageData* WorkerFusedResultCommand::image_payload() const {
+	return this->tiff_data ? &*this->tiff_data : nullptr;
+}
 
-	const auto& equalisationJobCommand =
-	    dynamic_cast<const WorkerEqualisationJobCommand&>(jobCommand);
+WorkerStreamHeaderCommand::WorkerStreamHeaderCommand(const std::uint64_t jobId)
+    : WorkerResultCommand{ "STREAM_HEADER", jobId } {}
 
-	return this->filename == equalisationJobCommand.filename;
+std::unique_ptr<WorkerStreamHeaderCommand>
+WorkerStreamHeaderCommand::from_data(const StreamHeader::Reader /* headerReader */,
+                                     const std::uint64_t jobId) {
+	return std::make_unique<WorkerStreamHeaderCommand>(jobId);
 }
 
-bool WorkerEqualisationResultCommand::operator==(const WorkerResultCommand& jobCommand) const {
-	if (!WorkerResultCommand::operator==(jobCommand)) {
-		return false;
-	}
+void WorkerStreamHeaderCommand::command_data(ProtocolResult::Data::Builder& dataBuilder) const {
+	dataBuilder.initStreamHeader();
+}
+
+void WorkerStreamHeaderCommand::visit(CommandVisitor& visitor) const {
+	return visitor.visit_stream_header(*this);
+}
+
+WorkerStreamChunkCommand::WorkerStreamChunkCommand(const std::uint64_t jobId,
+                                                   const std::uint32_t sequence,
+                                                   ImageData chunkData)
+    : WorkerResultCommand{ "STREAM_CHUNK", jobId }, sequence{ sequence },
+      chunk_data{ std::move(chunkData) } {}
+
+std::unique_ptr<WorkerStreamChunkCommand>
+WorkerStreamChunkCommand::from_data(const StreamChunk::Reader chunkReader,
+                                    const std::uint64_t jobId, std::optional<ImageData> payload) {
+	// A chunk without its frame is passed on empty, and fails its image's checksum
+	return std::make_unique<WorkerStreamChunkCommand>(jobId, chunkReader.getSequence(),
+	                                                  payload ? std::move(*payload) : ImageData{});
+}
+
+void WorkerStreamChunkCommand::command_data(ProtocolResult::Data::Builder& dataBuilder) const {
+	StreamChunk::Builder chunkBuilder = dataBuilder.initStreamChunk();
+	chunkBuilder.setSequence(sequence);
+
+	// The chunk's bytes follow in their own frame, see `image_payload`
+}
 
-	const auto& equalisationJobCommand =
-	    dynamic_cast<const WorkerEqualisationResultCommand&>(jobCommand);
+void WorkerStreamChunkCommand::visit(CommandVisitor& visitor) const {
+	return visitor.visit_stream_chunk(*this);
+}
+
+std::uint32_t WorkerStreamChunkCommand::get_sequence() const {
+	return this->sequence;
+}
+
+const ImageData& WorkerStreamChunkCommand::get_chunk_data() const {
+	return this->chunk_data;
+}
+
+const ImageData* WorkerStreamChunkCommand::image_payload() const {
+	return &this->chunk_data;
+}
+
+WorkerStreamTrailerCommand::WorkerStreamTrailerCommand(const std::uint64_t jobId,
+                                                       const std::uint32_t chunkCount,
+                                                       const std::uint64_t size,
+                                                       const std::uint64_t checksum)
+    : WorkerResultCommand{ "STREAM_TRAILER", jobId }, chunk_count{ chunkCount }, size{ size },
+      checksum{ checksum } {}
+
+std::unique_ptr<WorkerStreamTrailerCommand>
+WorkerStreamTrailerCommand::from_data(const StreamTrailer::Reader trailerReader,
+                                      const std::uint64_t jobId) {
+	return std::make_unique<WorkerStreamTrailerCommand>(jobId, trailerReader.getChunkCount(),
+	                                                    trailerReader.getSize(),
+	                                                    trailerReader.getChecksum());
+}
+
+void WorkerStreamTrailerCommand::command_data(ProtocolResult::Data::Builder& dataBuilder) const {
+	StreamTrailer::Builder trailerBuilder = dataBuilder.initStreamTrailer();
+	trailerBuilder.setChunkCount(chunk_count);
+	trailerBuilder.setSize(size);
+	trailerBuilder.setChecksum(checksum);
+}
+
+void WorkerStreamTrailerCommand::visit(CommandVisitor& visitor) const {
+	return visitor.visit_stream_trailer(*this);
+}
+
+std::uint32_t WorkerStreamTrailerCommand::get_chunk_count() const {
+	return this->chunk_count;
+}
+
+std::uint64_t WorkerStreamTrailerCommand::get_size() const {
+	return this->size;
+}
+
+std::uint64_t WorkerStreamTrailerCommand::get_checksum() const {
+	return this->checksum;
+}
+
+WorkerUnknownPathCommand::WorkerUnknownPathCommand(const std::uint64_t jobId)
+    : WorkerResultCommand{ "UNKNOWN_PATH", jobId } {}
+
+std::unique_ptr<WorkerUnknownPathCommand>
+WorkerUnknownPathCommand::from_data(const std::uint64_t jobId) {
+	return std::make_unique<WorkerUnknownPathCommand>(jobId);
+}
+
+void WorkerUnknownPathCommand::command_data(ProtocolResult::Data::Builder& dataBuilder) const {
+	dataBuilder.setUnknownPath();
+}
 
-	return this->filename == equalisationJobCommand.filename;
+void WorkerUnknownPathCommand::visit(CommandVisitor& visitor) const {
+	return visitor.visit_unknown_path(*this);
 }
 
 WorkerHeartbeatCommand::WorkerHeartbeatCommand(HeartbeatType heartbeatType)
@@ -496,8 +748,14 @@ void CommandVisitor::visit_helo(const WorkerHeloCommand& heloCommand) {}
 void CommandVisitor::visit_ehlo(const WorkerEhloCommand& ehloCommand) {}
 void CommandVisitor::visit_histogram_job(const WorkerHistogramJobCommand& jobCommand) {}
 void CommandVisitor::visit_equalisation_job(const WorkerEqualisationJobCommand& jobCommand) {}
+void CommandVisitor::visit_fused_job(const WorkerFusedJobCommand& jobCommand) {}
 void CommandVisitor::visit_histogram_result(const WorkerHistogramResultCommand& resultCommand) {}
 void CommandVisitor::visit_equalisation_result(
     const WorkerEqualisationResultCommand& resultCommand) {}
+void CommandVisitor::visit_fused_result(const WorkerFusedResultCommand& resultCommand) {}
+void CommandVisitor::visit_stream_header(const WorkerStreamHeaderCommand& headerCommand) {}
+void CommandVisitor::visit_stream_chunk(const WorkerStreamChunkCommand& chunkCommand) {}
+void CommandVisitor::visit_stream_trailer(const WorkerStreamTrailerCommand& trailerCommand) {}
+void CommandVisitor::visit_unknown_path(const WorkerUnknownPathCommand& unknownPathCommand) {}
 void CommandVisitor::visit_heartbeat(const WorkerHeartbeatCommand& heartbeatCommand) {}
 void CommandVisitor::visit_bye(const WorkerByeCommand& byeCommand) {}
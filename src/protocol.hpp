@@ -5,6 +5,7 @@
 #include <cstdint>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -14,6 +15,8 @@
 #include "algorithm.hpp"
 #include "commands.capnp.h"
 #include "config.hpp"
+#include "image_data.hpp"
+#include "output_encoding.hpp"
 #include "worker.hpp"
 
 namespace zmqpp {
@@ -40,10 +43,18 @@ public:
 
 	virtual void visit(CommandVisitor& visitor) const = 0;
 
+	// The command is added as a single frame, followed by a frame holding its image if it carries
+	// one. The image frame is sent without being copied.
 	[[nodiscard]] zmqpp::message to_message() const;
 	zmqpp::message& add_to_message(zmqpp::message& msg) const;
 
+	// The image carried alongside the command, rather than within it, if any
+	[[nodiscard]] virtual const ImageData* image_payload() const;
+
 	static std::unique_ptr<WorkerCommand> from_serialised_string(const std::string& serialisedString);
+	// Reads the command in frame `part` of `message`, with the image in the frame following it. Both
+	// are read in place, the image holding on to the message rather than being copied out of it.
+	static std::unique_ptr<WorkerCommand> from_message(zmqpp::message message, std::size_t part);
 
 private:
 	const std::string command_string;
@@ -76,13 +87,9 @@ public:
 	static std::unique_ptr<WorkerEhloCommand> from_data();
 };
 
-class WorkerResultCommand;
-class WorkerHistogramResultCommand;
-class WorkerEqualisationResultCommand;
-
 class WorkerJobCommand : public WorkerCommand {
 public:
-	WorkerJobCommand(std::string jobType);
+	WorkerJobCommand(std::string jobType, std::string filename);
 	~WorkerJobCommand() override = default;
 
 	void command_data(ProtocolCommand::Data::Builder& dataBuilder) const override;
@@ -90,62 +97,93 @@ public:
 	// Require child classes to be able to build the job component of command's data
 	virtual void command_data(ProtocolJob::Data::Builder& dataBuilder) const = 0;
 
-	static std::unique_ptr<WorkerJobCommand> from_data(ProtocolJob::Reader reader);
+	// The image the job is for
+	[[nodiscard]] const std::string& get_filename() const;
 
-	virtual bool operator==(const WorkerJobCommand& other) const;
-	virtual bool operator==(const WorkerResultCommand& other) const;
+	// Identifies the job's result, assigned each time the job is dispatched
+	[[nodiscard]] std::uint64_t get_job_id() const;
+	void set_job_id(std::uint64_t jobId);
+
+	// The ID the job's worker knows its path by, with the path itself only sent if `sendPath`
+	void set_path_id(std::uint32_t pathId, bool sendPath);
+	// Records the path of a job sent in full in `knownPaths`, or takes the path of a job sent by ID
+	// alone from it, returning whether the path is known
+	bool resolve_path(std::vector<std::string>& knownPaths);
+
+	static std::unique_ptr<WorkerJobCommand> from_data(ProtocolJob::Reader reader);
 
 protected:
-	std::string job_type;
+	// The filename to send, left empty when the worker already knows the path by its ID
+	[[nodiscard]] const std::string& sent_filename() const;
 
-	friend WorkerResultCommand;
+	std::string job_type;
+	std::string filename;
+	std::uint64_t job_id;
+	std::uint32_t path_id;
+	bool send_path;
 };
 
 class WorkerHistogramJobCommand : public WorkerJobCommand {
 public:
-	WorkerHistogramJobCommand(std::string filename);
+	WorkerHistogramJobCommand(std::string filename, std::uint64_t sampleBudget = 0,
+	                          std::uint32_t decodeSize = 0);
 
 	void command_data(ProtocolJob::Data::Builder& dataBuilder) const override;
 	void visit(CommandVisitor& visitor) const override;
 
-	[[nodiscard]] std::string get_filename() const;
+	[[nodiscard]] std::uint64_t get_sample_budget() const;
+	[[nodiscard]] std::uint32_t get_decode_size() const;
 
 	static std::unique_ptr<WorkerHistogramJobCommand> from_data(HistogramJob::Reader reader);
 
-	bool operator==(const WorkerJobCommand& other) const override;
-	bool operator==(const WorkerResultCommand& other) const override;
-
 protected:
-	std::string filename;
-
-	friend WorkerHistogramResultCommand;
+	std::uint64_t sample_budget;
+	std::uint32_t decode_size;
 };
 
 class WorkerEqualisationJobCommand : public WorkerJobCommand {
 public:
-	WorkerEqualisationJobCommand(std::string filename, EqualisationHistogramMapping histogramMapping);
+	WorkerEqualisationJobCommand(std::string filename, EqualisationHistogramMapping histogramMapping,
+	                             OutputEncoding outputEncoding = {});
 
 	void command_data(ProtocolJob::Data::Builder& dataBuilder) const override;
 	void visit(CommandVisitor& visitor) const override;
 
-	[[nodiscard]] std::string get_filename() const;
 	[[nodiscard]] EqualisationHistogramMapping get_histogram_mapping() const;
+	[[nodiscard]] const OutputEncoding& get_output_encoding() const;
 
 	static std::unique_ptr<WorkerEqualisationJobCommand> from_data(EqualisationJob::Reader reader);
 
-	bool operator==(const WorkerJobCommand& other) const override;
-	bool operator==(const WorkerResultCommand& other) const override;
-
 protected:
-	std::string filename;
 	EqualisationHistogramMapping histogramMapping;
+	OutputEncoding output_encoding;
+};
+
+class WorkerFusedJobCommand : public WorkerJobCommand {
+public:
+	// Without a previous histogram (for the first frame), the image is equalised with the identity
+	// mapping
+	WorkerFusedJobCommand(std::string filename, std::optional<Histogram> previousHistogram,
+	                      std::uint64_t sampleBudget = 0, OutputEncoding outputEncoding = {});
+
+	void command_data(ProtocolJob::Data::Builder& dataBuilder) const override;
+	void visit(CommandVisitor& visitor) const override;
+
+	[[nodiscard]] const std::optional<Histogram>& get_previous_histogram() const;
+	[[nodiscard]] std::uint64_t get_sample_budget() const;
+	[[nodiscard]] const OutputEncoding& get_output_encoding() const;
 
-	friend WorkerEqualisationResultCommand;
+	static std::unique_ptr<WorkerFusedJobCommand> from_data(FusedJob::Reader reader);
+
+protected:
+	std::optional<Histogram> previous_histogram;
+	std::uint64_t sample_budget;
+	OutputEncoding output_encoding;
 };
 
 class WorkerResultCommand : public WorkerCommand {
 public:
-	WorkerResultCommand(std::string resultType);
+	WorkerResultCommand(std::string resultType, std::uint64_t jobId);
 	~WorkerResultCommand() override = default;
 
 	void command_data(ProtocolCommand::Data::Builder& dataBuilder) const override;
@@ -153,63 +191,154 @@ public:
 	// Require child classes to be able to build the result component of command's data
 	virtual void command_data(ProtocolResult::Data::Builder& dataBuilder) const = 0;
 
-	static std::unique_ptr<WorkerResultCommand> from_data(ProtocolResult::Reader reader);
+	// `payload` is the image received alongside the result, if any
+	static std::unique_ptr<WorkerResultCommand>
+	from_data(ProtocolResult::Reader reader, std::optional<ImageData> payload = std::nullopt);
 
-	virtual bool operator==(const WorkerJobCommand& other) const;
-	virtual bool operator==(const WorkerResultCommand& other) const;
+	// The job the result is for
+	[[nodiscard]] std::uint64_t get_job_id() const;
 
 protected:
 	std::string result_type;
-
-	friend WorkerJobCommand;
+	std::uint64_t job_id;
 };
 
 class WorkerHistogramResultCommand : public WorkerResultCommand {
 public:
-	WorkerHistogramResultCommand(std::string filename, const Histogram& histogram);
+	WorkerHistogramResultCommand(std::uint64_t jobId, const Histogram& histogram,
+	                             double cdfErrorBound = 0.0);
 	~WorkerHistogramResultCommand() override = default;
 
 	void command_data(ProtocolResult::Data::Builder& dataBuilder) const override;
 	void visit(CommandVisitor& visitor) const override;
 
 	static std::unique_ptr<WorkerHistogramResultCommand>
-	from_data(HistogramResult::Reader histogramReader);
+	from_data(HistogramResult::Reader histogramReader, std::uint64_t jobId);
 
-	[[nodiscard]] std::string get_filename() const;
 	[[nodiscard]] Histogram get_histogram() const;
-
-	bool operator==(const WorkerJobCommand& jobCommand) const override;
-	bool operator==(const WorkerResultCommand& jobCommand) const override;
+	[[nodiscard]] double get_cdf_error_bound() const;
 
 protected:
-	std::string filename;
 	Histogram histogram;
-
-	friend WorkerHistogramJobCommand;
+	double cdf_error_bound;
 };
 
 class WorkerEqualisationResultCommand : public WorkerResultCommand {
 public:
-	WorkerEqualisationResultCommand(std::string filename, std::vector<std::uint8_t> tiffData);
+	WorkerEqualisationResultCommand(std::uint64_t jobId, std::optional<ImageData> tiffData);
 	~WorkerEqualisationResultCommand() override = default;
 
 	void command_data(ProtocolResult::Data::Builder& dataBuilder) const override;
 	void visit(CommandVisitor& visitor) const override;
 
 	static std::unique_ptr<WorkerEqualisationResultCommand>
-	from_data(EqualisationResult::Reader equalisationReader);
+	from_data(EqualisationResult::Reader equalisationReader, std::uint64_t jobId,
+	          std::optional<ImageData> payload = std::nullopt);
+
+	// Whether the image arrived with the result, without which the result failed
+	[[nodiscard]] bool has_tiff_data() const;
+	[[nodiscard]] const ImageData& get_tiff_data() const;
+	[[nodiscard]] const ImageData* image_payload() const override;
+
+protected:
+	std::optional<ImageData> tiff_data;
+};
+
+class WorkerFusedResultCommand : public WorkerResultCommand {
+public:
+	WorkerFusedResultCommand(std::uint64_t jobId, const Histogram& histogram, double cdfErrorBound,
+	                         std::optional<ImageData> tiffData);
+	~WorkerFusedResultCommand() override = default;
+
+	void command_data(ProtocolResult::Data::Builder& dataBuilder) const override;
+	void visit(CommandVisitor& visitor) const override;
 
-	[[nodiscard]] std::string get_filename() const;
-	[[nodiscard]] const std::vector<std::uint8_t>& get_tiff_data() const;
+	static std::unique_ptr<WorkerFusedResultCommand>
+	from_data(FusedResult::Reader fusedReader, std::uint64_t jobId,
+	          std::optional<ImageData> payload = std::nullopt);
 
-	bool operator==(const WorkerJobCommand& jobCommand) const override;
-	bool operator==(const WorkerResultCommand& jobCommand) const override;
+	[[nodiscard]] Histogram get_histogram() const;
+	[[nodiscard]] double get_cdf_error_bound() const;
+	// Whether the image arrived with the result, without which the result failed
+	[[nodiscard]] bool has_tiff_data() const;
+	[[nodiscard]] const ImageData& get_tiff_data() const;
+	[[nodiscard]] const ImageData* image_payload() const override;
 
 protected:
-	std::string filename;
-	std::vector<std::uint8_t> tiff_data;
+	Histogram histogram;
+	double cdf_error_bound;
+	std::optional<ImageData> tiff_data;
+};
+
+// Starts streaming an equalised image, or starts it again if it is already being streamed
+class WorkerStreamHeaderCommand : public WorkerResultCommand {
+public:
+	WorkerStreamHeaderCommand(std::uint64_t jobId);
+	~WorkerStreamHeaderCommand() override = default;
+
+	void command_data(ProtocolResult::Data::Builder& dataBuilder) const override;
+	void visit(CommandVisitor& visitor) const override;
+
+	static std::unique_ptr<WorkerStreamHeaderCommand> from_data(StreamHeader::Reader headerReader,
+	                                                            std::uint64_t jobId);
+};
+
+// The next part of a streamed image, sent in a frame following the chunk
+class WorkerStreamChunkCommand : public WorkerResultCommand {
+public:
+	WorkerStreamChunkCommand(std::uint64_t jobId, std::uint32_t sequence, ImageData chunkData);
+	~WorkerStreamChunkCommand() override = default;
+
+	void command_data(ProtocolResult::Data::Builder& dataBuilder) const override;
+	void visit(CommandVisitor& visitor) const override;
+
+	static std::unique_ptr<WorkerStreamChunkCommand>
+	from_data(StreamChunk::Reader chunkReader, std::uint64_t jobId,
+	          std::optional<ImageData> payload = std::nullopt);
+
+	[[nodiscard]] std::uint32_t get_sequence() const;
+	[[nodiscard]] const ImageData& get_chunk_data() const;
+	[[nodiscard]] const ImageData* image_payload() const override;
+
+protected:
+	std::uint32_t sequence;
+	ImageData chunk_data;
+};
+
+// Completes a streamed image, and with it the image's equalisation job
+class WorkerStreamTrailerCommand : public WorkerResultCommand {
+public:
+	WorkerStreamTrailerCommand(std::uint64_t jobId, std::uint32_t chunkCount, std::uint64_t size,
+	                           std::uint64_t checksum);
+	~WorkerStreamTrailerCommand() override = default;
+
+	void command_data(ProtocolResult::Data::Builder& dataBuilder) const override;
+	void visit(CommandVisitor& visitor) const override;
+
+	static std::unique_ptr<WorkerStreamTrailerCommand> from_data(StreamTrailer::Reader trailerReader,
+	                                                             std::uint64_t jobId);
+
+	[[nodiscard]] std::uint32_t get_chunk_count() const;
+	[[nodiscard]] std::uint64_t get_size() const;
+	[[nodiscard]] std::uint64_t get_checksum() const;
+
+protected:
+	std::uint32_t chunk_count;
+	std::uint64_t size;
+	std::uint64_t checksum;
+};
+
+// Declines a job whose path was sent by an ID the worker does not know, for the server to send
+// again with its path in full
+class WorkerUnknownPathCommand : public WorkerResultCommand {
+public:
+	WorkerUnknownPathCommand(std::uint64_t jobId);
+	~WorkerUnknownPathCommand() override = default;
+
+	void command_data(ProtocolResult::Data::Builder& dataBuilder) const override;
+	void visit(CommandVisitor& visitor) const override;
 
-	friend WorkerEqualisationJobCommand;
+	static std::unique_ptr<WorkerUnknownPathCommand> from_data(std::uint64_t jobId);
 };
 
 class WorkerHeartbeatCommand : public WorkerCommand {
@@ -247,8 +376,14 @@ public:
 	virtual void visit_ehlo(const WorkerEhloCommand& ehloCommand);
 	virtual void visit_histogram_job(const WorkerHistogramJobCommand& jobCommand);
 	virtual void visit_equalisation_job(const WorkerEqualisationJobCommand& jobCommand);
+	virtual void visit_fused_job(const WorkerFusedJobCommand& jobCommand);
 	virtual void visit_histogram_result(const WorkerHistogramResultCommand& resultCommand);
 	virtual void visit_equalisation_result(const WorkerEqualisationResultCommand& resultCommand);
+	virtual void visit_fused_result(const WorkerFusedResultCommand& resultCommand);
+	virtual void visit_stream_header(const WorkerStreamHeaderCommand& headerCommand);
+	virtual void visit_stream_chunk(const WorkerStreamChunkCommand& chunkCommand);
+	virtual void visit_stream_trailer(const WorkerStreamTrailerCommand& trailerCommand);
+	virtual void visit_unknown_path(const WorkerUnknownPathCommand& unknownPathCommand);
 	virtual void visit_heartbeat(const WorkerHeartbeatCommand& heartbeatCommand);
 	virtual void visit_bye(const WorkerByeCommand& byeCommand);
 };
@@ -0,0 +1,132 @@
+#include "record_file.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+RecordFile::RecordFile(std::filesystem::path path, std::string description,
+                       const char (&magic)[8], const std::uint32_t version,
+                       const std::size_t recordSize)
+    : path{ std::move(path) }, description{ std::move(description) }, header{}, file{ -1 },
+      mapping{ nullptr }, mappingSize{ 0 }, records{ nullptr }, recordCount{ 0 } {
+	std::memcpy(header.magic, magic, sizeof(header.magic));
+	header.version = version;
+	header.record_size = static_cast<std::uint32_t>(recordSize);
+
+	file = ::open(this->path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+	if (file < 0) {
+		this->log_error("open");
+		return;
+	}
+
+	struct stat fileStat {};
+	Header fileHeader{};
+
+	if (::fstat(file, &fileStat) != 0 ||
+	    static_cast<std::size_t>(fileStat.st_size) < sizeof(Header) ||
+	    ::pread(file, &fileHeader, sizeof(fileHeader), 0) != sizeof(fileHeader) ||
+	    std::memcmp(&fileHeader, &header, sizeof(Header)) != 0) {
+		if (!this->reset()) {
+			this->close();
+		}
+
+		return;
+	}
+
+	// Drop any partial record left by an interrupted write, so that appended records stay aligned
+	recordCount = (static_cast<std::size_t>(fileStat.st_size) - sizeof(Header)) / recordSize;
+	mappingSize = sizeof(Header) + recordCount * recordSize;
+
+	if (static_cast<std::size_t>(fileStat.st_size) != mappingSize &&
+	    ::ftruncate(file, static_cast<off_t>(mappingSize)) != 0) {
+		this->log_error("truncate");
+		this->close();
+		recordCount = 0;
+		return;
+	}
+
+	if (recordCount == 0) {
+		return;
+	}
+
+	mapping = ::mmap(nullptr, mappingSize, PROT_READ, MAP_SHARED, file, 0);
+
+	if (mapping == MAP_FAILED) {
+		this->log_error("map");
+		mapping = nullptr;
+		recordCount = 0;
+		return;
+	}
+
+	records = static_cast<const char*>(mapping) + sizeof(Header);
+}
+
+RecordFile::~RecordFile() {
+	if (mapping != nullptr) {
+		::munmap(mapping, mappingSize);
+	}
+
+	this->close();
+}
+
+bool RecordFile::is_open() const {
+	return file >= 0;
+}
+
+std::size_t RecordFile::record_count() const {
+	return recordCount;
+}
+
+const void* RecordFile::record(const std::size_t index) const {
+	return records + index * header.record_size;
+}
+
+void RecordFile::append(const void* record) {
+	if (file < 0) {
+		return;
+	}
+
+	const ssize_t written = ::write(file, record, header.record_size);
+
+	if (written == static_cast<ssize_t>(header.record_size)) {
+		return;
+	}
+
+	this->log_error("write to");
+
+	// Remove the partial record, rather than misalign every record after it
+	struct stat fileStat {};
+
+	if (written > 0 && (::fstat(file, &fileStat) != 0 ||
+	                    ::ftruncate(file, fileStat.st_size - written) != 0)) {
+		this->close();
+	}
+}
+
+bool RecordFile::reset() {
+	if (::ftruncate(file, 0) != 0 ||
+	    ::write(file, &header, sizeof(header)) != static_cast<ssize_t>(sizeof(header))) {
+		this->log_error("create");
+		return false;
+	}
+
+	return true;
+}
+
+void RecordFile::close() {
+	if (file >= 0) {
+		::close(file);
+		file = -1;
+	}
+}
+
+void RecordFile::log_error(const std::string& action) const {
+	std::clog << "Unable to " << action << " " << description << " '" << path.string()
+	          << "': " << std::strerror(errno) << "\n";
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+/**
+ * @brief A file of fixed-size records following a short header, memory mapped when opened.
+ *
+ * Records are only ever appended. The records present when the file was opened are read through
+ * the mapping, and records appended afterwards are read by files opened later. Files with a
+ * different magic, version or record size are replaced with empty ones, as is the partial record
+ * left by an interrupted write.
+ */
+class RecordFile {
+public:
+	// `description` names the file in log messages
+	RecordFile(std::filesystem::path path, std::string description, const char (&magic)[8],
+	           std::uint32_t version, std::size_t recordSize);
+	RecordFile(const RecordFile& other) = delete;
+	RecordFile& operator=(const RecordFile& other) = delete;
+	~RecordFile();
+
+	// Whether the file could be opened. A file that could not be opened has no records, and ignores
+	// those appended.
+	[[nodiscard]] bool is_open() const;
+
+	// The number of records present when the file was opened
+	[[nodiscard]] std::size_t record_count() const;
+	[[nodiscard]] const void* record(std::size_t index) const;
+
+	void append(const void* record);
+
+protected:
+	struct Header {
+		char magic[8];
+		std::uint32_t version;
+		std::uint32_t record_size;
+	};
+
+	// Replaces the file with an empty one
+	bool reset();
+	void close();
+	void log_error(const std::string& action) const;
+
+	const std::filesystem::path path;
+	const std::string description;
+	Header header;
+	int file;
+
+	void* mapping;
+	std::size_t mappingSize;
+	const char* records;
+	std::size_t recordCount;
+};
@@ -0,0 +1,83 @@
+#include "result_stream.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <utility>
+
+#include "config.hpp"
+#include "file_identity.hpp"
+
+OutgoingResultStream::OutgoingResultStream(const ServerConnection& connection,
+                                           const std::uint64_t jobId)
+    : connection{ connection }, jobId{ jobId }, nextSequence{ 0 }, size{ 0 },
+      checksum{ FNV_OFFSET_BASIS } {
+	this->connection.send_work_message(WorkerStreamHeaderCommand{ this->jobId }.to_message());
+}
+
+void OutgoingResultStream::write(const ImageData& piece) {
+	for (std::size_t offset = 0; offset < piece.size(); offset += RESULT_CHUNK_SIZE) {
+		const ImageData chunk =
+		    piece.slice(offset, std::min<std::size_t>(piece.size() - offset, RESULT_CHUNK_SIZE));
+
+		checksum = hash_bytes(chunk.data(), chunk.size(), checksum);
+		size += chunk.size();
+
+		connection.send_work_message(
+		    WorkerStreamChunkCommand{ jobId, nextSequence++, chunk }.to_message());
+	}
+}
+
+void OutgoingResultStream::restart() {
+	if (nextSequence == 0) {
+		return;
+	}
+
+	nextSequence = 0;
+	size = 0;
+	checksum = FNV_OFFSET_BASIS;
+
+	connection.send_work_message(WorkerStreamHeaderCommand{ jobId }.to_message());
+}
+
+void OutgoingResultStream::finish() {
+	connection.send_work_message(
+	    WorkerStreamTrailerCommand{ jobId, nextSequence, size, checksum }.to_message());
+}
+
+IncomingResultStream::IncomingResultStream(const bool gather)
+    : gather{ gather }, gathered{}, nextSequence{ 0 }, size{ 0 }, checksum{ FNV_OFFSET_BASIS },
+      intact{ true } {}
+
+bool IncomingResultStream::append(const std::uint32_t sequence, const ImageData& chunk) {
+	if (!intact) {
+		return false;
+	}
+
+	if (sequence != nextSequence) {
+		std::clog << "Received chunk " << sequence << " of an equalised image, expecting chunk "
+		          << nextSequence << "\n";
+		intact = false;
+		return false;
+	}
+
+	nextSequence++;
+	size += chunk.size();
+	checksum = hash_bytes(chunk.data(), chunk.size(), checksum);
+
+	if (gather) {
+		gathered.insert(gathered.end(), chunk.begin(), chunk.end());
+	}
+
+	return true;
+}
+
+bool IncomingResultStream::finish(const WorkerStreamTrailerCommand& trailerCommand) {
+	intact = intact && nextSequence == trailerCommand.get_chunk_count() &&
+	         size == trailerCommand.get_size() && checksum == trailerCommand.get_checksum();
+
+	return intact;
+}
+
+ImageData IncomingResultStream::take_image() {
+	return ImageData{ std::move(gathered) };
+}
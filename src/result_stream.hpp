@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "algorithm.hpp"
+#include "image_data.hpp"
+#include "protocol.hpp"
+#include "worker.hpp"
+
+/**
+ * @brief Streams an equalised image back to the server as it is encoded.
+ *
+ * The image is sent as a header, chunks of up to RESULT_CHUNK_SIZE numbered from zero, and a
+ * trailer with the image's size and checksum. Chunks share the encoder's bytes, rather than copying
+ * them.
+ */
+class OutgoingResultStream : public ImageSink {
+public:
+	// Sends the header at once
+	OutgoingResultStream(const ServerConnection& connection, std::uint64_t jobId);
+
+	void write(const ImageData& piece) override;
+	void restart() override;
+
+	// Sends the trailer, once the whole image has been written
+	void finish();
+
+protected:
+	const ServerConnection& connection;
+	const std::uint64_t jobId;
+	std::uint32_t nextSequence;
+	std::uint64_t size;
+	std::uint64_t checksum;
+};
+
+/**
+ * @brief An equalised image being received from a worker, a chunk at a time.
+ *
+ * Chunks are checked as they arrive, and handed on to be written so no more than one is held at a
+ * time. Images that are needed whole, such as those for the frame stream, are instead gathered.
+ */
+class IncomingResultStream {
+public:
+	explicit IncomingResultStream(bool gather);
+
+	// Adds the next chunk, which must follow the last, returning whether it did
+	[[nodiscard]] bool append(std::uint32_t sequence, const ImageData& chunk);
+
+	// Whether every chunk arrived, in order, as the trailer describes
+	[[nodiscard]] bool finish(const WorkerStreamTrailerCommand& trailerCommand);
+
+	// The gathered image, once finished
+	[[nodiscard]] ImageData take_image();
+
+protected:
+	const bool gather;
+	std::vector<std::uint8_t> gathered;
+	std::uint32_t nextSequence;
+	std::uint64_t size;
+	std::uint64_t checksum;
+	bool intact;
+};
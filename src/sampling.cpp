@@ -0,0 +1,108 @@
+#include "sampling.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+// Fractional part of the golden ratio, which spreads successive row offsets most evenly
+const constexpr double GOLDEN_RATIO_FRACTION = 0.6180339887498949;
+
+SampleGrid SampleGrid::for_budget(const std::size_t columns, const std::size_t rows,
+                                  const std::uint64_t sampleBudget) {
+	const double pixelCount = static_cast<double>(columns) * rows;
+
+	if (sampleBudget == 0 || sampleBudget >= pixelCount) {
+		return SampleGrid{ columns, rows, 1, 1 };
+	}
+
+	// Use the same stride in both directions, rounding down to sample at least the budget. Strides
+	// are capped to the image so that degenerate (single row or column) images are still sampled.
+	const auto stride =
+	    std::max<std::size_t>(1, static_cast<std::size_t>(std::sqrt(pixelCount / sampleBudget)));
+
+	return SampleGrid{ columns, rows, std::min(stride, rows), std::min(stride, columns) };
+}
+
+bool SampleGrid::samples_every_pixel() const {
+	return row_stride == 1 && column_stride == 1;
+}
+
+std::size_t SampleGrid::first_row() const {
+	return row_stride / 2;
+}
+
+std::size_t SampleGrid::sampled_rows() const {
+	if (this->first_row() >= rows) {
+		return 0;
+	}
+
+	return (rows - this->first_row() - 1) / row_stride + 1;
+}
+
+std::size_t SampleGrid::sampled_row(const std::size_t index) const {
+	return this->first_row() + index * row_stride;
+}
+
+std::size_t SampleGrid::sampled_index_from(const std::size_t row) const {
+	if (row <= this->first_row()) {
+		return 0;
+	}
+
+	return std::min((row - this->first_row() + row_stride - 1) / row_stride, this->sampled_rows());
+}
+
+std::size_t SampleGrid::column_offset(const std::size_t row) const {
+	const double sequence = static_cast<double>(row / row_stride) * GOLDEN_RATIO_FRACTION;
+
+	return static_cast<std::size_t>((sequence - std::floor(sequence)) * column_stride);
+}
+
+std::size_t SampleGrid::columns_in_row(const std::size_t row) const {
+	const std::size_t offset = this->column_offset(row);
+
+	if (offset >= columns) {
+		return 0;
+	}
+
+	return (columns - offset + column_stride - 1) / column_stride;
+}
+
+const Magick::Quantum* SampleGrid::gather_row(const Magick::Quantum* rowPixels,
+                                              const std::size_t row, const std::size_t channels,
+                                              std::vector<Magick::Quantum>& buffer) const {
+	if (column_stride == 1) {
+		return rowPixels;
+	}
+
+	const std::size_t sampleCount = this->columns_in_row(row);
+	const Magick::Quantum* column = rowPixels + this->column_offset(row) * channels;
+	buffer.resize(sampleCount * channels);
+
+	for (std::size_t sample = 0; sample < sampleCount; sample++, column += column_stride * channels) {
+		std::copy(column, column + channels, buffer.data() + sample * channels);
+	}
+
+	return buffer.data();
+}
+
+double histogram_cdf_error_bound(const std::uint64_t sampleCount) {
+	if (sampleCount == 0) {
+		return 1.0;
+	}
+
+	return std::sqrt(std::log(2.0 / (1.0 - HISTOGRAM_CDF_CONFIDENCE)) /
+	                 (2.0 * static_cast<double>(sampleCount)));
+}
+
+double histogram_cdf_distance(const Histogram& histogram, const Histogram& otherHistogram) {
+	double cumulative = 0.0;
+	double otherCumulative = 0.0;
+	double distance = 0.0;
+
+	for (std::size_t i = 0; i < HISTOGRAM_SEGMENTS; i++) {
+		cumulative += histogram[i];
+		otherCumulative += otherHistogram[i];
+		distance = std::max(distance, std::abs(cumulative - otherCumulative));
+	}
+
+	return distance;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <Magick++.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "algorithm.hpp"
+
+// Pixels sampled from a `columns` x `rows` image when estimating its histogram.
+//
+// Every `row_stride`th row is sampled and, within each sampled row, every `column_stride`th column
+// from a per-row offset. The offsets follow the golden ratio (R1) low discrepancy sequence, so
+// sampled columns do not line up from row to row, giving an even, blue noise like coverage of the
+// frame that does not alias with periodic image content.
+struct SampleGrid {
+	std::size_t columns;
+	std::size_t rows;
+	std::size_t row_stride;
+	std::size_t column_stride;
+
+	// Strides sampling at least `sampleBudget` pixels. A budget of zero, or one at least as large as
+	// the image, samples every pixel.
+	static SampleGrid for_budget(std::size_t columns, std::size_t rows, std::uint64_t sampleBudget);
+
+	[[nodiscard]] bool samples_every_pixel() const;
+	[[nodiscard]] std::size_t first_row() const;
+	[[nodiscard]] std::size_t sampled_rows() const;
+	[[nodiscard]] std::size_t sampled_row(std::size_t index) const;
+	// Index of the first sampled row at or after `row`
+	[[nodiscard]] std::size_t sampled_index_from(std::size_t row) const;
+	[[nodiscard]] std::size_t column_offset(std::size_t row) const;
+	[[nodiscard]] std::size_t columns_in_row(std::size_t row) const;
+
+	// Returns the sampled pixels of `row`, contiguous, either in place or gathered into `buffer`
+	const Magick::Quantum* gather_row(const Magick::Quantum* rowPixels, std::size_t row,
+	                                  std::size_t channels,
+	                                  std::vector<Magick::Quantum>& buffer) const;
+};
+
+/**
+ * @brief Bound on the difference between the cumulative distributions of a sampled histogram and
+ * the full histogram of the image it was sampled from.
+ *
+ * Uses the Dvoretzky-Kiefer-Wolfowitz inequality, which holds with HISTOGRAM_CDF_CONFIDENCE
+ * probability for independent samples. Stratified sampling only ever does better, so this is
+ * conservative.
+ *
+ * @param sampleCount The number of pixels sampled
+ * @return The bound, as a proportion of all pixels
+ */
+double histogram_cdf_error_bound(std::uint64_t sampleCount);
+
+// Largest difference between the cumulative distributions of two proportional histograms (the
+// Kolmogorov-Smirnov distance).
+double histogram_cdf_distance(const Histogram& histogram, const Histogram& otherHistogram);
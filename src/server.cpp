@@ -3,225 +3,1236 @@
 #include <algorithm>
 #include <array>
 #include <cassert>
+#include <csignal>
 #include <cxxabi.h>
 #include <exception>
-#include <fstream>
-#include <future>
 #include <iterator>
+#include <set>
 #include <system_error>
 #include <utility>
 #include <zmqpp/message.hpp>
+#include <zmqpp/poller.hpp>
 #include <zmqpp/socket_options.hpp>
 #include <zmqpp/socket_types.hpp>
 
 #include "config.hpp"
+#include "directory_scan.hpp"
+#include "directory_watch.hpp"
 #include "protocol.hpp"
+#include "thread_pool.hpp"
 
 namespace zmqpp {
 	class context;
 } // namespace zmqpp
 
-Server::Server(zmqpp::context& context)
-    : work_socket{ context, zmqpp::socket_type::router },
-      communication_socket{ context, zmqpp::socket_type::router }, communication_service_running{
-	      false
-      } {
+// Where the equalised image of a frame is written, alongside it
+static std::string equalised_image_path(const std::string& filename, const OutputCodec codec) {
+	return filename + output_extension(codec);
+}
+
+// The frame `filename` would be the equalised image of, with any codec, if it is named like one.
+// Suffixes match case-sensitively, as only the lower case names images are written under are
+// outputs. A camera's `IMG_0001.JPG` is a frame of its own.
+static std::optional<std::string> equalised_image_frame(const std::string& filename) {
+	for (const OutputCodec codec : OUTPUT_CODECS) {
+		const std::string suffix = output_extension(codec);
+
+		if (filename.size() > suffix.size() &&
+		    filename.compare(filename.size() - suffix.size(), suffix.size(), suffix) == 0) {
+			return filename.substr(0, filename.size() - suffix.size());
+		}
+	}
+
+	return std::nullopt;
+}
+
+// Whether `filename` is the equalised image of one of `frames`
+static bool is_equalised_image(const std::string& filename, const std::set<std::string>& frames) {
+	const std::optional<std::string> frame = equalised_image_frame(filename);
+
+	return frame && frames.count(*frame) != 0;
+}
+
+// Whether `filename` is the equalised image of a frame on disk. Unlike `is_equalised_image`, this
+// is known as soon as the file is scanned, rather than once every frame is.
+static bool is_equalised_image_on_disk(const std::string& filename, const FrameFilter& filter) {
+	const std::optional<std::string> frame = equalised_image_frame(filename);
+	std::error_code error{};
+
+	return frame && filter.accepts(std::filesystem::path{ *frame }) &&
+	       std::filesystem::is_regular_file(std::filesystem::path{ *frame }, error);
+}
+
+// Set once a watched run is interrupted, to finish it as a normal run would be
+static volatile std::sig_atomic_t watch_interrupted = 0;
+
+static void interrupt_watch(int) {
+	watch_interrupted = 1;
+}
+
+Server::Server(zmqpp::context& context, ServerOptions options)
+    : options{ options }, work_socket{ context, zmqpp::socket_type::router },
+      communication_socket{ context, zmqpp::socket_type::router },
+      next_job_id{ 1 }, next_heartbeat_check{}, histogram_cdf_error_bound{ 0.0 },
+      next_target_frame{ 0 }, scanning_frames{ false }, reused_output_count{ 0 },
+      next_histogram_frame{ 0 }, window_frame_count{ 0 }, restored_histogram_count{ 0 },
+      output_bytes{ 0 }, output_count{ 0 },
+      output_writer{ OUTPUT_WRITE_THREADS, options.output_write_budget },
+      dispatch_throttled{ false }, throttle_count{ 0 } {
 	work_socket.bind("tcp://*:" + std::to_string(WORK_PORT));
 	work_socket.set(zmqpp::socket_option::router_mandatory, true);
 	work_socket.set(zmqpp::socket_option::immediate, true);
-	work_socket.set(
-	    zmqpp::socket_option::receive_timeout,
-	    static_cast<int>(
-	        std::chrono::duration_cast<std::chrono::milliseconds>(MAX_HEARTBEAT_INTERVAL).count()));
 
 	communication_socket.bind("tcp://*:" + std::to_string(COMMUNICATION_PORT));
 	communication_socket.set(zmqpp::socket_option::router_mandatory, true);
 	communication_socket.set(zmqpp::socket_option::immediate, true);
-	communication_socket.set(
-	    zmqpp::socket_option::receive_timeout,
-	    static_cast<int>(
-	        std::chrono::duration_cast<std::chrono::milliseconds>(MAX_HEARTBEAT_INTERVAL).count()));
 
 	assert(work_socket);
 }
 
-/* Cannot be run on multiple threads! */
+/* Cannot be run on multiple threads! Every socket and all state is owned by the calling thread. */
 void Server::serve_work(const std::filesystem::path& servePath) {
 	assert(std::filesystem::exists(servePath));
 	assert(std::filesystem::is_directory(servePath));
 
-	for (const auto& file : std::filesystem::directory_iterator{ servePath }) {
-		if (!std::filesystem::is_regular_file(file)) {
-			continue;
+	if (!options.fused_jobs) {
+		if (!options.stream_path.empty()) {
+			this->open_frame_stream();
 		}
 
-		enqueued_work.push(std::make_unique<WorkerHistogramJobCommand>(file.path()));
-	}
+		// Every frame is written to a frame stream, so none can be reused
+		if (options.reuse_outputs && !frame_stream) {
+			output_manifest = std::make_unique<OutputManifest>(servePath / OUTPUT_MANIFEST_FILENAME);
+		}
 
-	const size_t jobCount = enqueued_work.size();
+		if (options.store_histograms) {
+			this->open_histogram_store(servePath);
+		}
+	}
 
-#if DEBUG_SERVICE_DISCOVERY
-	std::clog << "Serving histogram jobs for " << jobCount << " files.\n";
-#endif
+	// Histogram jobs can be dispatched while the directory is still being scanned, unless they have
+	// to be dispatched in frame order, which is only known once the scan is complete
+	const bool dispatchWhileScanning =
+	    !options.fused_jobs && options.histogram_window == 0 && !frame_stream;
+	std::vector<std::string> frames = this->scan_frames(servePath, dispatchWhileScanning);
 
-	this->communication_service_running = true;
-	std::future<void> communicationServiceJob =
-	    std::async(std::launch::async, &Server::run_communication_service, this);
+	// Frames are equalised against one another in filename order
+	std::sort(frames.begin(), frames.end());
 
-	std::future<std::map<std::string, Histogram>> receiveHistogramsWorkJob =
-	    std::async(std::launch::async, &Server::receive_histograms, this, jobCount);
+	const size_t jobCount = frames.size();
+	this->track_frames(frames);
 
-	const auto histograms = receiveHistogramsWorkJob.get();
+	if (options.fused_jobs) {
+		if (options.smoothing_window > 1) {
+			std::clog << "Temporal smoothing is not applied to fused jobs, which equalise each frame to "
+			             "the frame before it\n";
+		}
 
-	assert(enqueued_work.empty());
+		this->start_fused_chain();
+	} else {
+		if (histogram_store || output_manifest) {
+			this->identify_frames();
+		}
 
-	auto prevHistogramPointer = histograms.begin();
-	auto currHistogramPointer = std::next(prevHistogramPointer);
+		this->record_scanned_histograms();
+		this->feed_histogram_work();
+	}
 
 #if DEBUG_SERVICE_DISCOVERY
-	std::clog << "Calculating brightness variations over " << histograms.size() << " histograms.\n";
+	std::clog << "Serving " << (options.fused_jobs ? "fused" : "histogram") << " jobs for "
+	          << jobCount << " files.\n";
 #endif
 
-	enqueued_work.push(std::make_unique<WorkerEqualisationJobCommand>(
-	    prevHistogramPointer->first, identity_equalisation_histogram_mapping()));
+	const auto serveStart = std::chrono::steady_clock::now();
 
-	while (currHistogramPointer != histograms.end()) {
-		const auto eqParams =
-		    get_equalisation_parameters(prevHistogramPointer->second, currHistogramPointer->second);
-		const auto currFilename = currHistogramPointer->first;
-		enqueued_work.push(std::make_unique<WorkerEqualisationJobCommand>(currFilename, eqParams));
+	if (options.fused_jobs) {
+		this->serve_fused_work(jobCount);
+	} else {
+		this->serve_overlapped_work(jobCount);
 
-		prevHistogramPointer = currHistogramPointer;
-		currHistogramPointer++;
+		if (options.watch_directory) {
+			this->watch_frames(servePath);
+		}
 	}
 
-	std::clog << "Equalising brightness\n";
+	// Every image is on disk, and recorded in the output manifest, before the run is reported
+	output_writer.drain();
+	this->complete_output_writes();
 
-	assert(enqueued_work.size() == jobCount);
+	this->report_output_statistics(std::chrono::steady_clock::now() - serveStart);
+	output_writer.report_statistics();
 
-	const std::future<void> receiveImagesWorkJob =
-	    std::async(std::launch::async, &Server::receive_equalised, this, jobCount);
+	if (throttle_count != 0) {
+		std::clog << "Held back dispatch " << throttle_count
+		          << " times while writing images to disk fell behind\n";
+	}
 
-	receiveImagesWorkJob.wait();
+	if (frame_stream) {
+		frame_stream->drain();
+		std::clog << "Streamed " << frame_stream->next_frame() << " frames, holding at most "
+		          << frame_stream->peak_buffered_count() << " out of order\n";
+		frame_stream.reset();
+	}
 
+	this->report_frame_memory();
 	this->dismiss_workers();
-	this->communication_service_running = false;
-	communicationServiceJob.wait();
 }
 
-void Server::run_communication_service() {
-	while (communication_service_running) {
-		zmqpp::message message{};
+std::vector<std::string> Server::scan_frames(const std::filesystem::path& servePath,
+                                             const bool dispatch) {
+	DirectoryScan scan{ servePath, options.frame_filter, options.recursive };
+	std::vector<std::string> frames{};
+	size_t equalisedCount = 0;
 
-		while (communication_socket.receive(message)) {
-			std::string identity = message.get(0);
+	scanning_frames = dispatch;
 
-			{
-				std::unique_lock<std::recursive_mutex> workerLock{ worker_mutex };
+	while (std::optional<std::vector<std::string>> batch = scan.next_batch(SCAN_POLL_INTERVAL)) {
+		std::vector<std::string> batchFrames{};
 
-				ServerCommunicationVisitor communicationVisitor{ *this, identity };
+		for (auto& file : *batch) {
+			const std::filesystem::path filename = std::filesystem::path{ file }.filename();
 
-				try {
-					std::unique_ptr<WorkerCommand> command =
-					    WorkerCommand::from_serialised_string(message.get(1));
-					command->visit(communicationVisitor);
-				} catch (const std::exception& e) {
-					std::clog << e.what() << "\n";
-					throw e;
-				}
+			// Images written by earlier runs are not frames themselves
+			if (filename == HISTOGRAM_STORE_FILENAME || filename == OUTPUT_MANIFEST_FILENAME ||
+			    is_equalised_image_on_disk(file, options.frame_filter)) {
+				continue;
 			}
+
+			batchFrames.push_back(std::move(file));
+		}
+
+		if (dispatch) {
+			this->dispatch_scanned_frames(batchFrames);
+			this->react(equalisedCount, std::chrono::milliseconds{ 0 });
 		}
+
+		std::move(batchFrames.begin(), batchFrames.end(), std::back_inserter(frames));
 	}
+
+	return frames;
 }
 
-void Server::transmit_work(const std::string& worker) {
-	std::unique_lock<std::recursive_mutex> workLock{ work_mutex };
-	std::unique_lock<std::recursive_mutex> workerLock{ worker_mutex };
+void Server::serve_overlapped_work(const size_t jobCount) {
+	std::clog << "Computing histograms, and equalising brightness as they arrive\n";
+
+	this->receive_overlapped(jobCount);
+
+	if (histogram_store) {
+		std::clog << "Restored " << restored_histogram_count << " of " << frame_paths.size()
+		          << " histograms from earlier runs\n";
+	}
+
+	if (reused_output_count != 0) {
+		std::clog << "Reused " << reused_output_count << " images from earlier runs\n";
+	}
+
+	if (options.histogram_sample_budget != 0) {
+		std::clog << "Sampled " << options.histogram_sample_budget
+		          << " pixels per histogram, with a worst estimated CDF error of "
+		          << histogram_cdf_error_bound << "\n";
+	}
+}
+
+void Server::serve_fused_work(const size_t jobCount) {
+	std::clog << "Computing histograms and equalising brightness in a single pass\n";
 
+	this->receive_fused(jobCount);
+
+	if (options.histogram_sample_budget != 0) {
+		std::clog << "Sampled " << options.histogram_sample_budget
+		          << " pixels per histogram, with a worst estimated CDF error of "
+		          << histogram_cdf_error_bound << "\n";
+	}
+}
+
+void Server::transmit_work(const std::string& worker) {
 	// Require worker to have a queue already
 	assert(worker_queues.find(worker) != worker_queues.end());
 
-	// Only add more work if under threshold
-	while (worker_queues.at(worker).work.size() < worker_queues.at(worker).concurrency &&
-	       !enqueued_work.empty()) {
-		WorkPtr workItem = std::move(enqueued_work.front());
-		zmqpp::message message{};
+	// Workers wait for the disk to catch up, rather than the server queueing their images without
+	// bound. Dispatch resumes as writes complete, see `complete_output_writes`.
+	if (output_writer.over_budget()) {
+		if (!dispatch_throttled) {
+			dispatch_throttled = true;
+			throttle_count++;
+		}
+
+		return;
+	}
+
+	std::vector<QueuedWork> queuedWork{};
+
+	// Only add more work if under threshold. Rather than leave the worker idle, start another chain
+	// of fused jobs if there is one to start.
+	while (worker_queues.at(worker).job_count + queuedWork.size() <
+	           worker_queues.at(worker).concurrency &&
+	       (this->work_pending() || (options.fused_jobs && this->split_fused_chain()))) {
+		queuedWork.push_back(this->next_work(worker));
+	}
+
+	for (WorkPtr& workItem : this->materialise_work(std::move(queuedWork))) {
+		this->dispatch_job(worker, std::move(workItem));
+	}
+}
 
-		workItem->add_to_message(message);
+void Server::dispatch_job(const std::string& worker, WorkPtr job) {
+	WorkerData& workerData = worker_queues.at(worker);
+	const auto [path, newPath] =
+	    workerData.path_ids.try_emplace(job->get_filename(), workerData.next_path_id);
+	const std::uint64_t jobId = next_job_id++;
+
+	if (newPath) {
+		workerData.next_path_id++;
+	}
+
+	job->set_job_id(jobId);
+	job->set_path_id(path->second, newPath);
+
+	zmqpp::message message{};
+
+	job->add_to_message(message);
+	send_work_message(worker, std::move(message));
+
+	workerData.job_count++;
+	in_flight_jobs.emplace(jobId, InFlightJob{ worker, std::move(job) });
+}
+
+WorkPtr Server::take_in_flight_job(const std::string& worker, const std::uint64_t jobId) {
+	const auto inFlight = in_flight_jobs.find(jobId);
+
+	if (inFlight == in_flight_jobs.end() || inFlight->second.worker != worker) {
+		return nullptr;
+	}
+
+	WorkPtr job = std::move(inFlight->second.job);
+	in_flight_jobs.erase(inFlight);
+
+	if (const auto workerData = worker_queues.find(worker); workerData != worker_queues.end()) {
+		workerData->second.job_count--;
+	}
+
+	return job;
+}
+
+const WorkerJobCommand* Server::in_flight_job(const std::string& worker,
+                                              const std::uint64_t jobId) const {
+	const auto inFlight = in_flight_jobs.find(jobId);
+
+	if (inFlight == in_flight_jobs.end() || inFlight->second.worker != worker) {
+		return nullptr;
+	}
+
+	return inFlight->second.job.get();
+}
+
+void Server::release_in_flight_jobs(const std::string& worker) {
+	for (auto inFlight = in_flight_jobs.begin(); inFlight != in_flight_jobs.end();) {
+		if (inFlight->second.worker != worker) {
+			++inFlight;
+			continue;
+		}
+
+		// Any image being streamed back is begun again when the job is next dispatched
+		incoming_results.erase(inFlight->first);
+		enqueued_work.push(std::move(inFlight->second.job));
+		inFlight = in_flight_jobs.erase(inFlight);
+	}
+}
+
+void Server::enqueue_affine_work(QueuedWork work) {
+	std::string filename{};
+
+	if (const auto* job = std::get_if<WorkPtr>(&work)) {
+		filename = (*job)->get_filename();
+	} else {
+		filename = frame_paths[std::get<PendingEqualisation>(work).frame];
+	}
+
+	const auto holder = image_holders.find(filename);
+
+	if (holder != image_holders.end() && worker_queues.find(holder->second) != worker_queues.end()) {
+		affine_work[holder->second].push_back(std::move(work));
+	} else {
+		enqueued_work.push(std::move(work));
+	}
+
+	// The holder is only needed to queue the image's job
+	if (holder != image_holders.end()) {
+		image_holders.erase(holder);
+	}
+}
+
+QueuedWork Server::next_work(const std::string& worker) {
+	QueuedWork workItem{};
+
+	if (const auto affine = affine_work.find(worker);
+	    affine != affine_work.end() && !affine->second.empty()) {
+		workItem = std::move(affine->second.front());
+		affine->second.pop_front();
+	} else if (!enqueued_work.empty()) {
+		workItem = std::move(enqueued_work.front());
 		enqueued_work.pop();
-		send_work_message(worker, std::move(message));
-		worker_queues.at(worker).work.push_back(std::move(workItem));
+	} else {
+		// Rather than leave this worker idle, take from the back of the longest affine queue, which its
+		// worker would reach last
+		const auto longest =
+		    std::max_element(affine_work.begin(), affine_work.end(), [](const auto& a, const auto& b) {
+			    return a.second.size() < b.second.size();
+		    });
+
+		assert(longest != affine_work.end() && !longest->second.empty());
+		workItem = std::move(longest->second.back());
+		longest->second.pop_back();
 	}
+
+	return workItem;
 }
 
-std::map<std::string, Histogram> Server::receive_histograms(size_t totalWorkSamples) {
-	std::map<std::string, Histogram> workResults{};
+std::vector<WorkPtr> Server::materialise_work(std::vector<QueuedWork> work) {
+	std::vector<WorkPtr> jobs(work.size());
 
-	while (workResults.size() < totalWorkSamples) {
-		zmqpp::message message{};
+	ThreadPool::shared().parallel_for(work.size(), [this, &work, &jobs](const std::size_t i) {
+		if (auto* job = std::get_if<WorkPtr>(&work[i])) {
+			jobs[i] = std::move(*job);
+			return;
+		}
+
+		const std::size_t frame = std::get<PendingEqualisation>(work[i]).frame;
+		jobs[i] = std::make_unique<WorkerEqualisationJobCommand>(
+		    std::string{ frame_paths[frame] }, *this->frame_mapping(frame), options.output_encoding);
+	});
+
+	for (const auto& workItem : work) {
+		if (const auto* pending = std::get_if<PendingEqualisation>(&workItem)) {
+			this->mark_mapping_built(pending->frame);
+		}
+	}
+
+	// Frames released above make room in the window for more histograms
+	this->feed_histogram_work();
+
+	return jobs;
+}
+
+bool Server::work_pending() {
+	return this->pending_work_count() != 0;
+}
+
+std::size_t Server::pending_work_count() {
+	std::size_t count = enqueued_work.size();
+
+	for (const auto& [_, work] : affine_work) {
+		count += work.size();
+	}
+
+	return count;
+}
 
-		if (work_socket.receive(message)) {
-			std::string identity = message.get(0);
+void Server::release_affine_work(const std::string& worker) {
+	const auto affine = affine_work.find(worker);
 
-			{
-				std::unique_lock<std::recursive_mutex> workerLock{ worker_mutex };
+	if (affine == affine_work.end()) {
+		return;
+	}
+
+	for (auto& workItem : affine->second) {
+		enqueued_work.push(std::move(workItem));
+	}
+
+	affine_work.erase(affine);
+}
+
+void Server::track_frames(const std::vector<std::string>& frames) {
+	frame_paths = InternedPaths{ frames };
+	frame_histograms = FrameHistograms{ frames.size(), options.quantise_histograms };
+	frame_targets = FrameHistograms{ frames.size(), options.quantise_histograms };
+	smoothing_sums = HistogramWindow{};
+	next_target_frame = 0;
+	histograms_recorded.assign(frames.size(), false);
+	mappings_built.assign(frames.size(), false);
+	frame_identities.assign(frames.size(), std::nullopt);
+	frame_output_keys.assign(frames.size(), std::nullopt);
+}
 
-				ServerHistogramCommandVisitor commandVisitor{ *this, identity, workResults };
+void Server::add_frames(std::vector<std::string> frames) {
+	std::sort(frames.begin(), frames.end());
+	const std::set<std::string> frameSet{ frames.begin(), frames.end() };
+	const std::size_t firstAdded = frame_paths.size();
+	size_t addedCount = 0;
 
-				try {
-					std::unique_ptr<WorkerCommand> command =
-					    WorkerCommand::from_serialised_string(message.get(1));
-					command->visit(commandVisitor);
-				} catch (const std::exception& e) {
-					std::clog << e.what() << "\n";
-					throw e;
-				}
+	for (const auto& frame : frames) {
+		const std::filesystem::path framePath{ frame };
+
+		if (!options.frame_filter.accepts(framePath) || !std::filesystem::is_regular_file(framePath) ||
+		    framePath.filename() == HISTOGRAM_STORE_FILENAME ||
+		    framePath.filename() == OUTPUT_MANIFEST_FILENAME || frame_paths.find(frame) ||
+		    is_equalised_image(frame, frameSet)) {
+			continue;
+		}
+
+		// Images written by this run are also reported, once their frames are known
+		if (const std::optional<std::string> outputFrame = equalised_image_frame(frame);
+		    outputFrame && frame_paths.find(*outputFrame)) {
+			continue;
+		}
+
+		// Frames are equalised in filename order, which cannot be kept for a frame sorting before one
+		// already equalised
+		if (!frame_paths.empty() && frame <= frame_paths[frame_paths.size() - 1]) {
+			std::clog << "Skipping new frame '" << frame << "', which sorts before earlier frames\n";
+			continue;
+		}
+
+		frame_paths.push_back(frame);
+		frame_histograms.add_frame();
+		frame_targets.add_frame();
+		histograms_recorded.push_back(false);
+		mappings_built.push_back(false);
+		frame_identities.push_back(std::nullopt);
+		frame_output_keys.push_back(std::nullopt);
+		addedCount++;
+	}
+
+	if (addedCount == 0) {
+		return;
+	}
+
+	// Identities are read in parallel, as when scanning
+	if (histogram_store || output_manifest) {
+		ThreadPool::shared().parallel_for(addedCount, [&](const std::size_t i) {
+			const std::size_t frame = firstAdded + i;
+			frame_identities[frame] = read_file_identity(std::filesystem::path{ frame_paths[frame] });
+		});
+	}
+
+	this->feed_histogram_work();
+
+	// Workers may have been idle since the last frame, so will not ask for work themselves
+	this->transmit_to_workers();
+}
+
+std::optional<std::size_t> Server::record_frame_histogram(const std::string& filename,
+                                                          const Histogram& histogram) {
+	const std::optional<std::size_t> frame = frame_paths.find(filename);
+
+	if (!frame) {
+		// Frames are only known once the scan completes
+		if (!scanning_frames) {
+			std::clog << "Histogram for unknown frame: '" << filename << "'\n";
+		}
+
+		return std::nullopt;
+	}
+
+	// A job requeued from a departed worker may report the same histogram twice
+	if (histograms_recorded[*frame]) {
+		return std::nullopt;
+	}
+
+	histograms_recorded[*frame] = true;
+	frame_histograms.insert(*frame, histogram);
+	return frame;
+}
+
+std::optional<EqualisationHistogramMapping> Server::frame_mapping(const std::size_t frame) const {
+	if (!this->frame_mapping_ready(frame)) {
+		return std::nullopt;
+	}
+
+	// The first frame has nothing to be equalised against
+	if (frame == 0) {
+		return identity_equalisation_histogram_mapping();
+	}
+
+	if (this->temporal_smoothing()) {
+		return get_equalisation_parameters(frame_targets.at(frame), frame_histograms.at(frame));
+	}
+
+	return get_equalisation_parameters(frame_histograms.at(frame - 1), frame_histograms.at(frame));
+}
+
+bool Server::frame_mapping_ready(const std::size_t frame) const {
+	if (frame >= frame_paths.size() || !frame_histograms.contains(frame)) {
+		return false;
+	}
+
+	if (frame == 0) {
+		return true;
+	}
+
+	return this->temporal_smoothing() ? frame_targets.contains(frame)
+	                                  : frame_histograms.contains(frame - 1);
+}
+
+bool Server::temporal_smoothing() const {
+	return options.smoothing_window > 1 && !options.fused_jobs;
+}
+
+std::vector<std::size_t> Server::dependent_frames(const std::size_t frame) {
+	if (!this->temporal_smoothing()) {
+		return { frame, frame + 1 };
+	}
+
+	// A frame whose target is computed below is included as it is reached, rather than twice
+	std::vector<std::size_t> frames{};
+
+	if (frame < next_target_frame) {
+		frames.push_back(frame);
+	}
+
+	// Each target needs every histogram before it in the window, so targets are computed in order
+	while (next_target_frame < frame_paths.size() &&
+	       (next_target_frame == 0 || histograms_recorded[next_target_frame - 1])) {
+		const std::size_t target = next_target_frame++;
+		frames.push_back(target);
+
+		if (target == 0) {
+			continue;
+		}
+
+		const std::size_t entering = target - 1;
+
+		if (entering >= options.smoothing_window) {
+			const std::size_t leaving = entering - options.smoothing_window;
+			const Histogram leavingHistogram = frame_histograms.at(leaving);
+			smoothing_sums.slide(frame_histograms.at(entering), &leavingHistogram);
+			this->release_histogram(leaving);
+		} else {
+			smoothing_sums.slide(frame_histograms.at(entering));
+		}
+
+		frame_targets.insert(target, smoothing_sums.mean());
+	}
+
+	return frames;
+}
+
+void Server::enqueue_equalisations(const std::vector<std::size_t>& frames) {
+	// Whether each frame's image from an earlier run is current, as chars rather than bools since
+	// tasks set them concurrently
+	std::vector<char> current(frames.size(), false);
+
+	// A frame's mapping is only built here when the output manifest needs its output key. Otherwise
+	// it is built once, when the frame's job is dispatched.
+	if (output_manifest) {
+		ThreadPool::shared().parallel_for(frames.size(), [&](const std::size_t i) {
+			const std::size_t frame = frames[i];
+
+			if (!frame_identities[frame] || !this->frame_mapping_ready(frame)) {
+				return;
 			}
+
+			const std::uint64_t outputKey =
+			    output_key(*this->frame_mapping(frame), options.output_encoding);
+			frame_output_keys[frame] = outputKey;
+			const std::string filename{ frame_paths[frame] };
+			current[i] = output_manifest->is_current(
+			    filename, *frame_identities[frame], outputKey,
+			    equalised_image_path(filename, options.output_encoding.codec));
+		});
+	}
+
+	for (std::size_t i = 0; i < frames.size(); i++) {
+		if (!this->frame_mapping_ready(frames[i])) {
+			continue;
+		}
+
+		if (current[i]) {
+			reused_output_count++;
+			this->mark_mapping_built(frames[i]);
+		} else {
+			this->enqueue_affine_work(PendingEqualisation{ frames[i] });
 		}
 	}
+}
+
+void Server::enqueue_dependent_equalisations(const std::vector<std::size_t>& recordedFrames) {
+	std::vector<std::size_t> frames{};
+
+	for (const std::size_t frame : recordedFrames) {
+		const std::vector<std::size_t> dependents = this->dependent_frames(frame);
+		frames.insert(frames.end(), dependents.begin(), dependents.end());
+	}
 
-	return workResults;
+	// Consecutive frames may each name the other
+	std::sort(frames.begin(), frames.end());
+	frames.erase(std::unique(frames.begin(), frames.end()), frames.end());
+	this->enqueue_equalisations(frames);
 }
 
-void Server::receive_equalised(size_t totalWorkSamples) {
-	size_t cumulativeWorkSamples = 0;
+void Server::dispatch_scanned_frames(const std::vector<std::string>& frames) {
+	// Identities are read in parallel, as each read is a round trip on network filesystems
+	std::vector<std::optional<FileIdentity>> identities(frames.size());
+
+	if (histogram_store || output_manifest) {
+		ThreadPool::shared().parallel_for(frames.size(), [&frames, &identities](const std::size_t i) {
+			identities[i] = read_file_identity(std::filesystem::path{ frames[i] });
+		});
+	}
+
+	for (size_t i = 0; i < frames.size(); i++) {
+		if (!identities[i]) {
+			enqueued_work.push(std::make_unique<WorkerHistogramJobCommand>(
+			    frames[i], options.histogram_sample_budget, options.histogram_decode_size));
+			continue;
+		}
+
+		scanned_identities.insert_or_assign(frames[i], *identities[i]);
+
+		const std::optional<StoredHistogram> storedHistogram =
+		    histogram_store ? histogram_store->find(frames[i], *identities[i],
+		                                            options.histogram_sample_budget,
+		                                            options.histogram_decode_size)
+		                    : std::nullopt;
+
+		if (storedHistogram) {
+			scanned_histograms.insert_or_assign(frames[i], storedHistogram->histogram);
+			restored_histogram_count++;
+			histogram_cdf_error_bound =
+			    std::max(histogram_cdf_error_bound, storedHistogram->cdf_error_bound);
+		} else {
+			enqueued_work.push(std::make_unique<WorkerHistogramJobCommand>(
+			    frames[i], options.histogram_sample_budget, options.histogram_decode_size));
+		}
+	}
+
+	this->transmit_to_workers();
+}
+
+void Server::keep_scanned_histogram(const std::string& filename, const StoredHistogram& histogram) {
+	scanned_histograms.insert_or_assign(filename, histogram.histogram);
+
+	const auto identity = scanned_identities.find(filename);
+
+	if (histogram_store && identity != scanned_identities.end()) {
+		histogram_store->insert(filename, identity->second, options.histogram_sample_budget,
+		                        options.histogram_decode_size, histogram);
+	}
+}
+
+void Server::record_scanned_histograms() {
+	if (!scanning_frames) {
+		return;
+	}
 
-	{
-		std::unique_lock<std::recursive_mutex> workerLock{ this->worker_mutex };
-		std::clog << "Serving jobs to " << worker_queues.size() << " existing workers.\n";
+	scanning_frames = false;
 
-		for (const auto& [worker, _] : worker_queues) {
-			if (!enqueued_work.empty()) {
-				this->transmit_work(worker);
+	// Every frame's histogram job was dispatched as it was scanned
+	next_histogram_frame = frame_paths.size();
+	window_frame_count = frame_paths.size();
+
+	std::vector<std::size_t> recordedFrames{};
+
+	for (const auto& [filename, histogram] : scanned_histograms) {
+		const std::optional<std::size_t> frame = this->record_frame_histogram(filename, histogram);
+
+		if (frame) {
+			recordedFrames.push_back(*frame);
+		}
+	}
+
+	scanned_histograms.clear();
+	scanned_identities.clear();
+	this->enqueue_dependent_equalisations(recordedFrames);
+}
+
+void Server::identify_frames() {
+	// Frames scanned while their histogram jobs were dispatched were identified then
+	std::vector<std::size_t> unidentified{};
+
+	for (size_t frame = 0; frame < frame_paths.size(); frame++) {
+		const auto scannedIdentity = scanned_identities.find(std::string{ frame_paths[frame] });
+
+		if (scannedIdentity != scanned_identities.end()) {
+			frame_identities[frame] = scannedIdentity->second;
+		} else {
+			unidentified.push_back(frame);
+		}
+	}
+
+	// The rest are read in parallel, as when scanning
+	ThreadPool::shared().parallel_for(unidentified.size(), [&](const std::size_t i) {
+		const std::size_t frame = unidentified[i];
+		frame_identities[frame] = read_file_identity(std::filesystem::path{ frame_paths[frame] });
+	});
+}
+
+void Server::mark_mapping_built(const std::size_t frame) {
+	mappings_built[frame] = true;
+
+	if (frame_targets.contains(frame)) {
+		frame_targets.erase(frame);
+	}
+
+	this->release_histogram(frame);
+
+	if (frame > 0) {
+		this->release_histogram(frame - 1);
+	}
+}
+
+void Server::release_histogram(const std::size_t frame) {
+	if (!frame_histograms.contains(frame) || !mappings_built[frame]) {
+		return;
+	}
+
+	// A frame's histogram is needed for its own mapping and the next frame's or, when smoothing, for
+	// the targets of the frames after it until it leaves the window. When watching, frames may yet
+	// be added after the last.
+	if (options.watch_directory || frame + 1 < frame_paths.size()) {
+		const std::size_t lastTarget =
+		    options.watch_directory ? frame + 1 + options.smoothing_window
+		                            : std::min(frame + 1 + options.smoothing_window,
+		                                       frame_paths.size() - 1);
+
+		if (!this->temporal_smoothing() &&
+		    (frame + 1 == frame_paths.size() || !mappings_built[frame + 1])) {
+			return;
+		}
+
+		if (this->temporal_smoothing() && next_target_frame <= lastTarget) {
+			return;
+		}
+	}
+
+	frame_histograms.erase(frame);
+	window_frame_count--;
+}
+
+void Server::feed_histogram_work() {
+	// Frames are not dispatched further ahead of the frame stream than its reorder buffer can hold
+	const auto streamFull = [this]() {
+		return frame_stream &&
+		       next_histogram_frame >= frame_stream->next_frame() + options.stream_reorder_frames;
+	};
+
+	// A window too short to hold a frame and the frames before it that its mapping is made from could
+	// never release a histogram
+	const std::size_t minimumWindow =
+	    (this->temporal_smoothing() ? options.smoothing_window : 1) + 1;
+	const auto windowFull = [this, minimumWindow]() {
+		return options.histogram_window != 0 &&
+		       window_frame_count >= std::max(options.histogram_window, minimumWindow);
+	};
+
+	// Equalisations found current release their frames, so feed again until the window is full
+	while (next_histogram_frame < frame_paths.size() && !windowFull() && !streamFull()) {
+		std::vector<std::size_t> restoredFrames{};
+
+		while (next_histogram_frame < frame_paths.size() && !windowFull() && !streamFull()) {
+			const size_t frame = next_histogram_frame++;
+			window_frame_count++;
+
+			if (this->restore_histogram(frame)) {
+				restoredFrames.push_back(frame);
 			} else {
-				break;
+				enqueued_work.push(std::make_unique<WorkerHistogramJobCommand>(
+				    std::string{ frame_paths[frame] }, options.histogram_sample_budget,
+				    options.histogram_decode_size));
 			}
 		}
+
+		// Frames after restored frames are queued as their own histograms arrive
+		this->enqueue_dependent_equalisations(restoredFrames);
 	}
+}
 
-	while (cumulativeWorkSamples < totalWorkSamples) {
-		zmqpp::message message{};
+void Server::open_frame_stream() {
+	frame_stream = std::make_unique<FrameStream>(options.stream_path, options.stream_format,
+	                                             STREAM_FRAME_RATE);
+
+	if (!frame_stream->is_open()) {
+		std::clog << "Writing equalised images alongside their inputs instead\n";
+		frame_stream.reset();
+	}
+}
+
+void Server::open_histogram_store(const std::filesystem::path& servePath) {
+	histogram_store = std::make_unique<HistogramStore>(servePath / HISTOGRAM_STORE_FILENAME);
+
+	if (!histogram_store->is_open()) {
+		histogram_store.reset();
+	}
+}
+
+bool Server::restore_histogram(const std::size_t frame) {
+	if (!histogram_store || !frame_identities[frame]) {
+		return false;
+	}
+
+	const std::string filename{ frame_paths[frame] };
+	const std::optional<StoredHistogram> storedHistogram =
+	    histogram_store->find(filename, *frame_identities[frame], options.histogram_sample_budget,
+	                          options.histogram_decode_size);
+
+	if (!storedHistogram || !this->record_frame_histogram(filename, storedHistogram->histogram)) {
+		return false;
+	}
+
+	restored_histogram_count++;
+	histogram_cdf_error_bound = std::max(histogram_cdf_error_bound, storedHistogram->cdf_error_bound);
+
+	return true;
+}
+
+void Server::store_histogram(const std::size_t frame, const StoredHistogram& histogram) {
+	if (histogram_store && frame_identities[frame]) {
+		histogram_store->insert(std::string{ frame_paths[frame] }, *frame_identities[frame],
+		                        options.histogram_sample_budget, options.histogram_decode_size,
+		                        histogram);
+	}
+}
+
+void Server::record_output(const std::string& filename) {
+	const std::optional<std::size_t> frameIndex = frame_paths.find(filename);
+
+	if (!output_manifest || !frameIndex) {
+		return;
+	}
+
+	const size_t frame = *frameIndex;
+
+	if (!frame_identities[frame] || !frame_output_keys[frame]) {
+		return;
+	}
+
+	const std::optional<FileIdentity> outputIdentity =
+	    read_file_identity(equalised_image_path(filename, options.output_encoding.codec));
+
+	if (outputIdentity) {
+		output_manifest->insert(filename, *frame_identities[frame], *frame_output_keys[frame],
+		                        *outputIdentity);
+	}
+}
+
+void Server::write_output(const std::string& filename, ImageData imageData) {
+	output_writer.begin(filename, equalised_image_path(filename, options.output_encoding.codec));
+	output_writer.append(filename, std::move(imageData));
+	output_writer.finish(filename);
+}
+
+void Server::complete_output_writes() {
+	for (const CompletedOutput& output : output_writer.take_completed()) {
+		if (output.written) {
+			this->record_output(output.filename);
+		} else {
+			std::clog << "Unable to write equalised image: '" << output.filename << "'\n";
+		}
+	}
+
+	if (dispatch_throttled && !output_writer.over_budget()) {
+		dispatch_throttled = false;
+		this->transmit_to_workers();
+	}
+}
+
+void Server::stream_frame(const std::string& filename, const ImageData& tiffData) {
+	const std::optional<std::size_t> frame = frame_paths.find(filename);
+
+	if (!frame) {
+		std::clog << "Equalised image for unknown frame: '" << filename << "'\n";
+		return;
+	}
+
+	frame_stream->submit(*frame, tiffData);
+}
+
+void Server::complete_streamed_frames() {
+	if (!frame_stream || !frame_stream->take_written()) {
+		return;
+	}
+
+	// Frames written make room for histograms of frames further ahead
+	this->feed_histogram_work();
+	this->transmit_to_workers();
+}
+
+void Server::begin_incoming_result(const std::uint64_t jobId, const std::string& filename) {
+	// The frame stream decodes whole images, so only images for disk are written as they arrive.
+	// Beginning the output again replaces any earlier attempt.
+	const bool gather = frame_stream != nullptr;
+
+	if (!gather) {
+		output_writer.begin(filename, equalised_image_path(filename, options.output_encoding.codec));
+	}
+
+	incoming_results.erase(jobId);
+	incoming_results.try_emplace(jobId, gather);
+}
+
+void Server::append_incoming_result(const WorkerStreamChunkCommand& chunkCommand,
+                                    const std::string& filename) {
+	auto incoming = incoming_results.find(chunkCommand.get_job_id());
+
+	if (incoming == incoming_results.end()) {
+		std::clog << "Equalised image chunk for an image not being received: '" << filename << "'\n";
+		return;
+	}
+
+	if (incoming->second.append(chunkCommand.get_sequence(), chunkCommand.get_chunk_data()) &&
+	    !frame_stream) {
+		output_writer.append(filename, chunkCommand.get_chunk_data());
+	}
+}
 
-		if (work_socket.receive(message)) {
-			std::string identity = message.get(0);
+bool Server::finish_incoming_result(const WorkerStreamTrailerCommand& trailerCommand,
+                                    const std::string& filename) {
+	auto incoming = incoming_results.find(trailerCommand.get_job_id());
 
-			{
-				std::unique_lock<std::recursive_mutex> workerLock{ worker_mutex };
+	if (incoming == incoming_results.end() || !incoming->second.finish(trailerCommand)) {
+		std::clog << "Equalised image arrived incomplete: '" << filename << "'\n";
 
-				ServerEqualisationCommandVisitor commandVisitor{ *this, identity, cumulativeWorkSamples };
+		if (incoming != incoming_results.end()) {
+			incoming_results.erase(incoming);
 
-				try {
-					std::unique_ptr<WorkerCommand> command =
-					    WorkerCommand::from_serialised_string(message.get(1));
-					command->visit(commandVisitor);
-				} catch (const std::exception& e) {
-					std::clog << e.what() << "\n";
-					throw e;
-				}
+			if (!frame_stream) {
+				output_writer.discard(filename);
 			}
 		}
 
+		return false;
+	}
+
+	output_bytes += trailerCommand.get_size();
+	output_count++;
+
+	// The image is recorded in the output manifest once it is on disk
+	if (frame_stream) {
+		this->stream_frame(filename, incoming->second.take_image());
+	} else {
+		output_writer.finish(filename);
+	}
+
+	incoming_results.erase(incoming);
+	return true;
+}
+
+void Server::start_fused_chain() {
+	fused_frame_states.assign(frame_paths.size(), FusedFrameState::Unstarted);
+
+	if (!frame_paths.empty()) {
+		fused_frame_states.front() = FusedFrameState::Started;
+		enqueued_work.push(std::make_unique<WorkerFusedJobCommand>(
+		    std::string{ frame_paths[0] }, std::nullopt, options.histogram_sample_budget,
+		    options.output_encoding));
+	}
+}
+
+void Server::record_fused_histogram(const std::string& filename, const Histogram& histogram) {
+	const std::optional<std::size_t> frame = this->record_frame_histogram(filename, histogram);
+
+	// Continue the chain onto the next frame, unless it has already been started
+	if (frame && *frame + 1 < frame_paths.size() &&
+	    fused_frame_states[*frame + 1] != FusedFrameState::Started) {
+		fused_frame_states[*frame + 1] = FusedFrameState::Started;
+		enqueued_work.push(std::make_unique<WorkerFusedJobCommand>(
+		    std::string{ frame_paths[*frame + 1] }, histogram, options.histogram_sample_budget,
+		    options.output_encoding));
+	}
+}
+
+bool Server::split_fused_chain() {
+	// Frame states are only tracked once a fused run has started
+	if (!options.fused_jobs) {
+		return false;
+	}
+
+	size_t runStart = 0;
+	size_t longestRunStart = 0;
+	size_t longestRunLength = 0;
+
+	for (size_t frame = 0; frame < fused_frame_states.size(); frame++) {
+		if (fused_frame_states[frame] != FusedFrameState::Unstarted) {
+			runStart = frame + 1;
+		} else if (frame + 1 - runStart > longestRunLength) {
+			longestRunStart = runStart;
+			longestRunLength = frame + 1 - runStart;
+		}
+	}
+
+	if (longestRunLength < FUSED_CHAIN_MIN_SPLIT) {
+		return false;
+	}
+
+	// The first frame is always started, so every run has a frame before it
+	const size_t frame = longestRunStart + longestRunLength / 2;
+	assert(frame > 0);
+
+	if (frame_histograms.contains(frame - 1)) {
+		fused_frame_states[frame] = FusedFrameState::Started;
+		enqueued_work.push(std::make_unique<WorkerFusedJobCommand>(
+		    std::string{ frame_paths[frame] }, frame_histograms.at(frame - 1),
+		    options.histogram_sample_budget, options.output_encoding));
+	} else {
+		// Seed the chain with the histogram of the frame before it, computed exactly as its own fused
+		// job will compute it
+		fused_frame_states[frame] = FusedFrameState::AwaitingPrevious;
+		enqueued_work.push(std::make_unique<WorkerHistogramJobCommand>(
+		    std::string{ frame_paths[frame - 1] }, options.histogram_sample_budget, 0));
+	}
+
+	return true;
+}
+
+void Server::receive_overlapped(size_t totalWorkSamples) {
+	size_t cumulativeWorkSamples = 0;
+
+	std::clog << "Serving jobs to " << worker_queues.size() << " existing workers.\n";
+	this->transmit_to_workers();
+
+	// Frames with current images from earlier runs are never queued
+	while (cumulativeWorkSamples + reused_output_count < totalWorkSamples) {
+		this->react(cumulativeWorkSamples, MAX_HEARTBEAT_INTERVAL);
+	}
+}
+
+bool Server::react(size_t& resultCount, const std::chrono::milliseconds longestWait,
+                   const int descriptor) {
+	// Wake in time for the next heartbeat check, however long the caller would wait
+	const auto untilHeartbeat = std::chrono::ceil<std::chrono::milliseconds>(
+	    next_heartbeat_check - std::chrono::steady_clock::now());
+	const std::chrono::milliseconds wait =
+	    std::max(std::chrono::milliseconds{ 0 }, std::min(longestWait, untilHeartbeat));
+
+	zmqpp::poller poller{};
+	poller.add(work_socket, zmqpp::poller::poll_in);
+	poller.add(communication_socket, zmqpp::poller::poll_in);
+
+	if (output_writer.descriptor() >= 0) {
+		poller.add(output_writer.descriptor(), zmqpp::poller::poll_in);
+	}
+
+	if (frame_stream && frame_stream->descriptor() >= 0) {
+		poller.add(frame_stream->descriptor(), zmqpp::poller::poll_in);
+	}
+
+	if (descriptor >= 0) {
+		poller.add(descriptor, zmqpp::poller::poll_in);
+	}
+
+	if (poller.poll(wait.count())) {
+		zmqpp::message message{};
+
+		// Workers register and answer heartbeats on the communication socket, so it is drained first
+		if (poller.has_input(communication_socket)) {
+			this->receive_communication_messages();
+		}
+
+		if (poller.has_input(work_socket)) {
+			while (work_socket.receive(message, true)) {
+				this->visit_work_message(std::move(message), resultCount);
+				message = zmqpp::message{};
+			}
+		}
+	}
+
+	// Budget freed by completed writes is checked on every wake, not only on completions
+	this->complete_output_writes();
+	this->complete_streamed_frames();
+
+	if (std::chrono::steady_clock::now() >= next_heartbeat_check) {
+		// Replies that arrived while handling results are counted before anyone is dismissed
+		this->receive_communication_messages();
 		this->send_heartbeats();
+		next_heartbeat_check = std::chrono::steady_clock::now() + HEARTBEAT_CHECK_INTERVAL;
+	}
+
+	return descriptor >= 0 && poller.has_input(descriptor);
+}
+
+void Server::receive_communication_messages() {
+	zmqpp::message message{};
+
+	while (communication_socket.receive(message, true)) {
+		this->visit_communication_message(std::move(message));
+		message = zmqpp::message{};
+	}
+}
+
+void Server::visit_work_message(zmqpp::message message, size_t& resultCount) {
+	std::string identity = message.get(0);
+
+	ServerOverlappedCommandVisitor overlappedVisitor{ *this, identity, resultCount };
+	ServerFusedCommandVisitor fusedVisitor{ *this, identity, resultCount };
+	CommandVisitor& commandVisitor =
+	    options.fused_jobs ? static_cast<CommandVisitor&>(fusedVisitor) : overlappedVisitor;
+
+	try {
+		std::unique_ptr<WorkerCommand> command = WorkerCommand::from_message(std::move(message), 1);
+		command->visit(commandVisitor);
+	} catch (const std::exception& e) {
+		std::clog << e.what() << "\n";
+		throw e;
+	}
+}
+
+void Server::visit_communication_message(zmqpp::message message) {
+	std::string identity = message.get(0);
+
+	ServerCommunicationVisitor communicationVisitor{ *this, identity };
+
+	try {
+		std::unique_ptr<WorkerCommand> command =
+		    WorkerCommand::from_serialised_string(message.get(1));
+		command->visit(communicationVisitor);
+	} catch (const std::exception& e) {
+		std::clog << e.what() << "\n";
+		throw e;
+	}
+}
+
+void Server::transmit_to_workers() {
+	for (const auto& [worker, _] : worker_queues) {
+		if (!this->work_pending()) {
+			break;
+		}
+
+		this->transmit_work(worker);
+	}
+}
+
+void Server::watch_frames(const std::filesystem::path& servePath) {
+	DirectoryWatch watch{ servePath, options.recursive };
+
+	if (!watch.is_open()) {
+		return;
+	}
+
+	std::clog << "Watching for new frames, until interrupted\n";
+	std::signal(SIGINT, interrupt_watch);
+	std::signal(SIGTERM, interrupt_watch);
+
+	size_t equalisedCount = 0;
+
+	// Wait on both the workers and the directory, so a new frame is queued as soon as it is complete
+	while (watch_interrupted == 0) {
+		if (this->react(equalisedCount, MAX_HEARTBEAT_INTERVAL, watch.descriptor())) {
+			std::vector<std::string> completedFiles{};
+
+			for (const auto& file : watch.take_completed_files()) {
+				completedFiles.push_back(file);
+			}
+
+			this->add_frames(std::move(completedFiles));
+		}
+	}
+
+	std::signal(SIGINT, SIG_DFL);
+	std::signal(SIGTERM, SIG_DFL);
+	std::clog << "Equalised " << equalisedCount << " frames added while watching\n";
+}
+
+void Server::receive_fused(size_t totalWorkSamples) {
+	size_t cumulativeWorkSamples = 0;
+
+	std::clog << "Serving jobs to " << worker_queues.size() << " existing workers.\n";
+
+	for (const auto& [worker, _] : worker_queues) {
+		this->transmit_work(worker);
+	}
+
+	while (cumulativeWorkSamples < totalWorkSamples) {
+		this->react(cumulativeWorkSamples, MAX_HEARTBEAT_INTERVAL);
 	}
 }
 
@@ -246,28 +1257,18 @@ void Server::send_communication_message(const std::string& worker, zmqpp::messag
 }
 
 void Server::dismiss_worker(const std::string& worker) {
-	std::unique_lock<std::recursive_mutex> workLock{ this->worker_mutex };
-	std::unique_lock<std::recursive_mutex> workerLock{ this->work_mutex };
-
 	auto workerDataIter = this->worker_queues.find(worker);
 
 	if (workerDataIter != this->worker_queues.end()) {
-		auto& work = workerDataIter->second.work;
-
-		for (auto& workItem : work) {
-			this->enqueued_work.push(std::move(workItem));
-		}
-
 		this->worker_queues.erase(workerDataIter);
 	}
 
+	this->release_in_flight_jobs(worker);
+	this->release_affine_work(worker);
 	this->send_work_message(worker, WorkerByeCommand{}.to_message());
 }
 
 void Server::dismiss_workers() {
-	std::unique_lock<std::recursive_mutex> workLock{ this->worker_mutex };
-	std::unique_lock<std::recursive_mutex> workerLock{ this->work_mutex };
-
 	for (const auto& [worker, _] : worker_queues) {
 		this->send_work_message(worker, WorkerByeCommand{}.to_message());
 	}
@@ -277,7 +1278,6 @@ void Server::dismiss_workers() {
 }
 
 void Server::send_heartbeats() {
-	std::unique_lock<std::recursive_mutex> workerLock{ this->worker_mutex };
 	std::vector<std::string> dismissedWorkers{};
 
 	for (auto& [worker, workerData] : worker_queues) {
@@ -301,6 +1301,38 @@ void Server::send_heartbeats() {
 	}
 }
 
+void Server::report_frame_memory() {
+	const size_t pathBytes = frame_paths.memory_bytes();
+	const size_t histogramBytes = frame_histograms.memory_bytes() + frame_targets.memory_bytes();
+	const size_t stateBytes =
+	    (histograms_recorded.capacity() + mappings_built.capacity()) / 8 +
+	    frame_identities.capacity() * sizeof(std::optional<FileIdentity>) +
+	    frame_output_keys.capacity() * sizeof(std::optional<std::uint64_t>) +
+	    fused_frame_states.capacity() * sizeof(FusedFrameState);
+	const size_t totalBytes = pathBytes + histogramBytes + stateBytes;
+
+	std::clog << "Frame storage: " << totalBytes << " bytes (" << pathBytes << " for paths, "
+	          << histogramBytes << " for histograms with at most "
+	          << frame_histograms.peak_held_count() << " held at once, " << stateBytes
+	          << " for progress), " << totalBytes / std::max<size_t>(frame_paths.size(), 1)
+	          << " bytes per frame\n";
+}
+
+void Server::report_output_statistics(const std::chrono::steady_clock::duration elapsed) {
+	if (output_count == 0) {
+		return;
+	}
+
+	const double seconds = std::max(std::chrono::duration<double>(elapsed).count(), 1e-9);
+	const double megabytes = static_cast<double>(output_bytes) / (1024.0 * 1024.0);
+
+	std::clog << "Received " << output_count << " images as "
+	          << output_codec_name(options.output_encoding.codec) << ": " << output_bytes
+	          << " bytes on the wire, " << output_bytes / output_count << " bytes per image, at "
+	          << megabytes / seconds << " MiB/s and " << static_cast<double>(output_count) / seconds
+	          << " images/s\n";
+}
+
 ServerWorkVisitor::ServerWorkVisitor(Server& server, const std::string& workerIdentity)
     : server{ server }, worker_identity{ workerIdentity } {}
 
@@ -324,6 +1356,11 @@ void ServerWorkVisitor::visit_equalisation_job(const WorkerEqualisationJobComman
 	DEBUG_NETWORK("Visited Worker Job (unexpected)\n");
 }
 
+void ServerWorkVisitor::visit_fused_job(const WorkerFusedJobCommand& jobCommand) {
+	/* Ignore unexpected message. */
+	DEBUG_NETWORK("Visited Worker Job (unexpected)\n");
+}
+
 void ServerWorkVisitor::visit_heartbeat(const WorkerHeartbeatCommand& heartbeatCommand) {
 	/* Ignore unexpected message. */
 	DEBUG_NETWORK("Visited Worker Heartbeat (on wrong channel)\n");
@@ -333,90 +1370,211 @@ void ServerWorkVisitor::visit_bye(const WorkerByeCommand& byeCommand) {
 	/* Remove worker from list, and reassign outstanding work. */
 	DEBUG_NETWORK("Visited Worker Bye\n");
 
-	std::unique_lock<std::recursive_mutex> workLock{ this->server.work_mutex };
-	std::unique_lock<std::recursive_mutex> workerLock{ this->server.worker_mutex };
+	this->server.worker_queues.erase(worker_identity);
+	this->server.release_in_flight_jobs(worker_identity);
+	this->server.release_affine_work(worker_identity);
+}
 
-	const auto workerJobsIter = this->server.worker_queues.find(worker_identity);
+void ServerWorkVisitor::visit_unknown_path(const WorkerUnknownPathCommand& unknownPathCommand) {
+	/* Send the job again, with its path in full. */
+	DEBUG_NETWORK("Visited Worker Unknown Path\n");
 
-	if (workerJobsIter != this->server.worker_queues.end()) {
-		auto& workerJobs = workerJobsIter->second;
+	WorkPtr job = server.take_in_flight_job(worker_identity, unknownPathCommand.get_job_id());
 
-		while (!workerJobs.work.empty()) {
-			auto&& job = std::move(workerJobs.work.back());
-			this->server.enqueued_work.push(std::move(job));
-			workerJobs.work.pop_back();
-		}
+	if (!job) {
+		std::clog << "Invalid result for a job not sent to worker: '" << worker_identity << "'\n";
+		return;
 	}
 
-	this->server.worker_queues.erase(workerJobsIter);
+	std::clog << "Worker '" << worker_identity << "' did not know the path '" << job->get_filename()
+	          << "', sending it again\n";
+	server.worker_queues.at(worker_identity).path_ids.erase(job->get_filename());
+	server.dispatch_job(worker_identity, std::move(job));
 }
 
-ServerHistogramCommandVisitor::ServerHistogramCommandVisitor(
-    Server& server, const std::string& workerIdentity,
-    std::map<std::string, Histogram>& workResults)
-    : ServerWorkVisitor{ server, workerIdentity }, histogram_results{ workResults } {}
+ServerOverlappedCommandVisitor::ServerOverlappedCommandVisitor(Server& server,
+                                                               const std::string& workerIdentity,
+                                                               size_t& equalisedCount)
+    : ServerWorkVisitor{ server, workerIdentity }, equalised_count{ equalisedCount } {}
 
-void ServerHistogramCommandVisitor::visit_histogram_result(
+void ServerOverlappedCommandVisitor::visit_histogram_result(
     const WorkerHistogramResultCommand& resultCommand) {
-	/* Add result to list of histogram results. */
+	/* Record the histogram, and queue the equalisation of any frames it completes. */
 	DEBUG_NETWORK("Visited Worker Histogram Result\n");
 
-	try {
-		std::vector<WorkPtr>& queue = server.worker_queues.at(worker_identity).work;
-		histogram_results.insert(
-		    std::make_pair(resultCommand.get_filename(), resultCommand.get_histogram()));
+	const WorkPtr job = server.take_in_flight_job(worker_identity, resultCommand.get_job_id());
 
-		queue.erase(std::find_if(queue.begin(), queue.end(), [&resultCommand](const WorkPtr& work) {
-			return *work.get() == resultCommand;
-		}));
+	if (!job) {
+		std::clog << "Invalid result for a job not sent to worker: '" << worker_identity << "'\n";
+		return;
+	}
 
-		if (!server.enqueued_work.empty()) {
-			server.transmit_work(worker_identity);
-		}
-	} catch (std::out_of_range& exception) {
-		std::clog << "Invalid result from unknown (unregistered) worker: '" << worker_identity << "'\n";
+	const std::string& filename = job->get_filename();
+
+	// Only full resolution decodes are kept by workers
+	if (server.options.histogram_decode_size == 0) {
+		server.image_holders.insert_or_assign(filename, worker_identity);
 	}
+
+	server.histogram_cdf_error_bound =
+	    std::max(server.histogram_cdf_error_bound, resultCommand.get_cdf_error_bound());
+
+	// A frame can be equalised once both its histogram and the previous frame's, or its smoothing
+	// target, are known
+	const Histogram histogram = resultCommand.get_histogram();
+	const std::optional<std::size_t> frame = server.record_frame_histogram(filename, histogram);
+
+	if (frame) {
+		server.store_histogram(*frame,
+		                       StoredHistogram{ histogram, resultCommand.get_cdf_error_bound() });
+		server.enqueue_equalisations(server.dependent_frames(*frame));
+	} else if (server.scanning_frames) {
+		server.keep_scanned_histogram(
+		    filename, StoredHistogram{ histogram, resultCommand.get_cdf_error_bound() });
+	}
+
+	server.transmit_work(worker_identity);
 }
 
-void ServerHistogramCommandVisitor::visit_equalisation_result(
+void ServerOverlappedCommandVisitor::visit_equalisation_result(
     const WorkerEqualisationResultCommand& resultCommand) {
-	DEBUG_NETWORK("Visited (Unexpected) Worker Equalisation Result\n");
+	DEBUG_NETWORK("Visited Worker Equalisation Result\n");
+
+	WorkPtr job = server.take_in_flight_job(worker_identity, resultCommand.get_job_id());
+
+	if (!job) {
+		std::clog << "Invalid result for a job not sent to worker: '" << worker_identity << "'\n";
+		return;
+	}
+
+	if (!resultCommand.has_tiff_data()) {
+		std::clog << "Equalisation result arrived without its image: '" << job->get_filename() << "'\n";
+
+		// Equalise the image again, on whichever worker is next free
+		server.enqueued_work.push(std::move(job));
+		server.transmit_work(worker_identity);
+		return;
+	}
+
+	server.output_bytes += resultCommand.get_tiff_data().size();
+	server.output_count++;
+
+	if (server.frame_stream) {
+		server.stream_frame(job->get_filename(), resultCommand.get_tiff_data());
+	} else {
+		server.write_output(job->get_filename(), resultCommand.get_tiff_data());
+	}
+
+	this->equalised_count++;
+	server.transmit_work(worker_identity);
 }
 
-ServerEqualisationCommandVisitor::ServerEqualisationCommandVisitor(
-    Server& server, const std::string& workerIdentity, size_t& equalisedCount)
-    : ServerWorkVisitor{ server, workerIdentity }, equalised_count{ equalisedCount } {}
+void ServerOverlappedCommandVisitor::visit_fused_result(
+    const WorkerFusedResultCommand& resultCommand) {
+	DEBUG_NETWORK("Visited (Unexpected) Worker Fused Result\n");
+}
+
+void ServerOverlappedCommandVisitor::visit_stream_header(
+    const WorkerStreamHeaderCommand& headerCommand) {
+	DEBUG_NETWORK("Visited Worker Stream Header\n");
+	const WorkerJobCommand* job = server.in_flight_job(worker_identity, headerCommand.get_job_id());
+
+	if (job == nullptr) {
+		std::clog << "Equalised image for a job not sent to worker: '" << worker_identity << "'\n";
+		return;
+	}
+
+	server.begin_incoming_result(headerCommand.get_job_id(), job->get_filename());
+}
+
+void ServerOverlappedCommandVisitor::visit_stream_chunk(
+    const WorkerStreamChunkCommand& chunkCommand) {
+	DEBUG_NETWORK("Visited Worker Stream Chunk\n");
+	const WorkerJobCommand* job = server.in_flight_job(worker_identity, chunkCommand.get_job_id());
+
+	if (job == nullptr) {
+		std::clog << "Equalised image chunk for a job not sent to worker: '" << worker_identity
+		          << "'\n";
+		return;
+	}
+
+	server.append_incoming_result(chunkCommand, job->get_filename());
+}
+
+void ServerOverlappedCommandVisitor::visit_stream_trailer(
+    const WorkerStreamTrailerCommand& trailerCommand) {
+	DEBUG_NETWORK("Visited Worker Stream Trailer\n");
+	WorkPtr job = server.take_in_flight_job(worker_identity, trailerCommand.get_job_id());
+
+	if (!job) {
+		std::clog << "Invalid result for a job not sent to worker: '" << worker_identity << "'\n";
+		return;
+	}
+
+	if (server.finish_incoming_result(trailerCommand, job->get_filename())) {
+		this->equalised_count++;
+	} else {
+		// Equalise the image again, on whichever worker is next free
+		server.enqueued_work.push(std::move(job));
+	}
+
+	server.transmit_work(worker_identity);
+}
+
+ServerFusedCommandVisitor::ServerFusedCommandVisitor(Server& server,
+                                                     const std::string& workerIdentity,
+                                                     size_t& fusedCount)
+    : ServerWorkVisitor{ server, workerIdentity }, fused_count{ fusedCount } {}
 
-void ServerEqualisationCommandVisitor::visit_histogram_result(
+void ServerFusedCommandVisitor::visit_histogram_result(
     const WorkerHistogramResultCommand& resultCommand) {
-	DEBUG_NETWORK("Visited (Unexpected) Worker Histogram Result. Should have completed all "
-	              "histogram results already!\n");
+	/* Seed the chain of fused jobs following this frame. */
+	DEBUG_NETWORK("Visited Worker Histogram Result\n");
+
+	const WorkPtr job = server.take_in_flight_job(worker_identity, resultCommand.get_job_id());
+
+	if (!job) {
+		std::clog << "Invalid result for a job not sent to worker: '" << worker_identity << "'\n";
+		return;
+	}
+
+	server.record_fused_histogram(job->get_filename(), resultCommand.get_histogram());
+	server.transmit_work(worker_identity);
 }
 
-void ServerEqualisationCommandVisitor::visit_equalisation_result(
+void ServerFusedCommandVisitor::visit_equalisation_result(
     const WorkerEqualisationResultCommand& resultCommand) {
-	DEBUG_NETWORK("Visited Worker Equalisation Result\n");
+	DEBUG_NETWORK("Visited (Unexpected) Worker Equalisation Result\n");
+}
 
-	std::ofstream resultOutput{ resultCommand.get_filename() + ".tiff",
-		                          std::ios_base::binary | std::ios_base::out };
-	const auto& tiffData = resultCommand.get_tiff_data();
+void ServerFusedCommandVisitor::visit_fused_result(const WorkerFusedResultCommand& resultCommand) {
+	DEBUG_NETWORK("Visited Worker Fused Result\n");
 
-	resultOutput.write(reinterpret_cast<const char*>(tiffData.data()), tiffData.size());
+	WorkPtr job = server.take_in_flight_job(worker_identity, resultCommand.get_job_id());
 
-	try {
-		std::vector<WorkPtr>& queue = server.worker_queues.at(worker_identity).work;
-		this->equalised_count++;
+	if (!job) {
+		std::clog << "Invalid result for a job not sent to worker: '" << worker_identity << "'\n";
+		return;
+	}
 
-		queue.erase(std::find_if(queue.begin(), queue.end(), [&resultCommand](const WorkPtr& work) {
-			return *work.get() == resultCommand;
-		}));
+	if (!resultCommand.has_tiff_data()) {
+		std::clog << "Fused result arrived without its image: '" << job->get_filename() << "'\n";
 
-		if (!server.enqueued_work.empty()) {
-			server.transmit_work(worker_identity);
-		}
-	} catch (std::out_of_range& exception) {
-		std::clog << "Invalid result from unknown (unregistered) worker: '" << worker_identity << "'\n";
+		// Run the job again, whose histogram continues the chain once its image is written
+		server.enqueued_work.push(std::move(job));
+		server.transmit_work(worker_identity);
+		return;
 	}
+
+	server.output_bytes += resultCommand.get_tiff_data().size();
+	server.output_count++;
+	server.write_output(job->get_filename(), resultCommand.get_tiff_data());
+
+	this->fused_count++;
+	server.histogram_cdf_error_bound =
+	    std::max(server.histogram_cdf_error_bound, resultCommand.get_cdf_error_bound());
+	server.record_fused_histogram(job->get_filename(), resultCommand.get_histogram());
+	server.transmit_work(worker_identity);
 }
 
 ServerCommunicationVisitor::ServerCommunicationVisitor(Server& server,
@@ -453,6 +1611,11 @@ void ServerCommunicationVisitor::visit_equalisation_job(
 	DEBUG_NETWORK("Visited Worker Job (unexpected, and on wrong channel)\n");
 }
 
+void ServerCommunicationVisitor::visit_fused_job(const WorkerFusedJobCommand& jobCommand) {
+	/* Ignore unexpected message. */
+	DEBUG_NETWORK("Visited Worker Job (unexpected, and on wrong channel)\n");
+}
+
 void ServerCommunicationVisitor::visit_heartbeat(const WorkerHeartbeatCommand& heartbeatCommand) {
 	DEBUG_NETWORK("Visited Worker Heartbeat\n");
 
@@ -469,7 +1632,6 @@ void ServerCommunicationVisitor::visit_heartbeat(const WorkerHeartbeatCommand& h
 		}
 		case HeartbeatType::REPLY: {
 			DEBUG_NETWORK("Received heartbeat reply from worker\n");
-			std::unique_lock<std::recursive_mutex> workerLock{ this->server.worker_mutex };
 			auto workerDataIter = this->server.worker_queues.find(worker_identity);
 
 			// Heartbeats from dismissed workers are irrelevant
@@ -499,3 +1661,7 @@ void ServerCommunicationVisitor::visit_histogram_result(
     const WorkerHistogramResultCommand& resultCommand) {
 	DEBUG_NETWORK("Visited Worker Histogram Result (on wrong channel)\n");
 }
+
+void ServerCommunicationVisitor::visit_fused_result(const WorkerFusedResultCommand& resultCommand) {
+	DEBUG_NETWORK("Visited Worker Fused Result (on wrong channel)\n");
+}
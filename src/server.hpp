@@ -2,22 +2,34 @@
 
 #include <chrono>
 #include <cstddef>
+#include <deque>
 #include <filesystem>
 #include <map>
 #include <memory>
-#include <mutex>
+#include <optional>
 #include <queue>
 #include <string>
+#include <unordered_map>
+#include <variant>
 #include <vector>
 #include <zmqpp/context.hpp>
 #include <zmqpp/socket.hpp>
 
 #include "algorithm.hpp"
+#include "directory_scan.hpp"
+#include "file_identity.hpp"
+#include "frame_store.hpp"
+#include "frame_stream.hpp"
+#include "histogram_store.hpp"
+#include "output_manifest.hpp"
+#include "output_writer.hpp"
 #include "protocol.hpp"
+#include "result_stream.hpp"
+#include "smoothing.hpp"
 
 class ServerWorkVisitor;
-class ServerHistogramCommandVisitor;
-class ServerEqualisationCommandVisitor;
+class ServerOverlappedCommandVisitor;
+class ServerFusedCommandVisitor;
 class ServerCommunicationVisitor;
 
 namespace zmqpp {
@@ -26,37 +38,299 @@ namespace zmqpp {
 } // namespace zmqpp
 
 using WorkPtr = std::unique_ptr<WorkerJobCommand>;
+
+// A frame whose equalisation job, and the mapping it holds, is only built once it is dispatched
+struct PendingEqualisation {
+	std::size_t frame;
+};
+
+using QueuedWork = std::variant<WorkPtr, PendingEqualisation>;
 using Timestamp = std::chrono::time_point<std::chrono::system_clock>;
 
+// Settings for a run, chosen on the command line
+struct ServerOptions {
+	// Pixels sampled from each image to estimate its histogram, or zero to use every pixel
+	std::uint64_t histogram_sample_budget = HISTOGRAM_SAMPLE_BUDGET;
+
+	// Minimum longest edge images are decoded to for their histograms, or zero for full resolution
+	std::uint32_t histogram_decode_size = HISTOGRAM_DECODE_SIZE;
+
+	// Whether to compute histograms and equalise in a single pass of fused jobs. Fused histograms are
+	// always computed at full resolution.
+	bool fused_jobs = FUSED_JOBS;
+
+	// Whether to reuse histograms from earlier runs, and keep the histograms computed for later runs
+	bool store_histograms = HISTOGRAM_STORE;
+
+	// Whether to skip equalising frames whose images from earlier runs are still current
+	bool reuse_outputs = REUSE_OUTPUTS;
+
+	// Whether to hold histograms as quantised cumulative distributions, see `FrameHistograms`
+	bool quantise_histograms = QUANTISE_HISTOGRAMS;
+
+	// Most frames whose histograms are held or being computed at once, or zero for no limit
+	std::size_t histogram_window = HISTOGRAM_WINDOW;
+
+	// Frames before each frame whose mean histogram it is equalised to. Not applied to fused runs.
+	std::size_t smoothing_window = SMOOTHING_WINDOW;
+
+	// Where equalised frames are streamed in frame order (see `FrameStream`), rather than written
+	// alongside their inputs, or empty to write them alongside. Not supported for fused runs.
+	std::string stream_path{};
+	FrameStreamFormat stream_format = FrameStreamFormat::Y4M;
+	// Most frames held waiting for the frames before them to be streamed
+	std::size_t stream_reorder_frames = STREAM_REORDER_FRAMES;
+
+	// Whether to keep equalising frames added to the directory after the first pass, until
+	// interrupted. Not supported for fused runs.
+	bool watch_directory = false;
+
+	// Whether to take frames from subdirectories of the served directory too
+	bool recursive = false;
+	FrameFilter frame_filter{};
+
+	// How workers encode equalised images, sent with each job
+	OutputEncoding output_encoding{};
+
+	// Most bytes of equalised images queued for writing before dispatch is held back
+	std::uint64_t output_write_budget = OUTPUT_WRITE_BUDGET;
+};
+
 struct WorkerData {
-	std::vector<WorkPtr> work;
+	// Jobs sent to the worker whose results have not yet arrived, see `Server::in_flight_jobs`
+	std::size_t job_count;
+	// IDs of the paths sent to the worker in full, which later jobs for them refer to them by. IDs
+	// are never reused, even for a path sent again.
+	std::unordered_map<std::string, std::uint32_t> path_ids;
+	std::uint32_t next_path_id;
 	Timestamp last_heartbeat_request;
 	bool heartbeat_reply_received;
 	std::uint32_t concurrency;
 };
 
+// A job sent to a worker, until its result arrives
+struct InFlightJob {
+	std::string worker;
+	WorkPtr job;
+};
+
 class Server {
 public:
-	Server(zmqpp::context& context);
+	Server(zmqpp::context& context, ServerOptions options = {});
 
 	void serve_work(const std::filesystem::path& servePath);
 
 protected:
+	const ServerOptions options;
+
 	zmqpp::socket work_socket;
 	zmqpp::socket communication_socket;
 
-	std::queue<WorkPtr> enqueued_work;
-	std::recursive_mutex work_mutex;
+	std::queue<QueuedWork> enqueued_work;
+
+	// Equalisation jobs queued for the worker that computed the image's histogram, which may still
+	// hold the decoded image
+	std::map<std::string, std::deque<QueuedWork>> affine_work{};
+
+	// Worker each image's histogram was computed on, until the image's equalisation is queued
+	std::map<std::string, std::string> image_holders{};
 
 	std::map<std::string, WorkerData> worker_queues{};
-	std::recursive_mutex worker_mutex;
 
-	std::atomic_bool communication_service_running;
+	// Jobs sent to workers, by the ID each dispatch is given, which their results are matched by
+	std::unordered_map<std::uint64_t, InFlightJob> in_flight_jobs{};
+	std::uint64_t next_job_id;
+
+	// When the workers' heartbeats are next checked, see `react`
+	std::chrono::steady_clock::time_point next_heartbeat_check;
+
+	// Worst CDF error bound of the histograms received, when sampling
+	double histogram_cdf_error_bound;
+
+	// Frames in the order they are equalised against one another, with their histograms from when
+	// they are known until both mappings they are needed for are built
+	InternedPaths frame_paths{};
+	FrameHistograms frame_histograms{};
+	std::vector<bool> histograms_recorded{};
+	// Whether each frame's mapping has been built for its equalisation job, or found to be current
+	std::vector<bool> mappings_built{};
+	std::vector<std::optional<FileIdentity>> frame_identities{};
+
+	// With temporal smoothing, the mean histogram of the frames before each frame, from when it is
+	// computed until the frame's mapping is built. Targets are computed in frame order, sliding the
+	// running sums of the window along, and frames before `next_target_frame` have theirs computed.
+	FrameHistograms frame_targets{};
+	HistogramWindow smoothing_sums{};
+	std::size_t next_target_frame;
+
+	// Output key (see `output_key`) of each frame's equalisation, once queued
+	std::vector<std::optional<std::uint64_t>> frame_output_keys{};
+
+	// Histograms and images from earlier runs, when enabled
+	std::unique_ptr<HistogramStore> histogram_store{};
+	std::unique_ptr<OutputManifest> output_manifest{};
+
+	// Stream equalised frames are written to in frame order, when enabled
+	std::unique_ptr<FrameStream> frame_stream{};
+
+	// Whether histogram jobs are being dispatched while the directory is scanned, before frames are
+	// tracked. Histograms arriving meanwhile, or restored from the store, are kept by path until
+	// then, along with the identities read for the store.
+	bool scanning_frames;
+	std::map<std::string, Histogram> scanned_histograms{};
+	std::map<std::string, FileIdentity> scanned_identities{};
+
+	// Frames whose images from earlier runs were current, so were not equalised again
+	std::size_t reused_output_count;
+
+	// Frames before this have had their histograms queued or restored
+	std::size_t next_histogram_frame;
+	// Frames whose histograms are being computed or held, bounded by the histogram window
+	std::size_t window_frame_count;
+	std::size_t restored_histogram_count;
 
-	void run_communication_service();
-	[[nodiscard]] std::map<std::string, Histogram> receive_histograms(size_t totalWorkSamples);
-	void receive_equalised(size_t totalWorkSamples);
+	// Equalised images received, and their encoded size, as sent over the network
+	std::uint64_t output_bytes;
+	std::size_t output_count;
+
+	// Equalised images being streamed back by workers, by job ID
+	std::unordered_map<std::uint64_t, IncomingResultStream> incoming_results;
+
+	// Writes equalised images to disk off the receive loop. While more is queued than the write
+	// budget allows, no work is dispatched, so workers wait for the disk rather than the server
+	// buffering their images without bound.
+	OutputWriter output_writer;
+	bool dispatch_throttled;
+	std::size_t throttle_count;
+
+	// Progress through the frames of a fused run. A frame's fused job can only start once the
+	// histogram of the frame before it is known, so frames are processed in chains, each seeded by a
+	// histogram job for the frame before its first.
+	enum class FusedFrameState {
+		Unstarted,
+		AwaitingPrevious,
+		Started,
+	};
+
+	std::vector<FusedFrameState> fused_frame_states{};
+
+	// Computes histograms, equalising each frame as soon as its and the previous frame's histograms
+	// are known
+	void serve_overlapped_work(size_t jobCount);
+	// Computes histograms and equalises in fused jobs, see `FusedFrameState`
+	void serve_fused_work(size_t jobCount);
+	void receive_overlapped(size_t totalWorkSamples);
+	// The server's event loop, run by each phase until it is done. Waits up to `longestWait` for
+	// messages on either socket, completed writes, or `descriptor` when given, handling everything
+	// that arrives and checking heartbeats as they fall due, after any replies have been taken.
+	// Results are counted in `resultCount`. Returns whether `descriptor` became readable.
+	bool react(size_t& resultCount, std::chrono::milliseconds longestWait, int descriptor = -1);
+	// Handles every message waiting on the communication socket, without blocking
+	void receive_communication_messages();
+	void visit_work_message(zmqpp::message message, size_t& resultCount);
+	void visit_communication_message(zmqpp::message message);
+	// Sends pending work to each worker with room for it
+	void transmit_to_workers();
+	// Equalises frames as they are added to the directory, until interrupted
+	void watch_frames(const std::filesystem::path& servePath);
+	void receive_fused(size_t totalWorkSamples);
 	void transmit_work(const std::string& worker);
+	// Sends a job to a worker, giving it a new job ID and sending its path in full unless the
+	// worker already knows it
+	void dispatch_job(const std::string& worker, WorkPtr job);
+	// Takes the job a result from a worker is for, or null if the worker was not sent the job
+	[[nodiscard]] WorkPtr take_in_flight_job(const std::string& worker, std::uint64_t jobId);
+	// The job a part of a streamed image from a worker is for, or null if the worker was not sent
+	// the job
+	[[nodiscard]] const WorkerJobCommand* in_flight_job(const std::string& worker,
+	                                                    std::uint64_t jobId) const;
+	// Returns a departing worker's in-flight jobs to the shared queue
+	void release_in_flight_jobs(const std::string& worker);
+
+	// Queues a job, for the worker holding its image if there is one still connected
+	void enqueue_affine_work(QueuedWork work);
+	// Takes the next job for a worker: one for an image it holds, otherwise an unassigned job,
+	// otherwise one from the worker with the most affine work outstanding
+	[[nodiscard]] QueuedWork next_work(const std::string& worker);
+	// Builds the jobs of pending equalisations, computing their mappings in parallel
+	[[nodiscard]] std::vector<WorkPtr> materialise_work(std::vector<QueuedWork> work);
+	[[nodiscard]] bool work_pending();
+	[[nodiscard]] std::size_t pending_work_count();
+	// Returns a departing worker's affine work to the shared queue
+	void release_affine_work(const std::string& worker);
+
+	// Lists the frames in the directory, dispatching their histogram jobs as they are found if
+	// `dispatch` is set
+	[[nodiscard]] std::vector<std::string> scan_frames(const std::filesystem::path& servePath,
+	                                                   bool dispatch);
+	// Queues histogram jobs for frames found while scanning, or restores their histograms
+	void dispatch_scanned_frames(const std::vector<std::string>& frames);
+	void keep_scanned_histogram(const std::string& filename, const StoredHistogram& histogram);
+	// Records the histograms kept while scanning, once frames are tracked
+	void record_scanned_histograms();
+	void track_frames(const std::vector<std::string>& frames);
+	// Adds frames completed after the run started, queueing their histogram jobs
+	void add_frames(std::vector<std::string> frames);
+	// Records a frame's histogram, returning the frame's index unless the frame is unknown or its
+	// histogram was already recorded
+	std::optional<std::size_t> record_frame_histogram(const std::string& filename,
+	                                                  const Histogram& histogram);
+	// The mapping a frame is equalised through, once its histogram and that of the previous frame, or
+	// its smoothing target, are known
+	[[nodiscard]] std::optional<EqualisationHistogramMapping> frame_mapping(std::size_t frame) const;
+	// Whether the histograms a frame's mapping is built from are known, without building it
+	[[nodiscard]] bool frame_mapping_ready(std::size_t frame) const;
+	[[nodiscard]] bool temporal_smoothing() const;
+	// Frames that may have become ready to equalise once a frame's histogram is recorded, computing
+	// any smoothing targets it completes
+	[[nodiscard]] std::vector<std::size_t> dependent_frames(std::size_t frame);
+	// Queues the equalisation of each frame whose histograms are known and whose image from an
+	// earlier run is not current, checking frames in parallel
+	void enqueue_equalisations(const std::vector<std::size_t>& frames);
+	// Queues the equalisations that newly recorded histograms make ready, see `dependent_frames`
+	void enqueue_dependent_equalisations(const std::vector<std::size_t>& recordedFrames);
+	// Releases the histograms that are no longer needed once a frame's mapping is built
+	void mark_mapping_built(std::size_t frame);
+	// Releases a frame's histogram if no mapping or smoothing target still needs it
+	void release_histogram(std::size_t frame);
+	// Queues histogram jobs, or restores histograms, for the frames that fit in the window
+	void feed_histogram_work();
+	// Reads the identity of every frame, for the histogram store and output manifest
+	void identify_frames();
+	void open_histogram_store(const std::filesystem::path& servePath);
+	void open_frame_stream();
+	// Records a frame's histogram from the store if it is unchanged, returning whether it was
+	[[nodiscard]] bool restore_histogram(std::size_t frame);
+	// Keeps a newly computed frame histogram in the store, if there is one
+	void store_histogram(std::size_t frame, const StoredHistogram& histogram);
+	// Records a newly written image in the output manifest, if there is one
+	void record_output(const std::string& filename);
+	// Queues a whole equalised image to be written alongside its input
+	void write_output(const std::string& filename, ImageData imageData);
+	// Records the images written to disk since last called, resuming dispatch once writing has
+	// caught up
+	void complete_output_writes();
+	// Feeds work held back by the frame stream once it has written frames
+	void complete_streamed_frames();
+	// Queues a frame's equalised image on the frame stream, to be written after the frames before it
+	void stream_frame(const std::string& filename, const ImageData& tiffData);
+	// Starts receiving a streamed equalised image, or starts it again, discarding what has arrived
+	void begin_incoming_result(std::uint64_t jobId, const std::string& filename);
+	void append_incoming_result(const WorkerStreamChunkCommand& chunkCommand,
+	                            const std::string& filename);
+	// Completes a streamed image, returning whether it arrived whole. Whole images are written out as
+	// any other equalised image is.
+	[[nodiscard]] bool finish_incoming_result(const WorkerStreamTrailerCommand& trailerCommand,
+	                                          const std::string& filename);
+
+	// Queues the fused job of the first frame, from which the first chain starts
+	void start_fused_chain();
+	// Records a frame's histogram, from either a fused or seeding histogram job, queueing the fused
+	// job of the frame after it
+	void record_fused_histogram(const std::string& filename, const Histogram& histogram);
+	// Starts a new chain in the middle of the longest run of unstarted frames, returning whether
+	// there was a run long enough to split
+	bool split_fused_chain();
 
 	void send_work_message(const std::string& worker, zmqpp::message message);
 	void send_communication_message(const std::string& worker, zmqpp::message message);
@@ -65,10 +339,12 @@ protected:
 	void dismiss_worker(const std::string& worker);
 	void dismiss_workers();
 	void send_heartbeats();
+	void report_frame_memory();
+	void report_output_statistics(std::chrono::steady_clock::duration elapsed);
 
 	friend ServerWorkVisitor;
-	friend ServerHistogramCommandVisitor;
-	friend ServerEqualisationCommandVisitor;
+	friend ServerOverlappedCommandVisitor;
+	friend ServerFusedCommandVisitor;
 	friend ServerCommunicationVisitor;
 };
 
@@ -81,36 +357,43 @@ public:
 	void visit_ehlo(const WorkerEhloCommand& ehloCommand) override;
 	void visit_histogram_job(const WorkerHistogramJobCommand& jobCommand) override;
 	void visit_equalisation_job(const WorkerEqualisationJobCommand& jobCommand) override;
+	void visit_fused_job(const WorkerFusedJobCommand& jobCommand) override;
 	void visit_heartbeat(const WorkerHeartbeatCommand& heartbeatCommand) override;
 	void visit_bye(const WorkerByeCommand& byeCommand) override;
+	void visit_unknown_path(const WorkerUnknownPathCommand& unknownPathCommand) override;
 
 protected:
 	Server& server;
 	const std::string& worker_identity;
 };
 
-class ServerHistogramCommandVisitor : public ServerWorkVisitor {
+// Handles both histogram and equalisation results, as the two are interleaved
+class ServerOverlappedCommandVisitor : public ServerWorkVisitor {
 public:
-	ServerHistogramCommandVisitor(Server& server, const std::string& workerIdentity,
-	                              std::map<std::string, Histogram>& workResults);
+	ServerOverlappedCommandVisitor(Server& server, const std::string& workerIdentity,
+	                               size_t& equalisedCount);
 
 	void visit_histogram_result(const WorkerHistogramResultCommand& resultCommand) override;
 	void visit_equalisation_result(const WorkerEqualisationResultCommand& resultCommand) override;
+	void visit_fused_result(const WorkerFusedResultCommand& resultCommand) override;
+	void visit_stream_header(const WorkerStreamHeaderCommand& headerCommand) override;
+	void visit_stream_chunk(const WorkerStreamChunkCommand& chunkCommand) override;
+	void visit_stream_trailer(const WorkerStreamTrailerCommand& trailerCommand) override;
 
 protected:
-	std::map<std::string, Histogram>& histogram_results;
+	size_t& equalised_count;
 };
 
-class ServerEqualisationCommandVisitor : public ServerWorkVisitor {
+class ServerFusedCommandVisitor : public ServerWorkVisitor {
 public:
-	ServerEqualisationCommandVisitor(Server& server, const std::string& workerIdentity,
-	                                 size_t& equalisedCount);
+	ServerFusedCommandVisitor(Server& server, const std::string& workerIdentity, size_t& fusedCount);
 
 	void visit_histogram_result(const WorkerHistogramResultCommand& resultCommand) override;
 	void visit_equalisation_result(const WorkerEqualisationResultCommand& resultCommand) override;
+	void visit_fused_result(const WorkerFusedResultCommand& resultCommand) override;
 
 protected:
-	size_t& equalised_count;
+	size_t& fused_count;
 };
 
 class ServerCommunicationVisitor : public CommandVisitor {
@@ -122,10 +405,12 @@ public:
 	void visit_ehlo(const WorkerEhloCommand& ehloCommand) override;
 	void visit_histogram_job(const WorkerHistogramJobCommand& jobCommand) override;
 	void visit_equalisation_job(const WorkerEqualisationJobCommand& jobCommand) override;
+	void visit_fused_job(const WorkerFusedJobCommand& jobCommand) override;
 	void visit_heartbeat(const WorkerHeartbeatCommand& heartbeatCommand) override;
 	void visit_bye(const WorkerByeCommand& byeCommand) override;
 	void visit_histogram_result(const WorkerHistogramResultCommand& resultCommand) override;
 	void visit_equalisation_result(const WorkerEqualisationResultCommand& resultCommand) override;
+	void visit_fused_result(const WorkerFusedResultCommand& resultCommand) override;
 
 protected:
 	Server& server;
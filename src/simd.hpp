@@ -0,0 +1,39 @@
+#pragma once
+
+// Shared helpers for the runtime-dispatched SIMD kernels. Kernels are compiled with per-function
+// target attributes, so the binary still runs on CPUs without the extensions, and are only called
+// after checking the running CPU supports them.
+
+#if defined(__x86_64__) || defined(__i386__)
+#	include <immintrin.h>
+#	define SIMD_X86_KERNELS 1
+#else
+#	define SIMD_X86_KERNELS 0
+#endif
+
+// GCC's intrinsic headers self-initialise their undefined vectors, which trips
+// -Wmaybe-uninitialized in target-attributed functions.
+#if defined(__GNUC__) && !defined(__clang__)
+#	define SIMD_KERNELS_BEGIN                                                                      \
+		_Pragma("GCC diagnostic push") _Pragma("GCC diagnostic ignored \"-Wmaybe-uninitialized\"")
+#	define SIMD_KERNELS_END _Pragma("GCC diagnostic pop")
+#else
+#	define SIMD_KERNELS_BEGIN
+#	define SIMD_KERNELS_END
+#endif
+
+inline bool cpu_supports_avx2() {
+#if SIMD_X86_KERNELS
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+	return false;
+#endif
+}
+
+inline bool cpu_supports_avx512() {
+#if SIMD_X86_KERNELS
+	return __builtin_cpu_supports("avx512f");
+#else
+	return false;
+#endif
+}
@@ -0,0 +1,80 @@
+#include "smoothing.hpp"
+
+#include <cassert>
+
+#include "simd.hpp"
+
+static_assert(HISTOGRAM_SEGMENTS % 4 == 0, "Window kernels process four bins at a time");
+
+// A histogram with nothing in it, removed from the window while it is still filling
+static const Histogram EMPTY_HISTOGRAM{};
+
+#if SIMD_X86_KERNELS
+
+SIMD_KERNELS_BEGIN
+
+__attribute__((target("avx2"))) static void
+slide_sums_avx2(double* sums, const float* entering, const float* leaving) {
+	for (std::size_t bin = 0; bin < HISTOGRAM_SEGMENTS; bin += 4) {
+		const __m256d difference = _mm256_sub_pd(_mm256_cvtps_pd(_mm_loadu_ps(entering + bin)),
+		                                         _mm256_cvtps_pd(_mm_loadu_ps(leaving + bin)));
+		_mm256_storeu_pd(sums + bin, _mm256_add_pd(_mm256_loadu_pd(sums + bin), difference));
+	}
+}
+
+__attribute__((target("avx2"))) static void mean_avx2(float* mean, const double* sums,
+                                                      const double scale) {
+	const __m256d scales = _mm256_set1_pd(scale);
+
+	for (std::size_t bin = 0; bin < HISTOGRAM_SEGMENTS; bin += 4) {
+		_mm_storeu_ps(mean + bin, _mm256_cvtpd_ps(_mm256_mul_pd(_mm256_loadu_pd(sums + bin), scales)));
+	}
+}
+
+SIMD_KERNELS_END
+
+#endif
+
+HistogramWindow::HistogramWindow() : sums{}, count{ 0 } {}
+
+void HistogramWindow::slide(const Histogram& entering, const Histogram* leaving) {
+	if (leaving == nullptr) {
+		count++;
+		leaving = &EMPTY_HISTOGRAM;
+	}
+
+#if SIMD_X86_KERNELS
+	if (cpu_supports_avx2()) {
+		slide_sums_avx2(sums.data(), entering.data(), leaving->data());
+		return;
+	}
+#endif
+
+	for (std::size_t bin = 0; bin < HISTOGRAM_SEGMENTS; bin++) {
+		sums[bin] += static_cast<double>(entering[bin]) - static_cast<double>((*leaving)[bin]);
+	}
+}
+
+Histogram HistogramWindow::mean() const {
+	assert(count != 0);
+
+	const double scale = 1.0 / static_cast<double>(count);
+	Histogram mean{};
+
+#if SIMD_X86_KERNELS
+	if (cpu_supports_avx2()) {
+		mean_avx2(mean.data(), sums.data(), scale);
+		return mean;
+	}
+#endif
+
+	for (std::size_t bin = 0; bin < HISTOGRAM_SEGMENTS; bin++) {
+		mean[bin] = static_cast<float>(sums[bin] * scale);
+	}
+
+	return mean;
+}
+
+std::size_t HistogramWindow::size() const {
+	return count;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+
+#include "algorithm.hpp"
+#include "config.hpp"
+
+/**
+ * @brief Running sums of the histograms of a sliding window of frames.
+ *
+ * Frames enter and leave the window one at a time, each updating the sums in O(bins) however long
+ * the window is, so the window's mean histogram is never recomputed from every frame in it. Sums
+ * are kept in double precision, so that adding and later removing a histogram leaves no drift.
+ */
+class HistogramWindow {
+public:
+	HistogramWindow();
+
+	// Adds `entering` to the window, removing `leaving` from it if given
+	void slide(const Histogram& entering, const Histogram* leaving = nullptr);
+
+	// The mean of the histograms in the window, which must not be empty
+	[[nodiscard]] Histogram mean() const;
+	[[nodiscard]] std::size_t size() const;
+
+protected:
+	std::array<double, HISTOGRAM_SEGMENTS> sums;
+	std::size_t count;
+};
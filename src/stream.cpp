@@ -0,0 +1,127 @@
+#include "stream.hpp"
+
+#include <algorithm>
+#include <exception>
+
+#include "config.hpp"
+
+// State of the stream being decoded on this thread. ImageMagick's stream handlers are plain
+// functions, with no way to pass context through to them.
+struct ActiveStream {
+	const StreamBandHandler& handle_band;
+	StreamFormat format;
+	std::vector<Magick::Quantum> band;
+	std::size_t band_rows;
+	std::size_t next_row;
+	bool started;
+	bool abandoned;
+};
+
+static thread_local ActiveStream* activeStream = nullptr;
+
+static std::vector<std::uint8_t> image_icc_profile(const MagickCore::Image* image) {
+	const MagickCore::StringInfo* profile = MagickCore::GetImageProfile(image, "icc");
+
+	if (profile == nullptr) {
+		return {};
+	}
+
+	const std::uint8_t* profileData = MagickCore::GetStringInfoDatum(profile);
+	return std::vector<std::uint8_t>{ profileData,
+		                                profileData + MagickCore::GetStringInfoLength(profile) };
+}
+
+static bool flush_band(ActiveStream& stream) {
+	if (stream.band_rows == 0) {
+		return true;
+	}
+
+	const bool handled = stream.handle_band(stream.format, stream.band.data(),
+	                                        stream.next_row - stream.band_rows, stream.band_rows);
+	stream.band_rows = 0;
+
+	return handled;
+}
+
+// Receives each row from ImageMagick as it is decoded, returning `columns` to continue decoding
+static std::size_t stream_row(const MagickCore::Image* image, const void* pixels,
+                              const std::size_t columns) {
+	ActiveStream& stream = *activeStream;
+
+	if (!stream.started) {
+		stream.format = StreamFormat{ image->columns,
+			                            image->rows,
+			                            image->number_channels,
+			                            image->colorspace,
+			                            image->alpha_trait != MagickCore::UndefinedPixelTrait,
+			                            image->depth,
+			                            image_icc_profile(image) };
+		stream.band.resize(STREAM_BAND_ROWS * stream.format.columns * stream.format.channels);
+		stream.started = true;
+	}
+
+	// Only whole rows of the first frame, in order, can be banded
+	if (stream.abandoned || columns != stream.format.columns ||
+	    image->number_channels != stream.format.channels || stream.next_row >= stream.format.rows) {
+		stream.abandoned = true;
+		return 0;
+	}
+
+	const auto* rowPixels = static_cast<const Magick::Quantum*>(pixels);
+	const std::size_t rowLength = columns * stream.format.channels;
+
+	std::copy(rowPixels, rowPixels + rowLength, stream.band.data() + stream.band_rows * rowLength);
+	stream.band_rows++;
+	stream.next_row++;
+
+	if (stream.band_rows == STREAM_BAND_ROWS) {
+		// Exceptions cannot be allowed to unwind through ImageMagick's C decoders
+		try {
+			stream.abandoned = !flush_band(stream);
+		} catch (...) {
+			stream.abandoned = true;
+		}
+	}
+
+	return stream.abandoned ? 0 : columns;
+}
+
+bool should_stream_image(const std::string& filename) {
+	Magick::Image image{};
+
+	try {
+		image.ping(filename);
+	} catch (Magick::Exception& error) {
+		return false;
+	}
+
+	return static_cast<std::uint64_t>(image.columns()) * image.rows() >= STREAMING_PIXEL_THRESHOLD;
+}
+
+bool stream_image_bands(const std::string& filename, const StreamBandHandler& handleBand) {
+	ActiveStream stream{ handleBand, {}, {}, 0, 0, false, false };
+	MagickCore::ImageInfo* imageInfo = MagickCore::AcquireImageInfo();
+	MagickCore::ExceptionInfo* exception = MagickCore::AcquireExceptionInfo();
+
+	MagickCore::CopyMagickString(imageInfo->filename, filename.c_str(), MagickPathExtent);
+	imageInfo->number_scenes = 1;
+
+	activeStream = &stream;
+	MagickCore::Image* image = MagickCore::ReadStream(imageInfo, &stream_row, exception);
+	activeStream = nullptr;
+
+	if (image != nullptr) {
+		MagickCore::DestroyImageList(image);
+	}
+
+	const bool decoded = exception->severity < MagickCore::ErrorException;
+
+	MagickCore::DestroyExceptionInfo(exception);
+	MagickCore::DestroyImageInfo(imageInfo);
+
+	if (!decoded || !stream.started || stream.abandoned || !flush_band(stream)) {
+		return false;
+	}
+
+	return stream.next_row == stream.format.rows;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <Magick++.h>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Layout of the pixels of a streamed image, known once its first row has been decoded
+struct StreamFormat {
+	std::size_t columns;
+	std::size_t rows;
+	std::size_t channels;
+	Magick::ColorspaceType colorspace;
+	bool alpha;
+	std::size_t depth;
+	std::vector<std::uint8_t> icc_profile;
+};
+
+// Handles a band of `rowCount` rows of interleaved pixels, the first of which is row `firstRow` of
+// the image. The pixels may be modified in place. Returning false abandons the stream.
+using StreamBandHandler = std::function<bool(const StreamFormat& format, Magick::Quantum* pixels,
+                                             std::size_t firstRow, std::size_t rowCount)>;
+
+// Whether `filename` has at least STREAMING_PIXEL_THRESHOLD pixels, and so should be streamed
+// rather than read whole. Only the image's header is read.
+bool should_stream_image(const std::string& filename);
+
+/**
+ * @brief Decode the first frame of an image a band of rows at a time.
+ *
+ * Rows are pulled through ImageMagick's pixel stream rather than its pixel cache, and buffered into
+ * bands of STREAM_BAND_ROWS rows, so peak memory is bounded by the band size rather than the image
+ * size. Relies on the coder delivering whole rows from top to bottom, as almost all do. Anything
+ * else (such as tiled TIFFs) abandons the stream.
+ *
+ * @param filename The image to decode
+ * @param handleBand Called with each band of rows in turn
+ * @return Whether every row of the image was streamed and handled. On failure, some bands may
+ * already have been handled.
+ */
+bool stream_image_bands(const std::string& filename, const StreamBandHandler& handleBand);
@@ -0,0 +1,137 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+
+#include "config.hpp"
+
+// Progress of a single `parallel_for` call, shared with any pool threads helping out
+struct ParallelForState {
+	const std::function<void(std::size_t)>& task;
+	const std::size_t count;
+	std::atomic<std::size_t> next;
+	std::size_t completed;
+	std::exception_ptr exception;
+	std::mutex mutex;
+	std::condition_variable condition;
+
+	ParallelForState(const std::function<void(std::size_t)>& task, const std::size_t count)
+	    : task{ task }, count{ count }, next{ 0 }, completed{ 0 }, exception{} {}
+
+	// Claims and runs tasks until none remain unclaimed
+	void run() {
+		for (std::size_t i = next++; i < count; i = next++) {
+			std::exception_ptr taskException{};
+
+			try {
+				task(i);
+			} catch (...) {
+				taskException = std::current_exception();
+			}
+
+			std::unique_lock<std::mutex> lock{ mutex };
+
+			if (taskException && !exception) {
+				exception = taskException;
+			}
+
+			if (++completed == count) {
+				condition.notify_all();
+			}
+		}
+	}
+};
+
+ThreadPool::ThreadPool(const std::size_t threadCount) : stopping{ false } {
+	for (std::size_t i = 0; i < threadCount; i++) {
+		threads.emplace_back(&ThreadPool::run_tasks, this);
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::unique_lock<std::mutex> tasksLock{ this->tasksMutex };
+		this->stopping = true;
+	}
+
+	this->tasksCondition.notify_all();
+
+	for (auto& thread : threads) {
+		thread.join();
+	}
+}
+
+void ThreadPool::parallel_for(const std::size_t count,
+                              const std::function<void(std::size_t)>& task) {
+	if (count == 0) {
+		return;
+	}
+
+	if (count == 1 || threads.empty()) {
+		for (std::size_t i = 0; i < count; i++) {
+			task(i);
+		}
+
+		return;
+	}
+
+	const auto state = std::make_shared<ParallelForState>(task, count);
+	const std::size_t helperCount = std::min(count - 1, threads.size());
+
+	{
+		std::unique_lock<std::mutex> tasksLock{ this->tasksMutex };
+
+		// Helpers only ever touch `task` whilst holding an unfinished claim, so cannot outlive this
+		// call
+		for (std::size_t i = 0; i < helperCount; i++) {
+			this->tasks.emplace_back([state]() { state->run(); });
+		}
+	}
+
+	this->tasksCondition.notify_all();
+	state->run();
+
+	std::unique_lock<std::mutex> lock{ state->mutex };
+	state->condition.wait(lock, [&state]() { return state->completed == state->count; });
+
+	if (state->exception) {
+		std::rethrow_exception(state->exception);
+	}
+}
+
+ThreadPool& ThreadPool::shared() {
+	static ThreadPool sharedPool{ std::max(1U, std::thread::hardware_concurrency()) - 1 };
+	return sharedPool;
+}
+
+void ThreadPool::run_tasks() {
+	while (true) {
+		std::function<void()> task{};
+
+		{
+			std::unique_lock<std::mutex> tasksLock{ this->tasksMutex };
+			this->tasksCondition.wait(tasksLock,
+			                          [this]() { return this->stopping || !this->tasks.empty(); });
+
+			if (this->tasks.empty()) {
+				return;
+			}
+
+			task = std::move(this->tasks.front());
+			this->tasks.pop_front();
+		}
+
+		task();
+	}
+}
+
+std::size_t row_band_count(const std::size_t rows, const std::size_t bandCount) {
+	return std::clamp<std::size_t>(rows / MIN_BAND_ROWS, 1, std::max<std::size_t>(bandCount, 1));
+}
+
+std::pair<std::size_t, std::size_t> band_range(const std::size_t count, const std::size_t bandCount,
+                                               const std::size_t band) {
+	return { count * band / bandCount, count * (band + 1) / bandCount };
+}
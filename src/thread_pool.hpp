@@ -0,0 +1,44 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// A fixed set of threads that the bands of a single image are spread across.
+class ThreadPool {
+public:
+	explicit ThreadPool(std::size_t threadCount);
+	ThreadPool(const ThreadPool& other) = delete;
+	ThreadPool& operator=(const ThreadPool& other) = delete;
+	virtual ~ThreadPool();
+
+	// Runs `task(i)` for each i in [0, count), returning once all have completed. The calling thread
+	// runs tasks too, so any number of threads can share the pool without waiting on one another. The
+	// first exception thrown by a task is rethrown once every task has finished.
+	void parallel_for(std::size_t count, const std::function<void(std::size_t)>& task);
+
+	// The pool shared by every job in this process, with a thread per core
+	static ThreadPool& shared();
+
+protected:
+	void run_tasks();
+
+	std::vector<std::thread> threads;
+	std::deque<std::function<void()>> tasks;
+	std::mutex tasksMutex;
+	std::condition_variable tasksCondition;
+	bool stopping;
+};
+
+// Number of bands to split `rows` image rows into, given `bandCount` are wanted, such that no band
+// has fewer than MIN_BAND_ROWS rows
+std::size_t row_band_count(std::size_t rows, std::size_t bandCount);
+
+// The half open range of items in the `band`th of `bandCount` near equal bands over `count` items
+std::pair<std::size_t, std::size_t> band_range(std::size_t count, std::size_t bandCount,
+                                               std::size_t band);
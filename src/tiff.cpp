@@ -0,0 +1,291 @@
+#include "tiff.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <type_traits>
+#include <utility>
+
+// Rows in each strip of the image data. Small strips keep readers from needing to buffer large runs
+// of the image.
+const constexpr std::size_t TIFF_ROWS_PER_STRIP = 16;
+
+// Room reserved for the image file directory and its values when choosing between TIFF and BigTIFF
+const constexpr std::uint64_t TIFF_DIRECTORY_ALLOWANCE = 1ULL << 20ULL;
+
+enum TiffType : std::uint16_t {
+	TIFF_SHORT = 3,
+	TIFF_LONG = 4,
+	TIFF_RATIONAL = 5,
+	TIFF_UNDEFINED = 7,
+	TIFF_LONG8 = 16,
+};
+
+struct TiffEntry {
+	std::uint16_t tag;
+	TiffType type;
+	std::uint64_t count;
+	std::vector<std::uint8_t> data;
+};
+
+static void append_little_endian(std::vector<std::uint8_t>& output, std::uint64_t value,
+                                 const std::size_t bytes) {
+	for (std::size_t i = 0; i < bytes; i++, value >>= 8U) {
+		output.push_back(static_cast<std::uint8_t>(value & 0xFFU));
+	}
+}
+
+// Converts `count` quantums to samples the width of `Sample`, stored little endian at
+// `destination`. Integer quantums are scaled exactly in integers, which is a plain copy when the
+// depths match, and every loop stores straight into the output so it can be vectorised.
+template <typename Sample>
+static void encode_samples(const Magick::Quantum* pixels, const std::size_t count,
+                           std::uint8_t* destination) {
+	constexpr std::uint64_t sampleMax = std::numeric_limits<Sample>::max();
+
+	const auto store = [destination](const std::size_t i, const Sample sample) {
+		for (std::size_t byte = 0; byte < sizeof(Sample); byte++) {
+			destination[i * sizeof(Sample) + byte] = static_cast<std::uint8_t>(sample >> (8 * byte));
+		}
+	};
+
+	if constexpr (std::is_integral_v<Magick::Quantum>) {
+		constexpr auto quantumRange = static_cast<std::uint64_t>(QuantumRange);
+
+		if constexpr (quantumRange == sampleMax) {
+			for (std::size_t i = 0; i < count; i++) {
+				store(i, static_cast<Sample>(pixels[i]));
+			}
+		} else {
+			// Narrower arithmetic, where it cannot overflow, lets the division by a constant vectorise
+			using Wide = std::conditional_t<2 * quantumRange * sampleMax + quantumRange <=
+			                                    std::numeric_limits<std::uint32_t>::max(),
+			                                std::uint32_t, std::uint64_t>;
+			constexpr auto range = static_cast<Wide>(quantumRange);
+			constexpr auto max = static_cast<Wide>(sampleMax);
+
+			// Rounds to the nearest sample, as `quantum * sampleMax / quantumRange + 0.5` does
+			for (std::size_t i = 0; i < count; i++) {
+				const auto quantum = static_cast<Wide>(pixels[i]);
+				store(i, static_cast<Sample>((2 * quantum * max + range) / (2 * range)));
+			}
+		}
+	} else {
+		const double scale = static_cast<double>(sampleMax) / QuantumRange;
+
+		for (std::size_t i = 0; i < count; i++) {
+			const double quantum = std::clamp<double>(pixels[i], 0.0, QuantumRange);
+			store(i, static_cast<Sample>(quantum * scale + 0.5));
+		}
+	}
+}
+
+static TiffEntry tiff_entry(const std::uint16_t tag, const TiffType type,
+                            const std::vector<std::uint64_t>& values) {
+	const std::size_t bytes = (type == TIFF_SHORT) ? 2 : (type == TIFF_LONG) ? 4 : 8;
+	TiffEntry entry{ tag, type, values.size(), {} };
+
+	for (const auto value : values) {
+		append_little_endian(entry.data, value, bytes);
+	}
+
+	return entry;
+}
+
+// Header size, and the size of offsets and counts, in classic TIFF and BigTIFF respectively
+static std::size_t header_size(const bool bigTiff) {
+	return bigTiff ? 16 : 8;
+}
+
+static std::size_t offset_size(const bool bigTiff) {
+	return bigTiff ? 8 : 4;
+}
+
+static bool requires_big_tiff(const std::size_t columns, const std::size_t rows,
+                              const std::size_t channels, const std::size_t bitsPerSample,
+                              const std::size_t iccProfileSize) {
+	const std::uint64_t dataSize =
+	    static_cast<std::uint64_t>(columns) * rows * channels * (bitsPerSample / 8);
+
+	return dataSize + iccProfileSize + TIFF_DIRECTORY_ALLOWANCE >
+	       std::numeric_limits<std::uint32_t>::max();
+}
+
+static void align_output(std::vector<std::uint8_t>& output) {
+	// Offsets must be word aligned
+	if (output.size() % 2 != 0) {
+		output.push_back(0);
+	}
+}
+
+// Appends the image file directory, with the values that do not fit in its entries written ahead of
+// it, and points the header at it
+static void append_directory(std::vector<std::uint8_t>& output,
+                             const std::vector<TiffEntry>& entries, const bool bigTiff) {
+	const std::size_t inlineSize = offset_size(bigTiff);
+	std::vector<std::uint64_t> valueOffsets(entries.size());
+
+	for (std::size_t i = 0; i < entries.size(); i++) {
+		if (entries[i].data.size() > inlineSize) {
+			align_output(output);
+			valueOffsets[i] = output.size();
+			output.insert(output.end(), entries[i].data.begin(), entries[i].data.end());
+		}
+	}
+
+	align_output(output);
+	const std::uint64_t directoryOffset = output.size();
+
+	append_little_endian(output, entries.size(), bigTiff ? 8 : 2);
+
+	for (std::size_t i = 0; i < entries.size(); i++) {
+		const auto& entry = entries[i];
+
+		append_little_endian(output, entry.tag, 2);
+		append_little_endian(output, entry.type, 2);
+		append_little_endian(output, entry.count, offset_size(bigTiff));
+
+		if (entry.data.size() > inlineSize) {
+			append_little_endian(output, valueOffsets[i], inlineSize);
+		} else {
+			output.insert(output.end(), entry.data.begin(), entry.data.end());
+			output.insert(output.end(), inlineSize - entry.data.size(), 0);
+		}
+	}
+
+	// No further directories
+	append_little_endian(output, 0, offset_size(bigTiff));
+	align_output(output);
+
+	// Point the header at the directory
+	std::vector<std::uint8_t> encodedOffset{};
+	append_little_endian(encodedOffset, directoryOffset, offset_size(bigTiff));
+	std::copy(encodedOffset.begin(), encodedOffset.end(),
+	          output.begin() + static_cast<std::ptrdiff_t>(header_size(bigTiff) - inlineSize));
+}
+
+TiffEncoder::TiffEncoder(const std::size_t columns, const std::size_t rows,
+                         const std::size_t channels, const std::size_t bitsPerSample,
+                         std::vector<std::uint8_t> iccProfile)
+    : columns{ columns }, rows{ rows }, channels{ channels }, bits_per_sample{ bitsPerSample },
+      icc_profile{ std::move(iccProfile) },
+      big_tiff{ requires_big_tiff(columns, rows, channels, bitsPerSample, icc_profile.size()) },
+      rows_written{ 0 }, output_taken{ false }, output{} {
+	assert(channels == 3 || channels == 4);
+	assert(bitsPerSample == 8 || bitsPerSample == 16);
+
+	// Little endian header, with the directory offset filled in by `write_directory`
+	output.push_back('I');
+	output.push_back('I');
+
+	if (big_tiff) {
+		append_little_endian(output, 43, 2);
+		append_little_endian(output, 8, 2);
+		append_little_endian(output, 0, 2);
+	} else {
+		append_little_endian(output, 42, 2);
+	}
+
+	append_little_endian(output, 0, offset_size(big_tiff));
+
+	this->write_directory();
+}
+
+void TiffEncoder::write_rows(const Magick::Quantum* pixels, const std::size_t rowCount) {
+	assert(rows_written + rowCount <= rows);
+
+	const std::size_t sampleCount = rowCount * columns * channels;
+	const std::size_t sampleBytes = bits_per_sample / 8;
+	const std::size_t bandOffset = output.size();
+
+	// Room for the rest of the image at once, unless rows are taken as they are written
+	if (output.capacity() < bandOffset + sampleCount * sampleBytes) {
+		const std::size_t remainingRows = output_taken ? rowCount : rows - rows_written;
+		output.reserve(bandOffset + remainingRows * columns * channels * sampleBytes);
+	}
+
+	output.resize(bandOffset + sampleCount * sampleBytes);
+
+	if (bits_per_sample == 16) {
+		encode_samples<std::uint16_t>(pixels, sampleCount, output.data() + bandOffset);
+	} else {
+		encode_samples<std::uint8_t>(pixels, sampleCount, output.data() + bandOffset);
+	}
+
+	rows_written += rowCount;
+}
+
+std::vector<std::uint8_t> TiffEncoder::take_output() {
+	output_taken = true;
+
+	std::vector<std::uint8_t> taken{};
+	taken.swap(output);
+	return taken;
+}
+
+std::vector<std::uint8_t> TiffEncoder::finish() {
+	assert(rows_written == rows);
+
+	return std::move(output);
+}
+
+std::vector<TiffEntry> TiffEncoder::directory_entries(const std::uint64_t dataOffset) const {
+	const std::size_t rowBytes = columns * channels * (bits_per_sample / 8);
+	const TiffType offsetType = big_tiff ? TIFF_LONG8 : TIFF_LONG;
+	std::vector<std::uint64_t> stripOffsets{};
+	std::vector<std::uint64_t> stripByteCounts{};
+
+	for (std::size_t row = 0; row < rows; row += TIFF_ROWS_PER_STRIP) {
+		stripOffsets.push_back(dataOffset + row * rowBytes);
+		stripByteCounts.push_back(std::min(TIFF_ROWS_PER_STRIP, rows - row) * rowBytes);
+	}
+
+	std::vector<TiffEntry> entries{
+		tiff_entry(256, TIFF_LONG, { columns }),
+		tiff_entry(257, TIFF_LONG, { rows }),
+		tiff_entry(258, TIFF_SHORT, std::vector<std::uint64_t>(channels, bits_per_sample)),
+		tiff_entry(259, TIFF_SHORT, { 1 }), // No compression
+		tiff_entry(262, TIFF_SHORT, { 2 }), // RGB
+		tiff_entry(273, offsetType, stripOffsets),
+		tiff_entry(277, TIFF_SHORT, { channels }),
+		tiff_entry(278, TIFF_LONG, { TIFF_ROWS_PER_STRIP }),
+		tiff_entry(279, offsetType, stripByteCounts),
+		tiff_entry(282, TIFF_RATIONAL, {}),
+		tiff_entry(283, TIFF_RATIONAL, {}),
+		tiff_entry(284, TIFF_SHORT, { 1 }), // Chunky (interleaved) samples
+		tiff_entry(296, TIFF_SHORT, { 2 }), // Resolution in inches
+	};
+
+	// 72 dots per inch, as a numerator and denominator pair
+	for (auto& entry : entries) {
+		if (entry.type == TIFF_RATIONAL) {
+			entry.count = 1;
+			append_little_endian(entry.data, 72, 4);
+			append_little_endian(entry.data, 1, 4);
+		}
+	}
+
+	if (channels == 4) {
+		entries.push_back(tiff_entry(338, TIFF_SHORT, { 2 })); // Unassociated alpha
+	}
+
+	if (!icc_profile.empty()) {
+		entries.push_back(TiffEntry{ 34675, TIFF_UNDEFINED, icc_profile.size(), icc_profile });
+	}
+
+	return entries;
+}
+
+void TiffEncoder::write_directory() {
+	// The directory is written ahead of the image data, so that rows can be taken from the encoder as
+	// soon as they are written. Its size does not depend on where the data starts, so it is laid out
+	// once to find where that is.
+	std::vector<std::uint8_t> layout{ output };
+	append_directory(layout, this->directory_entries(0), big_tiff);
+
+	const std::uint64_t dataOffset = layout.size();
+	append_directory(output, this->directory_entries(dataOffset), big_tiff);
+
+	assert(output.size() == dataOffset);
+}
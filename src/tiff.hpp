@@ -0,0 +1,52 @@
+#pragma once
+
+#include <Magick++.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct TiffEntry;
+
+/**
+ * @brief Encodes an uncompressed RGB(A) TIFF a band of rows at a time.
+ *
+ * Rows are converted straight into the output, so the image never needs to be held as pixels. The
+ * image file directory is written first, so the file may be taken a band of rows at a time.
+ * Images too large for classic TIFF's 32 bit offsets are written as BigTIFF.
+ */
+class TiffEncoder {
+public:
+	/**
+	 * @param columns Width of the image in pixels
+	 * @param rows Height of the image in pixels
+	 * @param channels Quantums per pixel, 3 for RGB or 4 for RGBA
+	 * @param bitsPerSample Output depth, 8 or 16
+	 * @param iccProfile Colour profile to embed, if not empty
+	 */
+	TiffEncoder(std::size_t columns, std::size_t rows, std::size_t channels,
+	            std::size_t bitsPerSample, std::vector<std::uint8_t> iccProfile = {});
+
+	// Appends `rowCount` rows of interleaved quantums to the image
+	void write_rows(const Magick::Quantum* pixels, std::size_t rowCount);
+
+	// Takes the part of the file encoded since it was last taken, so the file can be sent on as it is
+	// encoded rather than held whole
+	std::vector<std::uint8_t> take_output();
+
+	// Completes the TIFF, once every row has been written, returning the rest of the encoded file
+	std::vector<std::uint8_t> finish();
+
+protected:
+	[[nodiscard]] std::vector<TiffEntry> directory_entries(std::uint64_t dataOffset) const;
+	void write_directory();
+
+	const std::size_t columns;
+	const std::size_t rows;
+	const std::size_t channels;
+	const std::size_t bits_per_sample;
+	const std::vector<std::uint8_t> icc_profile;
+	const bool big_tiff;
+	std::size_t rows_written;
+	bool output_taken;
+	std::vector<std::uint8_t> output;
+};
@@ -1,5 +1,6 @@
 #include "worker.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <climits>
 #include <mutex>
@@ -11,6 +12,7 @@
 #include <zmqpp/socket_types.hpp>
 
 #include "protocol.hpp"
+#include "result_stream.hpp"
 
 // Command visitor to use whilst connecting to a server
 class ConnectingWorkerCommandVisitor : public CommandVisitor {
@@ -33,8 +35,10 @@ public:
 	void visit_ehlo(const WorkerEhloCommand& ehloCommand) override;
 	void visit_histogram_job(const WorkerHistogramJobCommand& jobCommand) override;
 	void visit_equalisation_job(const WorkerEqualisationJobCommand& jobCommand) override;
+	void visit_fused_job(const WorkerFusedJobCommand& jobCommand) override;
 	void visit_histogram_result(const WorkerHistogramResultCommand& resultCommand) override;
 	void visit_equalisation_result(const WorkerEqualisationResultCommand& resultCommand) override;
+	void visit_fused_result(const WorkerFusedResultCommand& resultCommand) override;
 	void visit_heartbeat(const WorkerHeartbeatCommand& heartbeatCommand) override;
 	void visit_bye(const WorkerByeCommand& byeCommand) override;
 
@@ -49,6 +53,7 @@ public:
 
 	void visit_histogram_job(const WorkerHistogramJobCommand& jobCommand) override;
 	void visit_equalisation_job(const WorkerEqualisationJobCommand& jobCommand) override;
+	void visit_fused_job(const WorkerFusedJobCommand& jobCommand) override;
 
 protected:
 	ServerConnection& connection;
@@ -72,20 +77,20 @@ ServerConnection::ServerConnection(const std::string& name, const std::string& a
                                    const uint16_t workPort, std::uint16_t communicationPort)
     : serverDetails{ name, address, workPort, communicationPort }, workSocket{},
       communicationSocket{}, currentState{ ServerConnection::State::Unconnected },
-      finishedSemaphore{ 0 }, jobsSemaphore{ 0 } {
+      finishedSemaphore{ 0 }, runningJobs{ 0 }, jobsSemaphore{ 0 } {
 	assert(address.length() == 4 || address.length() == 16);
 }
 
 ServerConnection::ServerConnection(ServerDetails serverDetails)
     : serverDetails{ std::move(serverDetails) }, workSocket{}, communicationSocket{},
-      currentState{ ServerConnection::State::Unconnected }, finishedSemaphore{ 0 }, jobsSemaphore{
-	      0
-      } {}
+      currentState{ ServerConnection::State::Unconnected }, finishedSemaphore{ 0 },
+      runningJobs{ 0 }, jobsSemaphore{ 0 } {}
 
 ServerConnection::ServerConnection(ServerConnection&& other) noexcept
     : serverDetails{ std::move(other.serverDetails) }, workSocket{ std::move(other.workSocket) },
       communicationSocket{ std::move(other.communicationSocket) },
-      currentState{ other.currentState }, finishedSemaphore{ 0 }, jobsSemaphore{ 0 } {}
+      currentState{ other.currentState }, finishedSemaphore{ 0 }, runningJobs{ 0 },
+      jobsSemaphore{ 0 } {}
 
 ServerConnection::~ServerConnection() {
 	this->disconnect();
@@ -159,6 +164,9 @@ void ServerConnection::background_task() {
 		while (const auto job = this->pop_job()) {
 			RunningWorkerCommandVisitor visitor{ *this };
 			job.value()->visit(visitor);
+
+			std::unique_lock<std::mutex> jobsLock{ this->jobsMutex };
+			this->runningJobs--;
 		}
 
 		this->jobsSemaphore.acquire();
@@ -229,6 +237,7 @@ std::optional<std::unique_ptr<WorkerJobCommand>> ServerConnection::pop_job() {
 
 	auto job = std::move(this->jobs.back());
 	this->jobs.pop_back();
+	this->runningJobs++;
 	return std::move(job);
 }
 
@@ -282,10 +291,30 @@ void ServerConnection::schedule_job(std::unique_ptr<WorkerJobCommand> job) {
 	assert(job);
 
 	std::unique_lock<std::mutex> jobsLock{ this->jobsMutex };
+
+	// Have the server send the job again with its path in full, rather than leave it outstanding
+	if (!job->resolve_path(this->knownPaths)) {
+		jobsLock.unlock();
+		std::clog << "Declining job " << job->get_job_id() << " for an unknown path\n";
+		this->send_work_message(WorkerUnknownPathCommand{ job->get_job_id() }.to_message());
+		return;
+	}
+
 	this->jobs.push_back(std::move(job));
 	this->notify_job();
 }
 
+std::size_t ServerConnection::job_band_count() {
+	std::unique_lock<std::mutex> jobsLock{ this->jobsMutex };
+	const std::size_t jobCount = std::max<std::size_t>(this->jobs.size() + this->runningJobs, 1);
+
+	return std::max<std::size_t>(THREAD_COUNT / jobCount, 1);
+}
+
+DecodedImageCache& ServerConnection::image_cache() {
+	return this->imageCache;
+}
+
 void ServerConnection::notify_job() {
 	this->jobsSemaphore.release();
 }
@@ -415,6 +444,12 @@ void CommunicatingWorkerCommandVisitor::visit_equalisation_job(
 	this->connection.schedule_job(std::make_unique<WorkerEqualisationJobCommand>(jobCommand));
 }
 
+void CommunicatingWorkerCommandVisitor::visit_fused_job(const WorkerFusedJobCommand& jobCommand) {
+	/* Schedule job. */
+	DEBUG_NETWORK("Visited server Fused Job: " << jobCommand.get_filename() << "\n");
+	this->connection.schedule_job(std::make_unique<WorkerFusedJobCommand>(jobCommand));
+}
+
 void CommunicatingWorkerCommandVisitor::visit_histogram_result(
     const WorkerHistogramResultCommand& resultCommand) {
 	/* Ignore unexpected message. */
@@ -427,6 +462,12 @@ void CommunicatingWorkerCommandVisitor::visit_equalisation_result(
 	DEBUG_NETWORK("Visited server Result (unexpected)\n");
 }
 
+void CommunicatingWorkerCommandVisitor::visit_fused_result(
+    const WorkerFusedResultCommand& resultCommand) {
+	/* Ignore unexpected message. */
+	DEBUG_NETWORK("Visited server Result (unexpected)\n");
+}
+
 void CommunicatingWorkerCommandVisitor::visit_heartbeat(
     const WorkerHeartbeatCommand& heartbeatCommand) {
 	/* Respond with the same heartbeat data. */
@@ -461,13 +502,17 @@ RunningWorkerCommandVisitor::RunningWorkerCommandVisitor(ServerConnection& conne
 void RunningWorkerCommandVisitor::visit_histogram_job(const WorkerHistogramJobCommand& jobCommand) {
 	/* Run job. */
 	DEBUG_NETWORK("Running Histogram Job: " << jobCommand.get_filename() << "\n");
-	std::optional<Histogram> histogram = image_get_histogram(jobCommand.get_filename());
+	std::optional<SampledHistogram> histogram =
+	    image_get_histogram(jobCommand.get_filename(), jobCommand.get_sample_budget(),
+	                        jobCommand.get_decode_size(), this->connection.job_band_count(),
+	                        &this->connection.image_cache());
 
 	assert(histogram);
 
-	zmqpp::message response{
-		WorkerHistogramResultCommand{ jobCommand.get_filename(), *histogram }.to_message()
-	};
+	zmqpp::message response{ WorkerHistogramResultCommand{ jobCommand.get_job_id(),
+		                                                     histogram->histogram,
+		                                                     histogram->cdf_error_bound }
+		                         .to_message() };
 
 	this->connection.send_work_message(std::move(response));
 }
@@ -476,12 +521,28 @@ void RunningWorkerCommandVisitor::visit_equalisation_job(
     const WorkerEqualisationJobCommand& jobCommand) {
 	/* Run job. */
 	DEBUG_NETWORK("Running Equalisation Job: " << jobCommand.get_filename() << "\n");
-	std::vector<std::uint8_t> tiffFile =
-	    image_equalise(jobCommand.get_filename(), jobCommand.get_histogram_mapping());
+	// The image is streamed back as it is encoded, so the server can write it out as it arrives
+	OutgoingResultStream resultStream{ this->connection, jobCommand.get_job_id() };
 
-	zmqpp::message response{
-		WorkerEqualisationResultCommand{ jobCommand.get_filename(), tiffFile }.to_message()
-	};
+	image_equalise(resultStream, jobCommand.get_filename(), jobCommand.get_histogram_mapping(),
+	               this->connection.job_band_count(), &this->connection.image_cache(),
+	               jobCommand.get_output_encoding());
 
-	this->connection.send_work_message(std::move(response));
+	resultStream.finish();
+}
+
+void RunningWorkerCommandVisitor::visit_fused_job(const WorkerFusedJobCommand& jobCommand) {
+	/* Run job. */
+	DEBUG_NETWORK("Running Fused Job: " << jobCommand.get_filename() << "\n");
+	FusedEqualisation result = image_histogram_equalise(
+	    jobCommand.get_filename(), jobCommand.get_previous_histogram(),
+	    jobCommand.get_sample_budget(), this->connection.job_band_count(),
+	    &this->connection.image_cache(), jobCommand.get_output_encoding());
+
+	const WorkerFusedResultCommand resultCommand{ jobCommand.get_job_id(),
+		                                            result.histogram.histogram,
+		                                            result.histogram.cdf_error_bound,
+		                                            std::move(result.tiff_data) };
+
+	this->connection.send_work_message(resultCommand.to_message());
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "config.hpp"
+#include "image_cache.hpp"
 #include "semaphore.hpp"
 
 #include <atomic>
@@ -77,6 +78,13 @@ public:
 	void notify_dying();
 	void notify_job();
 
+	// Row bands to split the next job's image into. Whilst fewer jobs are queued or running than
+	// there are threads, each job is split across the otherwise idle cores.
+	std::size_t job_band_count();
+
+	// Images decoded by histogram jobs, kept for the equalisation jobs of the same images
+	DecodedImageCache& image_cache();
+
 	static std::string generate_random_id();
 
 protected:
@@ -97,7 +105,11 @@ protected:
 	mutable std::mutex currentStateMutex;
 	std::binary_semaphore finishedSemaphore;
 	std::vector<std::unique_ptr<WorkerJobCommand>> jobs;
+	std::uint32_t runningJobs;
 	std::mutex jobsMutex;
+	// Paths the server has sent in full, by the ID later jobs for them refer to them by
+	std::vector<std::string> knownPaths;
+	DecodedImageCache imageCache;
 
 	// Can use std C++ semaphores if your implementation correctly implements semaphore wake semantics
 	// std::counting_semaphore<MAX_HARDWARE_CONCURRENCY> jobsSemaphore;